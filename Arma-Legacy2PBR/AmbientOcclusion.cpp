@@ -0,0 +1,244 @@
+#include "AmbientOcclusion.h"
+#include "CpuDispatch.h"
+#include "Kernels.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <vector>
+
+// Larger side of the reduced resolution; AO is low frequency, so finer detail would not change it
+static const unsigned aoResolution = 512;
+// Jacobi sweeps per pyramid level, after the coarsest level has converged
+static const unsigned coarseIterations = 200;
+static const unsigned levelIterations = 30;
+// Step lengths along each direction, in reduced-resolution texels
+static const int horizonStepLengths[horizonSteps] = { 1, 2, 3, 5, 8, 12 };
+
+static void parallelRows(unsigned threads, unsigned rows, const std::function<void(unsigned)>& body) {
+    ProfileTags tags = getProfileTags();
+    auto run = [&](unsigned first) {
+        setProfileTags(tags);
+        for (unsigned y = first; y < rows; y += threads) {
+            body(y);
+        }
+    };
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < std::min(threads, rows); ++i) {
+        workers.emplace_back(run, i);
+    }
+    run(0);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+static unsigned wrap(int value, unsigned size) {
+    int modulo = value % int(size);
+    return unsigned(modulo < 0 ? modulo + int(size) : modulo);
+}
+
+struct SlopeField {
+    unsigned width = 0;
+    unsigned height = 0;
+    // Height change to the next texel right and up, in full-resolution texels
+    std::vector<float> dx;
+    std::vector<float> dy;
+};
+
+// Every coarser level halves the texels, so each step covers twice the height change
+static SlopeField halveSlopes(const SlopeField& fine) {
+    SlopeField coarse;
+    coarse.width = (fine.width + 1) / 2;
+    coarse.height = (fine.height + 1) / 2;
+    coarse.dx.assign(size_t(coarse.width) * coarse.height, 0.0f);
+    coarse.dy.assign(size_t(coarse.width) * coarse.height, 0.0f);
+    for (unsigned y = 0; y < coarse.height; ++y) {
+        for (unsigned x = 0; x < coarse.width; ++x) {
+            float dx = 0.0f, dy = 0.0f;
+            for (unsigned i = 0; i < 4; ++i) {
+                size_t index = size_t(std::min(2 * y + i / 2, fine.height - 1)) * fine.width + std::min(2 * x + i % 2, fine.width - 1);
+                dx += fine.dx[index];
+                dy += fine.dy[index];
+            }
+            coarse.dx[size_t(y) * coarse.width + x] = dx * 0.5f;
+            coarse.dy[size_t(y) * coarse.width + x] = dy * 0.5f;
+        }
+    }
+    return coarse;
+}
+
+// Jacobi sweeps of the Poisson equation lap(h) = div(slopes), wrapping at the edges like a tiling texture
+static void relaxHeights(const SlopeField& slopes, std::vector<float>& heights, unsigned iterations) {
+    unsigned w = slopes.width, h = slopes.height;
+    std::vector<float> divergence(heights.size());
+    for (unsigned y = 0; y < h; ++y) {
+        for (unsigned x = 0; x < w; ++x) {
+            size_t index = size_t(y) * w + x;
+            divergence[index] = slopes.dx[index] - slopes.dx[size_t(y) * w + wrap(int(x) - 1, w)] +
+                slopes.dy[index] - slopes.dy[size_t(wrap(int(y) - 1, h)) * w + x];
+        }
+    }
+    std::vector<float> next(heights.size());
+    for (unsigned iteration = 0; iteration < iterations; ++iteration) {
+        for (unsigned y = 0; y < h; ++y) {
+            const float* row = heights.data() + size_t(y) * w;
+            const float* below = heights.data() + size_t(wrap(int(y) - 1, h)) * w;
+            const float* above = heights.data() + size_t(wrap(int(y) + 1, h)) * w;
+            const float* source = divergence.data() + size_t(y) * w;
+            float* target = next.data() + size_t(y) * w;
+            // Only the first and last texel of a row wrap; the loop between them vectorizes
+            target[0] = (row[w - 1] + row[std::min(1u, w - 1)] + below[0] + above[0] - source[0]) * 0.25f;
+            for (unsigned x = 1; x + 1 < w; ++x) {
+                target[x] = (row[x - 1] + row[x + 1] + below[x] + above[x] - source[x]) * 0.25f;
+            }
+            if (w > 1) {
+                target[w - 1] = (row[w - 2] + row[0] + below[w - 1] + above[w - 1] - source[w - 1]) * 0.25f;
+            }
+        }
+        heights.swap(next);
+    }
+}
+
+// Coarse to fine: the coarsest level converges fully, every finer one starts from the level below
+static std::vector<float> integrateHeights(const SlopeField& slopes) {
+    std::vector<SlopeField> levels = { slopes };
+    while (levels.back().width > 16 && levels.back().height > 16) {
+        levels.push_back(halveSlopes(levels.back()));
+    }
+    std::vector<float> heights(size_t(levels.back().width) * levels.back().height, 0.0f);
+    relaxHeights(levels.back(), heights, coarseIterations);
+    for (size_t level = levels.size() - 1; level-- > 0;) {
+        const SlopeField& coarse = levels[level + 1];
+        const SlopeField& fine = levels[level];
+        std::vector<float> upsampled(size_t(fine.width) * fine.height);
+        for (unsigned y = 0; y < fine.height; ++y) {
+            for (unsigned x = 0; x < fine.width; ++x) {
+                upsampled[size_t(y) * fine.width + x] = heights[size_t(std::min(y / 2, coarse.height - 1)) * coarse.width + std::min(x / 2, coarse.width - 1)];
+            }
+        }
+        heights.swap(upsampled);
+        relaxHeights(fine, heights, levelIterations);
+    }
+    return heights;
+}
+
+FIBITMAP* bakeAmbientOcclusion(FIBITMAP* nohq, unsigned threads) {
+    unsigned width = FreeImage_GetWidth(nohq);
+    unsigned height = FreeImage_GetHeight(nohq);
+    if (FreeImage_GetBPP(nohq) != 32 || width == 0 || height == 0) {
+        return nullptr;
+    }
+    threads = std::max(1u, threads);
+    unsigned factor = 1;
+    while (std::max(width, height) / factor > aoResolution) {
+        factor *= 2;
+    }
+
+    // Slopes from box-averaged normals (BGRA: R = x, G = y, z rebuilt), scaled to one reduced texel
+    SlopeField slopes;
+    slopes.width = (width + factor - 1) / factor;
+    slopes.height = (height + factor - 1) / factor;
+    slopes.dx.assign(size_t(slopes.width) * slopes.height, 0.0f);
+    slopes.dy.assign(size_t(slopes.width) * slopes.height, 0.0f);
+    std::vector<float> nx(slopes.dx.size()), ny(slopes.dx.size());
+    parallelRows(threads, slopes.height, [&](unsigned cy) {
+        std::vector<uint32_t> sumX(slopes.width, 0), sumY(slopes.width, 0), counts(slopes.width, 0);
+        for (unsigned y = cy * factor; y < std::min(height, (cy + 1) * factor); ++y) {
+            const BYTE* row = FreeImage_GetScanLine(nohq, y);
+            for (unsigned cx = 0; cx < slopes.width; ++cx) {
+                unsigned end = std::min(width, (cx + 1) * factor);
+                uint32_t red = 0, green = 0;
+                for (unsigned x = cx * factor; x < end; ++x) {
+                    red += row[x * 4 + 2];
+                    green += row[x * 4 + 1];
+                }
+                sumX[cx] += red;
+                sumY[cx] += green;
+                counts[cx] += end - cx * factor;
+            }
+        }
+        for (unsigned cx = 0; cx < slopes.width; ++cx) {
+            size_t index = size_t(cy) * slopes.width + cx;
+            nx[index] = float(sumX[cx]) / (127.5f * float(counts[cx])) - 1.0f;
+            ny[index] = float(sumY[cx]) / (127.5f * float(counts[cx])) - 1.0f;
+        }
+    });
+    for (size_t i = 0; i < nx.size(); ++i) {
+        // Near-horizontal normals would give unbounded slopes
+        float nz = std::max(0.2f, std::sqrt(std::max(0.0f, 1.0f - nx[i] * nx[i] - ny[i] * ny[i])));
+        nx[i] = -nx[i] / nz * float(factor);
+        ny[i] = -ny[i] / nz * float(factor);
+    }
+    // Centered slopes averaged onto the edges between texels
+    for (unsigned y = 0; y < slopes.height; ++y) {
+        for (unsigned x = 0; x < slopes.width; ++x) {
+            size_t index = size_t(y) * slopes.width + x;
+            slopes.dx[index] = 0.5f * (nx[index] + nx[size_t(y) * slopes.width + wrap(int(x) + 1, slopes.width)]);
+            slopes.dy[index] = 0.5f * (ny[index] + ny[size_t(wrap(int(y) + 1, slopes.height)) * slopes.width + x]);
+        }
+    }
+    std::vector<float> heights = integrateHeights(slopes);
+
+    // Padded by the longest step on every side, so each sample is a plain offset from its pixel
+    unsigned w = slopes.width, h = slopes.height;
+    const int pad = horizonStepLengths[horizonSteps - 1];
+    size_t stride = size_t(w) + 2 * pad;
+    std::vector<float> padded(stride * (size_t(h) + 2 * pad));
+    for (int y = -pad; y < int(h) + pad; ++y) {
+        for (int x = -pad; x < int(w) + pad; ++x) {
+            padded[size_t(y + pad) * stride + size_t(x + pad)] = heights[size_t(wrap(y, h)) * w + wrap(x, w)];
+        }
+    }
+    HorizonSamples samples;
+    const int directions[horizonDirections][2] = { { 1, 0 }, { 1, 1 }, { 0, 1 }, { -1, 1 }, { -1, 0 }, { -1, -1 }, { 0, -1 }, { 1, -1 } };
+    for (unsigned d = 0; d < horizonDirections; ++d) {
+        float length = std::sqrt(float(directions[d][0] * directions[d][0] + directions[d][1] * directions[d][1]));
+        for (unsigned s = 0; s < horizonSteps; ++s) {
+            int step = horizonStepLengths[s];
+            samples.offsets[d * horizonSteps + s] = ptrdiff_t(directions[d][1] * step) * ptrdiff_t(stride) + directions[d][0] * step;
+            samples.inverseDistances[d * horizonSteps + s] = 1.0f / (float(step) * length * float(factor));
+        }
+    }
+    std::vector<float> ao(size_t(w) * h);
+    const KernelTable& table = kernels();
+    parallelRows(threads, h, [&](unsigned y) {
+        table.horizonAo(ao.data() + size_t(y) * w, padded.data() + size_t(y + pad) * stride + pad, samples, w);
+    });
+
+    // Bilinear upsampling, wrapping like the height field
+    FIBITMAP* result = FreeImage_Allocate(int(width), int(height), 32);
+    if (!result) {
+        return nullptr;
+    }
+    std::vector<unsigned> x0(width), x1(width);
+    std::vector<float> tx(width);
+    for (unsigned x = 0; x < width; ++x) {
+        float position = (float(x) + 0.5f) / float(factor) - 0.5f;
+        float base = std::floor(position);
+        x0[x] = wrap(int(base), w);
+        x1[x] = wrap(int(base) + 1, w);
+        tx[x] = position - base;
+    }
+    parallelRows(threads, height, [&](unsigned y) {
+        float position = (float(y) + 0.5f) / float(factor) - 0.5f;
+        float base = std::floor(position);
+        const float* lower = ao.data() + size_t(wrap(int(base), h)) * w;
+        const float* upper = ao.data() + size_t(wrap(int(base) + 1, h)) * w;
+        float ty = position - base;
+        // Vertical pass on the reduced row first, so each output pixel is one horizontal lerp
+        std::vector<float> blended(w);
+        for (unsigned x = 0; x < w; ++x) {
+            blended[x] = (lower[x] + (upper[x] - lower[x]) * ty) * 255.0f;
+        }
+        uint32_t* row = reinterpret_cast<uint32_t*>(FreeImage_GetScanLine(result, int(y)));
+        for (unsigned x = 0; x < width; ++x) {
+            float value = std::clamp(blended[x0[x]] + (blended[x1[x]] - blended[x0[x]]) * tx[x], 0.0f, 255.0f);
+            row[x] = 0xFF000000u | (uint32_t(value + 0.5f) * 0x010101u);
+        }
+    });
+    return result;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <FreeImage.h>
+
+// Stand-in AS map for sets that have none: heights are integrated from the NOHQ normals at reduced resolution,
+// horizon-based AO is taken over them and upsampled back. Returns a 32-bit gray bitmap the size of nohq
+FIBITMAP* bakeAmbientOcclusion(FIBITMAP* nohq, unsigned threads);
@@ -0,0 +1,272 @@
+#include "ArchiveStream.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+static const size_t tarBlock = 512;
+static const size_t cpioHeaderSize = 110;
+// Larger than any texture; a header claiming more is damaged rather than a reason to allocate
+static const uint64_t maxEntryBytes = 4ull << 30;
+// Long names and pax records
+static const uint64_t maxMetadataBytes = 1 << 20;
+
+void openArchiveStdin(ArchiveStream& stream) {
+#ifdef _WIN32
+    (void)_setmode(_fileno(stdin), _O_BINARY);
+#endif
+    stream = ArchiveStream();
+    stream.file = stdin;
+}
+
+static bool readExactly(ArchiveStream& stream, void* buffer, size_t size) {
+    size_t done = size ? fread(buffer, 1, size, stream.file) : 0;
+    stream.bytesRead += done;
+    return done == size;
+}
+
+// Pipes cannot seek, so skipped data is read through a small buffer
+static bool skipBytes(ArchiveStream& stream, uint64_t size) {
+    char scratch[64 * 1024];
+    while (size > 0) {
+        size_t chunk = size_t(std::min<uint64_t>(size, sizeof(scratch)));
+        if (!readExactly(stream, scratch, chunk)) {
+            return false;
+        }
+        size -= chunk;
+    }
+    return true;
+}
+
+static bool readData(ArchiveStream& stream, uint64_t size, std::vector<BYTE>& data) {
+    try {
+        data.resize(size_t(size));
+    }
+    catch (const std::exception&) {
+        return false;
+    }
+    return readExactly(stream, data.data(), data.size());
+}
+
+// Octal, NUL/space terminated; sizes of 8 GB and more use the GNU base-256 form
+static uint64_t parseTarNumber(const char* field, size_t length) {
+    uint64_t value = 0;
+    if (static_cast<unsigned char>(field[0]) & 0x80) {
+        for (size_t i = 1; i < length; ++i) {
+            value = (value << 8) | static_cast<unsigned char>(field[i]);
+        }
+        return value;
+    }
+    for (size_t i = 0; i < length && field[i]; ++i) {
+        if (field[i] >= '0' && field[i] <= '7') {
+            value = value * 8 + uint64_t(field[i] - '0');
+        }
+    }
+    return value;
+}
+
+static std::string tarString(const char* field, size_t length) {
+    return std::string(field, strnlen(field, length));
+}
+
+// POSIX ustar ("ustar\0" "00") or GNU ("ustar  \0") with a matching header checksum. The checksum is the sum of the
+// header bytes with its own field read as spaces; some old writers summed signed chars
+static bool isValidTarHeader(const char* header) {
+    if (std::memcmp(header + 257, "ustar\0" "00", 8) != 0 && std::memcmp(header + 257, "ustar  \0", 8) != 0) {
+        return false;
+    }
+    uint64_t unsignedSum = 0;
+    int64_t signedSum = 0;
+    for (size_t i = 0; i < tarBlock; ++i) {
+        bool checksumField = i >= 148 && i < 156;
+        unsignedSum += checksumField ? ' ' : static_cast<unsigned char>(header[i]);
+        signedSum += checksumField ? ' ' : static_cast<signed char>(header[i]);
+    }
+    uint64_t stored = parseTarNumber(header + 148, 8);
+    return stored == unsignedSum || int64_t(stored) == signedSum;
+}
+
+// "<length> <key>=<value>\n" records; only the path matters here
+static std::string findPaxPath(const std::vector<BYTE>& data) {
+    std::string text(data.begin(), data.end());
+    size_t position = 0;
+    while (position < text.size()) {
+        size_t space = text.find(' ', position);
+        if (space == std::string::npos) {
+            break;
+        }
+        size_t length = size_t(std::strtoull(text.c_str() + position, nullptr, 10));
+        if (length == 0 || position + length > text.size()) {
+            break;
+        }
+        std::string record = text.substr(space + 1, position + length - space - 2);
+        if (record.compare(0, 5, "path=") == 0) {
+            return record.substr(5);
+        }
+        position += length;
+    }
+    return std::string();
+}
+
+static bool readTarEntry(ArchiveStream& stream, const char* first, std::string& name, std::vector<BYTE>& data, const ArchiveFilter& wanted) {
+    char header[tarBlock];
+    std::memcpy(header, first, tarBlock);
+    std::string longName;
+    for (;;) {
+        bool empty = true;
+        for (size_t i = 0; i < tarBlock && empty; ++i) {
+            empty = header[i] == 0;
+        }
+        if (empty) {
+            stream.ended = true;
+            return false;
+        }
+        uint64_t size = parseTarNumber(header + 124, 12);
+        char type = header[156];
+        if (!isValidTarHeader(header) || size > maxEntryBytes || ((type == 'L' || type == 'x') && size > maxMetadataBytes)) {
+            stream.damaged = true;
+            return false;
+        }
+        uint64_t padding = (tarBlock - size % tarBlock) % tarBlock;
+        if (type == 'L' || type == 'x') {
+            std::vector<BYTE> extra;
+            if (!readData(stream, size, extra) || !skipBytes(stream, padding)) {
+                stream.damaged = true;
+                return false;
+            }
+            longName = type == 'L' ? tarString(reinterpret_cast<const char*>(extra.data()), extra.size()) : findPaxPath(extra);
+        }
+        else if (type == '0' || type == '\0' || type == '7') {
+            if (longName.empty()) {
+                std::string prefix = std::memcmp(header + 257, "ustar", 5) == 0 ? tarString(header + 345, 155) : std::string();
+                longName = (prefix.empty() ? std::string() : prefix + "/") + tarString(header, 100);
+            }
+            if (wanted(longName)) {
+                name = longName;
+                if (!readData(stream, size, data) || !skipBytes(stream, padding)) {
+                    stream.damaged = true;
+                    return false;
+                }
+                return true;
+            }
+            longName.clear();
+            if (!skipBytes(stream, size + padding)) {
+                stream.damaged = true;
+                return false;
+            }
+        }
+        else {
+            // Directories, links, global pax headers
+            longName.clear();
+            if (!skipBytes(stream, size + padding)) {
+                stream.damaged = true;
+                return false;
+            }
+        }
+        if (!readExactly(stream, header, tarBlock)) {
+            stream.damaged = true;
+            return false;
+        }
+    }
+}
+
+static bool parseHex(const char* field, uint32_t& value) {
+    value = 0;
+    for (int i = 0; i < 8; ++i) {
+        char c = field[i];
+        int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+        if (digit < 0) {
+            return false;
+        }
+        value = value * 16 + uint32_t(digit);
+    }
+    return true;
+}
+
+// newc: 6-byte magic, 13 hex fields of 8 characters, then the name and the data, each padded to 4 bytes
+static bool readCpioEntry(ArchiveStream& stream, const char* first, size_t firstSize, std::string& name, std::vector<BYTE>& data,
+    const ArchiveFilter& wanted) {
+    char header[cpioHeaderSize];
+    std::memcpy(header, first, firstSize);
+    for (;;) {
+        if (firstSize < cpioHeaderSize && !readExactly(stream, header + firstSize, cpioHeaderSize - firstSize)) {
+            stream.damaged = true;
+            return false;
+        }
+        firstSize = 0;
+        if (std::memcmp(header, "070701", 6) != 0 && std::memcmp(header, "070702", 6) != 0) {
+            stream.damaged = true;
+            return false;
+        }
+        uint32_t mode = 0;
+        uint32_t size = 0;
+        uint32_t nameSize = 0;
+        if (!parseHex(header + 14, mode) || !parseHex(header + 54, size) || !parseHex(header + 94, nameSize) || nameSize > maxMetadataBytes) {
+            stream.damaged = true;
+            return false;
+        }
+        std::vector<BYTE> nameBytes;
+        if (!readData(stream, nameSize, nameBytes) || !skipBytes(stream, (4 - (cpioHeaderSize + nameSize) % 4) % 4)) {
+            stream.damaged = true;
+            return false;
+        }
+        std::string entryName(reinterpret_cast<const char*>(nameBytes.data()), strnlen(reinterpret_cast<const char*>(nameBytes.data()), nameBytes.size()));
+        if (entryName == "TRAILER!!!") {
+            stream.ended = true;
+            return false;
+        }
+        uint32_t padding = (4 - size % 4) % 4;
+        if ((mode & 0170000) == 0100000 && wanted(entryName)) {
+            name = entryName;
+            if (!readData(stream, size, data) || !skipBytes(stream, padding)) {
+                stream.damaged = true;
+                return false;
+            }
+            return true;
+        }
+        if (!skipBytes(stream, uint64_t(size) + padding)) {
+            stream.damaged = true;
+            return false;
+        }
+    }
+}
+
+bool readArchiveEntry(ArchiveStream& stream, std::string& name, std::vector<BYTE>& data, const ArchiveFilter& wanted) {
+    if (stream.ended || stream.damaged || !stream.file) {
+        return false;
+    }
+    char header[tarBlock] = {};
+    if (stream.format == ArchiveStream::Format::Cpio) {
+        return readCpioEntry(stream, header, 0, name, data, wanted);
+    }
+    if (stream.format == ArchiveStream::Format::Tar) {
+        if (!readExactly(stream, header, tarBlock)) {
+            // A tar stream cut at a block boundary after its last entry is still usable
+            stream.ended = true;
+            return false;
+        }
+        return readTarEntry(stream, header, name, data, wanted);
+    }
+
+    // The first six bytes tell cpio from tar; an empty stream is an empty archive
+    if (!readExactly(stream, header, 6)) {
+        stream.ended = true;
+        return false;
+    }
+    if (std::memcmp(header, "070701", 6) == 0 || std::memcmp(header, "070702", 6) == 0) {
+        stream.format = ArchiveStream::Format::Cpio;
+        return readCpioEntry(stream, header, 6, name, data, wanted);
+    }
+    stream.format = ArchiveStream::Format::Tar;
+    if (!readExactly(stream, header + 6, tarBlock - 6)) {
+        stream.damaged = true;
+        return false;
+    }
+    return readTarEntry(stream, header, name, data, wanted);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+#include <FreeImage.h>
+
+// Sequential reader for tar (ustar, GNU long names, pax paths) and cpio (newc) streams, e.g. stdin; the format is
+// told from the first header. Only regular files are returned, everything else is skipped
+struct ArchiveStream {
+    FILE* file = nullptr;
+    enum class Format { Unknown, Tar, Cpio } format = Format::Unknown;
+    bool ended = false;
+    bool damaged = false;
+    uint64_t bytesRead = 0;
+};
+
+// Switches stdin to binary mode where the platform distinguishes it
+void openArchiveStdin(ArchiveStream& stream);
+// Whether a regular file is read; the others are skipped without buffering them
+using ArchiveFilter = std::function<bool(const std::string& name)>;
+
+// False at the end of the archive; damaged is set when it ended inside a header or entry, or a header is invalid
+bool readArchiveEntry(ArchiveStream& stream, std::string& name, std::vector<BYTE>& data, const ArchiveFilter& wanted);
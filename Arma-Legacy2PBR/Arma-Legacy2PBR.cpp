@@ -1,10 +1,165 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <filesystem>
+#include <fstream>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <atomic>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+#include <map>
+#include <deque>
 #include <FreeImage.h>
+#include "AmbientOcclusion.h"
+#include "Background.h"
+#include "ArchiveStream.h"
+#include "BuildManifest.h"
+#include "Codec.h"
+#include "CpuDispatch.h"
+#include "FileIO.h"
+#include "Hash.h"
+#include "Kernels.h"
+#include "ProcessPool.h"
+#include "Profiler.h"
+#include "ReadAhead.h"
+#include "References.h"
+#include "Vfs.h"
+#include "RunHistory.h"
+#include "Similarity.h"
+#include "Workload.h"
 
 namespace fs = std::filesystem;
+using Clock = std::chrono::steady_clock;
+
+const char* const toolVersion = "1.1.0";
+
+// Peak working set of one set: four decoded 32-bit inputs and both outputs
+const uint64_t peakBytesPerPixel = 24;
+
+// baseName names the outputs and manifest entries: the NOHQ stem, under its virtual folder for sets from an
+// indexed install or archive so that equally named textures of different addons do not share outputs
+struct TextureSet {
+    std::string baseName;
+    std::string nohq;
+    std::string smdi;
+    std::string as;
+    std::string co;
+};
+
+// Outputs of a set that must be rebuilt, with the inputs each one depends on
+struct SetWork {
+    bool nmo = false;
+    bool bcr = false;
+    std::vector<InputSignature> nmoInputs;
+    std::vector<InputSignature> bcrInputs;
+    // What the existing outputs were built from, for patching only the tiles that changed
+    std::vector<InputSignature> previousNmo;
+    std::vector<InputSignature> previousBcr;
+    // Halvings of both sides to stay within the per-set limits, and what was given up to meet them
+    unsigned reduction = 0;
+    std::string fallback;
+};
+
+const std::vector<std::string> outputExtensions = { ".tga", ".tif", ".png" };
+
+// --max-set-pixels/--max-set-memory/--max-set-seconds; zero is no limit
+struct SetLimits {
+    uint64_t pixels = 0;
+    uint64_t bytes = 0;
+    double seconds = 0.0;
+};
+
+// Below 1/64 of each side the result would not be worth having
+const unsigned maxReduction = 6;
+
+struct Options {
+    unsigned jobs = 1;
+    uint64_t memoryBudget = 0;
+    bool showHistory = false;
+    std::string captureWorkload;
+    std::string replayWorkload;
+    std::string replayFolder = "Replay";
+    std::string isa;
+    bool selfTest = false;
+    bool packBenchmark = false;
+    bool directIo = false;
+    std::string only;
+    bool force = false;
+    bool calibrate = false;
+    bool physicalReadOrder = false;
+    uint64_t readAheadBytes = 256ull * 1024 * 1024;
+    bool isolate = false;
+    bool worker = false;
+    std::string referencedBy;
+    std::vector<std::string> vfsRoots;
+    SimulatedStorage simulatedStorage;
+    std::string simulatedStorageText;
+    bool reuseSimilar = false;
+    unsigned similarityBits = 0;
+    bool archiveInput = false;
+    bool background = false;
+    std::string checksums;
+    std::string profile;
+    unsigned profileHz = 199;
+    SetLimits limits;
+};
+
+// Read by the decoding threads, set once at startup
+SetLimits setLimits;
+
+// Halvings of both sides that bring a set of this size and predicted duration within the limits
+unsigned getBudgetReduction(uint64_t pixels, double seconds) {
+    unsigned reduction = 0;
+    while (reduction < maxReduction && ((setLimits.pixels && pixels > setLimits.pixels) ||
+        (setLimits.bytes && pixels * peakBytesPerPixel > setLimits.bytes) || (setLimits.seconds > 0.0 && seconds > setLimits.seconds))) {
+        ++reduction;
+        pixels /= 4;
+        seconds /= 4.0;
+    }
+    return reduction;
+}
+
+std::string describeReduction(unsigned reduction) {
+    return "decoded at 1/" + std::to_string(1u << reduction) + " size";
+}
+
+// Installs indexed with --vfs; read-only once built, so every worker resolves through it
+Vfs* sourceVfs = nullptr;
+
+// A file inside a PBO or ZIP, named by its virtual path
+const VfsEntry* findArchivedFile(const std::string& filename) {
+    const VfsEntry* entry = sourceVfs ? findVfsEntry(*sourceVfs, filename) : nullptr;
+    return entry && entry->archive >= 0 ? entry : nullptr;
+}
+
+// Archived inputs change with their archive
+InputSignature getSourceSignature(const std::string& path) {
+    const VfsEntry* entry = findArchivedFile(path);
+    if (!entry) {
+        return getInputSignature(path);
+    }
+    InputSignature signature;
+    signature.path = path;
+    signature.size = entry->dataSize;
+    signature.modified = sourceVfs->archives[size_t(entry->archive)].modified;
+    return signature;
+}
+
+// Sets from indexed installs and archives mirror their folder under PBR_Result
+void ensureOutputFolder(const std::string& baseName) {
+    if (baseName.find('/') != std::string::npos) {
+        std::error_code error;
+        fs::create_directories((fs::current_path() / "PBR_Result" / baseName).parent_path(), error);
+    }
+}
 
 void ensurePBRFolderExists() {
     fs::path pbrFolderPath = fs::current_path() / "PBR_Result";
@@ -20,19 +175,49 @@ FREE_IMAGE_FORMAT getFreeImageFormat(const std::string& filename) {
     return FreeImage_GetFIFFromFilename(filename.c_str());
 }
 
-FIBITMAP* loadImage(const std::string& filename) {
-    FREE_IMAGE_FORMAT format = getFreeImageFormat(filename);
-    if (format == FIF_UNKNOWN) {
+// channel >= 0: the caller reads only that channel, and formats that can decode it alone return it as gray
+FIBITMAP* loadImage(const std::string& filename, unsigned* sourceBpp = nullptr, ReadAhead* readAhead = nullptr, unsigned reduction = 0,
+    int channel = -1) {
+    if (!findDecoder(getCodecExtension(filename))) {
         std::cerr << "Unknown image format: " << filename << std::endl;
         return nullptr;
     }
-    FIBITMAP* dib = FreeImage_Load(format, filename.c_str());
+    FIBITMAP* dib = nullptr;
+    std::vector<BYTE> data;
+    const VfsEntry* archived = findArchivedFile(filename);
+    if (readAhead && takeReadAhead(*readAhead, filename, data)) {
+        dib = decodeImagePartial(filename, data.data(), data.size(), reduction, channel);
+    }
+    else if (archived) {
+        const BYTE* bytes = nullptr;
+        size_t size = 0;
+        if (readVfsEntry(*sourceVfs, *archived, data, bytes, size)) {
+            // Decoders only read, so the mapped archive bytes are passed as they are
+            dib = decodeImagePartial(filename, const_cast<BYTE*>(bytes), size, reduction, channel);
+        }
+    }
+    else if (reduction > 0 || (channel >= 0 && decodesSingleChannel(filename))) {
+        // Partial decoding reads from memory, and a mapping costs no copy
+        MappedFile file;
+        trackInputResidency(filename);
+        if (openMappedFile(filename, false, file)) {
+            dib = decodeImagePartial(filename, file.data, file.size, reduction, channel);
+            closeMappedFile(file);
+        }
+    }
+    else {
+        trackInputResidency(filename);
+        dib = decodeImage(filename);
+    }
     if (!dib) {
         std::cerr << "Failed to load image: " << filename << std::endl;
         return nullptr;
     }
-    // Check bit depth
-    if (FreeImage_GetBPP(dib) < 32) {
+    if (sourceBpp) {
+        *sourceBpp = FreeImage_GetBPP(dib);
+    }
+    // Check bit depth; 16-bit per channel images are reduced as well
+    if (FreeImage_GetBPP(dib) != 32 || FreeImage_GetImageType(dib) != FIT_BITMAP) {
         FIBITMAP* converted = FreeImage_ConvertTo32Bits(dib);
         FreeImage_Unload(dib);
         if (!converted) {
@@ -45,15 +230,43 @@ FIBITMAP* loadImage(const std::string& filename) {
 }
 
 std::string getBaseName(const std::string& filename) {
-    return fs::path(filename).stem().string();
+    // Virtual paths keep their backslashes on every platform
+    return fs::path(filename.substr(filename.find_last_of("\\/") + 1)).stem().string();
+}
+
+// ZIPs dropped into TGA_Result are read in place, like the PBOs of --vfs
+std::vector<fs::path> findSourceZips() {
+    std::vector<fs::path> result;
+    std::error_code error;
+    for (const auto& entry : fs::directory_iterator(fs::current_path() / "TGA_Result", error)) {
+        std::string extension = entry.path().extension().string();
+        if (extension == ".zip" || extension == ".ZIP") {
+            result.push_back(entry.path());
+        }
+    }
+    return result;
+}
+
+// Virtual folder of every input found in an indexed install or archive, '/'-separated; TGA_Result files have none
+std::unordered_map<std::string, std::string> sourceFolders;
+
+std::string getSourceFolder(const std::string& file) {
+    auto found = sourceFolders.find(file);
+    return found != sourceFolders.end() ? found->second : std::string();
+}
+
+std::string getSetName(const std::string& nohq) {
+    std::string folder = getSourceFolder(nohq);
+    return folder.empty() ? getBaseName(nohq) : folder + "/" + getBaseName(nohq);
 }
 
 std::vector<std::string> findFilesWithSuffix(const std::string& suffix) {
     std::vector<std::string> result;
+    simulateMetadata();
     try {
         for (const auto& entry : fs::directory_iterator(fs::current_path() / "TGA_Result")) {
             std::string extension = entry.path().extension().string();
-            if ((extension == ".tga" || extension == ".png" || extension == ".tif") &&
+            if ((extension == ".tga" || extension == ".png" || extension == ".tif" || extension == ".paa") &&
                 entry.path().stem().string().ends_with(suffix)) {
                 result.push_back(entry.path().string());
             }
@@ -62,132 +275,1866 @@ std::vector<std::string> findFilesWithSuffix(const std::string& suffix) {
     catch (const std::exception& e) {
         std::cerr << "Error reading directory: " << e.what() << std::endl;
     }
+    // Textures in indexed installs: loose files by their path, archived ones by virtual path
+    if (sourceVfs) {
+        for (const auto& file : sourceVfs->entries) {
+            fs::path name(file.first);
+            if (name.stem().string().ends_with(suffix) && findDecoder(getCodecExtension(file.first))) {
+                std::string path = file.second.archive >= 0 ? file.first : file.second.loosePath;
+                size_t separator = file.first.find_last_of('\\');
+                std::string folder = separator == std::string::npos ? std::string() : file.first.substr(0, separator);
+                std::replace(folder.begin(), folder.end(), '\\', '/');
+                sourceFolders[path] = folder;
+                result.push_back(path);
+            }
+        }
+    }
+    // Directory order differs between file systems; sort so set pairing is reproducible
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
     return result;
 }
 
-bool saveImage(const std::string& baseName, const std::string& suffix, FIBITMAP* dib, const std::vector<std::string>& extensions) {
+// What every written output is digested with (--checksums), set once at startup
+OutputDigest checksumSelection;
+
+struct OutputChecksum {
+    uint64_t size = 0;
+    std::string sha256;
+    std::string xxh64;
+};
+
+// Outputs written this run, by file name in PBR_Result
+std::mutex checksumMutex;
+std::map<std::string, OutputChecksum> outputChecksums;
+
+bool parseChecksums(const std::string& text, OutputDigest& selection) {
+    std::istringstream list(text);
+    std::string name;
+    while (std::getline(list, name, ',')) {
+        if (name == "sha256") {
+            selection.sha256 = true;
+        }
+        else if (name == "xxh64") {
+            selection.xxh64 = true;
+        }
+        else {
+            return false;
+        }
+    }
+    return selection.sha256 || selection.xxh64;
+}
+
+void recordOutputChecksum(const std::string& file, const OutputDigest& digest) {
+    if (!digest.sequential) {
+        std::cerr << "Encoder rewrote part of " << file << ", no checksum recorded" << std::endl;
+        return;
+    }
+    OutputChecksum checksum;
+    checksum.size = digest.size;
+    checksum.sha256 = digest.sha256 ? sha256Digest(digest.sha256State) : "-";
+    checksum.xxh64 = digest.xxh64 ? toHex(xxh64Digest(digest.xxh64State)) : "-";
+    std::lock_guard<std::mutex> lock(checksumMutex);
+    outputChecksums[file] = checksum;
+}
+
+fs::path getRunManifestPath() {
+    return fs::current_path() / "run_manifest.tsv";
+}
+
+// Rows of file, size and digests for the outputs of this run; left alone when --checksums is not given
+bool writeRunManifest(const fs::path& file) {
+    if (!checksumSelection.sha256 && !checksumSelection.xxh64) {
+        return true;
+    }
+    fs::path temporary = file;
+    temporary += ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::trunc);
+        out << "# file\tbytes\tsha256\txxh64\n";
+        for (const auto& [name, checksum] : outputChecksums) {
+            out << name << '\t' << checksum.size << '\t' << checksum.sha256 << '\t' << checksum.xxh64 << '\n';
+        }
+        if (!out) {
+            std::cerr << "Failed to write run manifest: " << temporary.string() << std::endl;
+            return false;
+        }
+    }
+    std::error_code error;
+    fs::rename(temporary, file, error);
+    if (error) {
+        std::cerr << "Failed to replace run manifest: " << file.string() << std::endl;
+        return false;
+    }
+    std::cout << "Checksums of " << outputChecksums.size() << " outputs written to: " << file.string() << std::endl;
+    return true;
+}
+
+// Encode to memory, then write from an aligned copy without going through the page cache; the copy is digested
+// a megabyte at a time, while each chunk is in cache anyway
+bool saveImageDirect(FREE_IMAGE_FORMAT format, FIBITMAP* dib, const std::string& filename, int flags, OutputDigest* digest) {
+    FIMEMORY* memory = FreeImage_OpenMemory();
+    BYTE* encoded = nullptr;
+    DWORD size = 0;
+    bool saved = FreeImage_SaveToMemory(format, dib, memory, flags) && FreeImage_AcquireMemory(memory, &encoded, &size);
+    if (saved) {
+        BYTE* aligned = allocateAligned(size);
+        saved = aligned != nullptr;
+        if (saved) {
+            const size_t chunk = 1024 * 1024;
+            for (size_t offset = 0; offset < size; offset += chunk) {
+                size_t length = std::min<size_t>(chunk, size - offset);
+                memcpy(aligned + offset, encoded + offset, length);
+                if (digest) {
+                    updateOutputDigest(*digest, aligned + offset, length);
+                }
+            }
+            saved = writeFileDirect(filename, aligned, size);
+        }
+        freeAligned(aligned);
+    }
+    FreeImage_CloseMemory(memory);
+    return saved;
+}
+
+bool saveImage(const std::string& baseName, const std::string& suffix, FIBITMAP* dib, const std::vector<std::string>& extensions, bool directIo) {
     fs::path pbrFolderPath = fs::current_path() / "PBR_Result";
+    ensureOutputFolder(baseName);
     for (const auto& ext : extensions) {
         std::string filename = (pbrFolderPath / (baseName + suffix + ext)).string();
         FREE_IMAGE_FORMAT format = getFreeImageFormat(filename);
 
-        if (format == FIF_UNKNOWN) {
+        if (format == FIF_UNKNOWN || !findEncoder(getCodecExtension(filename))) {
             std::cerr << "Unknown image format: " << filename << std::endl;
             return false;
         }
 
-        int flags = (format == FIF_TARGA) ? TARGA_DEFAULT :
-            (format == FIF_TIFF) ? TIFF_NONE :
-            (format == FIF_PNG) ? PNG_Z_NO_COMPRESSION : 0;
-
-        if (!FreeImage_Save(format, dib, filename.c_str(), flags)) {
+        // Direct I/O needs the encoded file in memory first, which only the FreeImage backend provides
+        Clock::time_point start = Clock::now();
+        OutputDigest digest = checksumSelection;
+        resetOutputDigest(digest);
+        OutputDigest* digesting = (digest.sha256 || digest.xxh64) ? &digest : nullptr;
+        bool saved = directIo ? saveImageDirect(format, dib, filename, freeImageSaveFlags(format), digesting) : encodeImage(dib, filename, digesting);
+        if (!saved) {
             std::cerr << "Failed to save image: " << filename << std::endl;
             return false;
         }
+        if (!directIo) {
+            ++ioStats().bufferedWrites;
+        }
+        std::error_code error;
+        ioStats().outputBytes += fs::file_size(filename, error);
+        ioStats().outputMicroseconds += std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+        if (digesting) {
+            recordOutputChecksum(baseName + suffix + ext, digest);
+        }
 
         std::cout << "Image saved to: " << filename << std::endl;
     }
     return true;
 }
 
-int main() {
+
+double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+std::string getExtensionName(const std::string& filename) {
+    std::string extension = fs::path(filename).extension().string();
+    return extension.empty() ? extension : extension.substr(1);
+}
+
+uint64_t getFileSize(const std::string& filename) {
+    simulateMetadata();
+    std::error_code error;
+    uintmax_t size = fs::file_size(filename, error);
+    return error ? 0 : static_cast<uint64_t>(size);
+}
+
+std::string getSetFormats(const TextureSet& set) {
+    return getExtensionName(set.nohq) + "," + getExtensionName(set.smdi) + "," +
+        getExtensionName(set.as) + "," + getExtensionName(set.co);
+}
+
+uint64_t getSetInputBytes(const TextureSet& set) {
+    return getFileSize(set.nohq) + getFileSize(set.smdi) + getFileSize(set.as) + getFileSize(set.co);
+}
+
+fs::path getHistoryPath() {
+    return fs::current_path() / "run_history.tsv";
+}
+
+fs::path getManifestPath() {
+    return fs::current_path() / "build_manifest.txt";
+}
+
+fs::path getFingerprintCachePath() {
+    return fs::current_path() / "fingerprints.txt";
+}
+
+fs::path getVfsIndexPath() {
+    return fs::current_path() / "vfs_index.txt";
+}
+
+fs::path getCodecConfigPath() {
+    return fs::current_path() / "codecs.cfg";
+}
+
+bool outputFilesExist(const std::string& baseName, const std::string& suffix) {
+    for (const auto& ext : outputExtensions) {
+        simulateMetadata();
+        if (!fs::exists(fs::current_path() / "PBR_Result" / (baseName + suffix + ext))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Fingerprints the NMO inputs of every set, loading only those not cached, and pairs each set that still needs
+// its NMO with the earliest set whose inputs are within the tolerance
+std::vector<std::pair<size_t, size_t>> findSharedNmo(const std::vector<TextureSet>& sets, std::vector<SetWork>& work, unsigned toleranceBits) {
+    FingerprintCache previous = readFingerprintCache(getFingerprintCachePath());
+    FingerprintCache cache;
+    std::vector<std::string> missing;
+    for (const auto& set : sets) {
+        for (const std::string* file : { &set.nohq, &set.smdi, &set.as }) {
+            if (file->empty() || cache.count(*file) || std::find(missing.begin(), missing.end(), *file) != missing.end()) {
+                continue;
+            }
+            InputSignature signature = getSourceSignature(*file);
+            auto cached = previous.find(*file);
+            if (cached != previous.end() && cached->second.first.size == signature.size && cached->second.first.modified == signature.modified) {
+                cache[*file] = cached->second;
+            }
+            else {
+                missing.push_back(*file);
+            }
+        }
+    }
+
+    std::vector<Fingerprint> computed(missing.size());
+    std::vector<char> loaded(missing.size(), 0);
+    std::atomic<size_t> next{ 0 };
+    auto fingerprintFiles = [&]() {
+        for (size_t i; (i = next++) < missing.size();) {
+            FIBITMAP* dib = loadImage(missing[i]);
+            if (dib) {
+                computed[i] = computeFingerprint(FreeImage_GetBits(dib), FreeImage_GetWidth(dib), FreeImage_GetHeight(dib), FreeImage_GetPitch(dib));
+                loaded[i] = 1;
+                FreeImage_Unload(dib);
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), missing.size()); ++i) {
+        threads.emplace_back(fingerprintFiles);
+    }
+    fingerprintFiles();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (size_t i = 0; i < missing.size(); ++i) {
+        if (loaded[i]) {
+            cache[missing[i]] = { getSourceSignature(missing[i]), computed[i] };
+        }
+    }
+    writeFingerprintCache(getFingerprintCachePath(), cache);
+
+    SimilarityIndex index;
+    index.toleranceBits = toleranceBits;
+    std::vector<size_t> indexedSets;
+    std::vector<std::pair<size_t, size_t>> shared;
+    for (size_t i = 0; i < sets.size(); ++i) {
+        auto nohq = cache.find(sets[i].nohq);
+        auto smdi = cache.find(sets[i].smdi);
+        auto as = cache.find(sets[i].as);
+        if (nohq == cache.end() || smdi == cache.end() || as == cache.end()) {
+            continue;
+        }
+        // The channels NMO is packed from: NOHQ red and green, SMDI green and AS green
+        const Fingerprint& n = nohq->second.second;
+        const Fingerprint& s = smdi->second.second;
+        const Fingerprint& a = as->second.second;
+        OutputFingerprint fingerprint;
+        fingerprint.hashes = { n.hashes[2], n.hashes[1], s.hashes[1], a.hashes[1] };
+        fingerprint.means = { n.means[2], n.means[1], s.means[1], a.means[1] };
+        fingerprint.sizes = { n.width, n.height, s.width, s.height, a.width, a.height };
+        size_t item;
+        if (work[i].nmo && findSimilar(index, fingerprint, item)) {
+            work[i].nmo = false;
+            shared.push_back({ i, indexedSets[item] });
+            std::cout << "Reusing NMO of " << sets[indexedSets[item]].baseName << " for: " << sets[i].baseName << std::endl;
+        }
+        else {
+            addToSimilarityIndex(index, fingerprint);
+            indexedSets.push_back(i);
+        }
+    }
+    return shared;
+}
+
+// An output is either packed straight into a mapped TGA file or into a FreeImage bitmap
+struct OutputImage {
+    MappedFile tga;
+    FIBITMAP* dib = nullptr;
+    BYTE* pixels = nullptr;
+};
+
+bool createMappedTga(const std::string& filename, unsigned width, unsigned height, OutputImage& output) {
+    if (width > 0xFFFF || height > 0xFFFF) {
+        return false;
+    }
+    size_t pixelBytes = size_t(width) * height * 4;
+    if (!createMappedFile(filename, tgaHeaderSize + pixelBytes + tgaFooterSize, output.tga)) {
+        return false;
+    }
+    BYTE* header = output.tga.data;
+    fillTgaHeader(header, width, height);
+    fillTgaFooter(header + tgaHeaderSize + pixelBytes);
+    output.pixels = header + tgaHeaderSize;
+    return true;
+}
+
+bool createOutputImage(const std::string& baseName, const std::string& suffix, unsigned width, unsigned height, bool mapTga, OutputImage& output) {
+    if (mapTga) {
+        ensureOutputFolder(baseName);
+        std::string filename = (fs::current_path() / "PBR_Result" / (baseName + suffix + ".tga")).string();
+        if (createMappedTga(filename, width, height, output)) {
+            // Header-only bitmap over the mapped pixels for the formats FreeImage still encodes
+            output.dib = FreeImage_ConvertFromRawBitsEx(FALSE, output.pixels, FIT_BITMAP, width, height, width * 4, 32,
+                FI_RGBA_RED_MASK, FI_RGBA_GREEN_MASK, FI_RGBA_BLUE_MASK, FALSE);
+            if (output.dib) {
+                return true;
+            }
+            closeMappedFile(output.tga);
+        }
+    }
+    output.dib = FreeImage_Allocate(width, height, 32);
+    output.pixels = output.dib ? FreeImage_GetBits(output.dib) : nullptr;
+    return output.dib != nullptr;
+}
+
+// Releases an output that will not be saved. A TGA createMappedTga made for it is removed rather than left behind
+// empty; an existing one opened for patching is kept
+void discardOutputImage(const std::string& baseName, const std::string& suffix, OutputImage& output, bool created) {
+    bool mapped = output.tga.data != nullptr;
+    FreeImage_Unload(output.dib);
+    closeMappedFile(output.tga);
+    output = OutputImage();
+    if (mapped && created) {
+        std::error_code error;
+        fs::remove(fs::current_path() / "PBR_Result" / (baseName + suffix + ".tga"), error);
+    }
+}
+
+// Maps an existing TGA written by createMappedTga (or FreeImage) so changed tiles can be repacked in place
+bool openOutputTga(const std::string& baseName, const std::string& suffix, unsigned width, unsigned height, OutputImage& output) {
+    std::string filename = (fs::current_path() / "PBR_Result" / (baseName + suffix + ".tga")).string();
+    if (!openMappedFile(filename, true, output.tga)) {
+        return false;
+    }
+    const BYTE* header = output.tga.data;
+    size_t pixelBytes = size_t(width) * height * 4;
+    bool matches = output.tga.size >= tgaHeaderSize + pixelBytes && header[0] == 0 && header[1] == 0 && header[2] == 2 &&
+        (header[12] | (header[13] << 8)) == int(width) && (header[14] | (header[15] << 8)) == int(height) &&
+        header[16] == 32 && (header[17] & 0x30) == 0;
+    if (matches) {
+        output.pixels = output.tga.data + tgaHeaderSize;
+        output.dib = FreeImage_ConvertFromRawBitsEx(FALSE, output.pixels, FIT_BITMAP, width, height, width * 4, 32,
+            FI_RGBA_RED_MASK, FI_RGBA_GREEN_MASK, FI_RGBA_BLUE_MASK, FALSE);
+    }
+    if (!output.dib) {
+        closeMappedFile(output.tga);
+        output = OutputImage();
+        return false;
+    }
+    return true;
+}
+
+// Calls pack(firstPixel, count) for every row segment of the dirty tiles
+template <typename Pack>
+void packDirtyTiles(const std::vector<char>& dirty, unsigned width, unsigned height, Pack pack) {
+    unsigned tilesX = (width + manifestTileSize - 1) / manifestTileSize;
+    for (size_t tile = 0; tile < dirty.size(); ++tile) {
+        if (!dirty[tile]) {
+            continue;
+        }
+        unsigned x = unsigned(tile % tilesX) * manifestTileSize;
+        unsigned y = unsigned(tile / tilesX) * manifestTileSize;
+        unsigned columns = std::min(manifestTileSize, width - x);
+        unsigned lastRow = std::min(y + manifestTileSize, height);
+        for (; y < lastRow; ++y) {
+            pack(size_t(y) * width + x, size_t(columns));
+        }
+    }
+}
+
+bool saveOutputImage(const std::string& baseName, const std::string& suffix, OutputImage& output, const std::vector<std::string>& extensions, bool directIo) {
+    std::vector<std::string> remaining;
+    for (const auto& ext : extensions) {
+        if (ext == ".tga" && output.tga.data) {
+            std::cout << "Image saved to: " << (fs::current_path() / "PBR_Result" / (baseName + suffix + ext)).string() << std::endl;
+            ioStats().outputBytes += output.tga.size;
+            // The kernels wrote the file through the mapping; its pages are still resident
+            if (checksumSelection.sha256 || checksumSelection.xxh64) {
+                OutputDigest digest = checksumSelection;
+                resetOutputDigest(digest);
+                updateOutputDigest(digest, output.tga.data, output.tga.size);
+                recordOutputChecksum(baseName + suffix + ext, digest);
+            }
+        }
+        else {
+            remaining.push_back(ext);
+        }
+    }
+    bool saved = saveImage(baseName, suffix, output.dib, remaining, directIo);
+    FreeImage_Unload(output.dib);
+    closeMappedFile(output.tga);
+    output = OutputImage();
+    return saved;
+}
+
+// Decoded inputs of a set; AS is already scaled to the output size
+struct SetImages {
+    FIBITMAP* nohq = nullptr;
+    FIBITMAP* smdi = nullptr;
+    FIBITMAP* as = nullptr;
+    FIBITMAP* co = nullptr;
+    unsigned width = 0;
+    unsigned height = 0;
+};
+
+void unloadSetImages(SetImages& images) {
+    FreeImage_Unload(images.nohq);
+    FreeImage_Unload(images.smdi);
+    FreeImage_Unload(images.as);
+    FreeImage_Unload(images.co);
+    images = SetImages();
+}
+
+// Cores one set may use to bake AO for a missing AS map; the rest belong to the sets running beside it
+unsigned bakeThreads = 1;
+
+// Decodes the roles the stale outputs need and records their tile hashes in work
+bool loadSetImages(const TextureSet& set, SetWork& work, ReadAhead* readAhead, std::vector<WorkloadInput>* capture, SetImages& images) {
+    ProfileStage stage("decode", set.baseName.c_str());
+    // NMO needs NOHQ, SMDI and AS; BCR needs CO and SMDI. Roles no stale output needs are not decoded
+    unsigned sourceBpp[4] = {};
+    unsigned reduction = work.reduction;
+    // The first input decoded shows the real size; when the estimate was too low, it is reduced and the rest
+    // are decoded reduced as well
+    auto enforceLimits = [&](FIBITMAP* dib) {
+        unsigned extra = dib ? getBudgetReduction(uint64_t(FreeImage_GetWidth(dib)) * FreeImage_GetHeight(dib), 0.0) : 0;
+        reduction += extra;
+        return reduceImage(dib, extra);
+    };
+    FIBITMAP* nohq = work.nmo ? enforceLimits(loadImage(set.nohq, &sourceBpp[0], readAhead, reduction)) : nullptr;
+    // NMO reads SMDI.G and AS.G, BCR reads SMDI.B; a role needing one channel skips decoding the rest
+    int smdiChannel = work.nmo && work.bcr ? -1 : work.nmo ? 1 : 0;
+    FIBITMAP* smdi = loadImage(set.smdi, &sourceBpp[1], readAhead, reduction, smdiChannel);
+    if (!work.nmo) {
+        smdi = enforceLimits(smdi);
+    }
+    FIBITMAP* as = work.nmo && !set.as.empty() ? loadImage(set.as, &sourceBpp[2], readAhead, reduction, 1) : nullptr;
+    FIBITMAP* co = work.bcr ? loadImage(set.co, &sourceBpp[3], readAhead, reduction) : nullptr;
+    if (reduction > 0) {
+        work.reduction = reduction;
+        work.fallback = describeReduction(reduction);
+    }
+    // Without an AS map the occlusion is baked from the normals
+    if (work.nmo && nohq && set.as.empty()) {
+        ProfileStage baking("bake-ao");
+        as = bakeAmbientOcclusion(nohq, bakeThreads);
+        sourceBpp[2] = 32;
+    }
+
+    if (!smdi || (work.nmo && (!nohq || !as)) || (work.bcr && !co)) {
+        std::cerr << "Failed to load or process one or more images." << std::endl;
+        FreeImage_Unload(nohq);
+        FreeImage_Unload(smdi);
+        FreeImage_Unload(as);
+        FreeImage_Unload(co);
+        return false;
+    }
+
+    FIBITMAP* reference = nohq ? nohq : co;
+    unsigned int width = FreeImage_GetWidth(reference);
+    unsigned int height = FreeImage_GetHeight(reference);
+
+    if (capture) {
+        const char* roles[4] = { "nohq", "smdi", "as", "co" };
+        const std::string* files[4] = { &set.nohq, &set.smdi, &set.as, &set.co };
+        FIBITMAP* decoded[4] = { nohq, smdi, as, co };
+        for (int i = 0; i < 4; ++i) {
+            if (!decoded[i]) {
+                continue;
+            }
+            WorkloadInput input;
+            input.role = roles[i];
+            input.width = FreeImage_GetWidth(decoded[i]);
+            input.height = FreeImage_GetHeight(decoded[i]);
+            input.format = getExtensionName(*files[i]);
+            input.bpp = sourceBpp[i];
+            input.entropy = estimateEntropy(decoded[i]);
+            input.fileBytes = getFileSize(*files[i]);
+            capture->push_back(input);
+        }
+    }
+
+    // Hash the decoded inputs per tile, so the next edit can be matched to the tiles it touched. SMDI and AS hash
+    // only the channel the output reads, which is the same whether or not the decoder skipped the others
+    if (work.nmo) {
+        ProfileStage hashing("hash");
+        computeTileHashes(work.nmoInputs[0], FreeImage_GetBits(nohq), FreeImage_GetWidth(nohq), FreeImage_GetHeight(nohq), FreeImage_GetPitch(nohq), 4);
+        computeTileHashes(work.nmoInputs[1], FreeImage_GetBits(smdi), FreeImage_GetWidth(smdi), FreeImage_GetHeight(smdi), FreeImage_GetPitch(smdi), 4, 1);
+        computeTileHashes(work.nmoInputs[2], FreeImage_GetBits(as), FreeImage_GetWidth(as), FreeImage_GetHeight(as), FreeImage_GetPitch(as), 4, 1);
+    }
+    if (work.bcr) {
+        ProfileStage hashing("hash");
+        computeTileHashes(work.bcrInputs[0], FreeImage_GetBits(co), FreeImage_GetWidth(co), FreeImage_GetHeight(co), FreeImage_GetPitch(co), 4);
+        computeTileHashes(work.bcrInputs[1], FreeImage_GetBits(smdi), FreeImage_GetWidth(smdi), FreeImage_GetHeight(smdi), FreeImage_GetPitch(smdi), 4, 0);
+    }
+
+    // Check image dimensions and rescale if necessary
+    if (as && (FreeImage_GetWidth(as) != width || FreeImage_GetHeight(as) != height)) {
+        FIBITMAP* resized = FreeImage_Rescale(as, width, height);
+        FreeImage_Unload(as);
+        as = resized;
+    }
+    images.nohq = nohq;
+    images.smdi = smdi;
+    images.as = as;
+    images.co = co;
+    images.width = width;
+    images.height = height;
+    return true;
+}
+
+// A set already over its time limit after decoding and packing writes only the TGA, which needs no encoding. The other
+// formats are removed rather than left stale, so the set is rebuilt by the next run
+std::vector<std::string> getBudgetExtensions(const std::string& baseName, SetWork& work, const HistoryRecord& record) {
+    if (setLimits.seconds <= 0.0 || record.loadSeconds + record.packSeconds <= setLimits.seconds) {
+        return outputExtensions;
+    }
+    for (const auto& ext : outputExtensions) {
+        for (const char* suffix : { "_NMO", "_BCR" }) {
+            std::error_code error;
+            if (ext != ".tga" && ((suffix[1] == 'N' && work.nmo) || (suffix[1] == 'B' && work.bcr))) {
+                fs::remove(fs::current_path() / "PBR_Result" / (baseName + suffix + ext), error);
+            }
+        }
+    }
+    work.fallback += std::string(work.fallback.empty() ? "" : ", ") + "TGA only";
+    return { ".tga" };
+}
+
+// The outputs column of the run history
+std::string getOutputList(bool nmo, bool bcr) {
+    return nmo && bcr ? "NMO+BCR" : nmo ? "NMO" : bcr ? "BCR" : "-";
+}
+
+bool processSet(const TextureSet& set, SetWork& work, const Options& options, HistoryRecord& record, std::vector<WorkloadInput>* capture,
+    ReadAhead* readAhead) {
+    ProfileStage stage("decode", set.baseName.c_str());
+    Clock::time_point start = Clock::now();
+    SetImages images;
+    if (!loadSetImages(set, work, readAhead, capture, images)) {
+        return false;
+    }
+    FIBITMAP* nohq = images.nohq;
+    FIBITMAP* smdi = images.smdi;
+    FIBITMAP* as = images.as;
+    FIBITMAP* co = images.co;
+    unsigned width = images.width;
+    unsigned height = images.height;
+    record.loadSeconds = secondsSince(start);
+
+    setProfileStage("pack");
+    start = Clock::now();
+    // An output whose inputs kept their dimensions is patched tile by tile in its existing TGA;
+    // with no dirty tile at all (e.g. only the timestamps changed) it is not rewritten
+    bool mapTga = !options.directIo;
+    std::vector<char> nmoDirty, bcrDirty;
+    bool patchNmo = work.nmo && mapTga && findDirtyTiles(work.previousNmo, work.nmoInputs, width, height, nmoDirty);
+    bool patchBcr = work.bcr && mapTga && findDirtyTiles(work.previousBcr, work.bcrInputs, width, height, bcrDirty);
+    bool writeNmo = work.nmo && (!patchNmo || std::count(nmoDirty.begin(), nmoDirty.end(), 1) > 0);
+    bool writeBcr = work.bcr && (!patchBcr || std::count(bcrDirty.begin(), bcrDirty.end(), 1) > 0);
+    record.outputs = getOutputList(writeNmo, writeBcr);
+    OutputImage nmo, bcr;
+    if (writeNmo && patchNmo && !openOutputTga(set.baseName, "_NMO", width, height, nmo)) {
+        patchNmo = false;
+    }
+    if (writeBcr && patchBcr && !openOutputTga(set.baseName, "_BCR", width, height, bcr)) {
+        patchBcr = false;
+    }
+    if (patchNmo) {
+        record.tiles += unsigned(nmoDirty.size());
+        record.dirtyTiles += unsigned(std::count(nmoDirty.begin(), nmoDirty.end(), 1));
+    }
+    if (patchBcr) {
+        record.tiles += unsigned(bcrDirty.size());
+        record.dirtyTiles += unsigned(std::count(bcrDirty.begin(), bcrDirty.end(), 1));
+    }
+    if ((writeNmo && !nmo.dib && (!as || !createOutputImage(set.baseName, "_NMO", width, height, mapTga, nmo))) ||
+        (writeBcr && !bcr.dib && !createOutputImage(set.baseName, "_BCR", width, height, mapTga, bcr))) {
+        std::cerr << "Failed to allocate output images for: " << set.baseName << std::endl;
+        discardOutputImage(set.baseName, "_NMO", nmo, !patchNmo);
+        discardOutputImage(set.baseName, "_BCR", bcr, !patchBcr);
+        unloadSetImages(images);
+        return false;
+    }
+
+    // 32-bit rows have no padding, so each image is one contiguous run of pixels
+    size_t pixels = size_t(width) * height;
+    BYTE* smdiBits = FreeImage_GetBits(smdi);
+    if (writeNmo) {
+        BYTE* nohqBits = FreeImage_GetBits(nohq);
+        BYTE* asBits = FreeImage_GetBits(as);
+        if (patchNmo) {
+            packDirtyTiles(nmoDirty, width, height, [&](size_t first, size_t count) {
+                kernels().packNmo(nmo.pixels + first * 4, nohqBits + first * 4, smdiBits + first * 4, asBits + first * 4, count);
+            });
+            std::cout << "Patched " << std::count(nmoDirty.begin(), nmoDirty.end(), 1) << " of " << nmoDirty.size()
+                << " tiles: " << set.baseName << "_NMO" << std::endl;
+        }
+        else {
+            kernels().packNmo(nmo.pixels, nohqBits, smdiBits, asBits, pixels);
+        }
+    }
+    if (writeBcr) {
+        BYTE* coBits = FreeImage_GetBits(co);
+        if (patchBcr) {
+            packDirtyTiles(bcrDirty, width, height, [&](size_t first, size_t count) {
+                kernels().packBcr(bcr.pixels + first * 4, coBits + first * 4, smdiBits + first * 4, count);
+            });
+            std::cout << "Patched " << std::count(bcrDirty.begin(), bcrDirty.end(), 1) << " of " << bcrDirty.size()
+                << " tiles: " << set.baseName << "_BCR" << std::endl;
+        }
+        else {
+            kernels().packBcr(bcr.pixels, coBits, smdiBits, pixels);
+        }
+    }
+    record.packSeconds = secondsSince(start);
+
+    setProfileStage("encode");
+    start = Clock::now();
+    // A failed save fails the set, so its outputs stay out of the manifest and are rebuilt
+    bool saved = true;
+    std::vector<std::string> extensions = getBudgetExtensions(set.baseName, work, record);
+    if (writeNmo) {
+        saved = saveOutputImage(set.baseName, "_NMO", nmo, extensions, options.directIo) && saved;
+    }
+    if (writeBcr) {
+        saved = saveOutputImage(set.baseName, "_BCR", bcr, extensions, options.directIo) && saved;
+    }
+    record.saveSeconds = secondsSince(start);
+
+    record.width = width;
+    record.height = height;
+
+    unloadSetImages(images);
+    return saved;
+}
+
+// Sets up to this size (icons, decals, UI) spend more on per-set overhead than on packing; a worker takes up to
+// tinyBatchSets of them at once and packs them with one batched kernel call per output type
+const uint64_t tinySetPixels = 64 * 64;
+const size_t tinyBatchSets = 64;
+
+// processSet for a batch of tiny sets. Tile patching is skipped, a whole tiny output is a single tile anyway.
+// succeeded[i] and records[i] belong to batch[i]; the pack time is split evenly over the sets that loaded
+void processSetBatch(const std::vector<TextureSet>& sets, const std::vector<size_t>& batch, std::vector<SetWork>& work,
+    const Options& options, std::vector<HistoryRecord>& records, std::vector<char>& succeeded, ReadAhead* readAhead) {
+    std::vector<SetImages> images(batch.size());
+    std::vector<OutputImage> nmo(batch.size()), bcr(batch.size());
+    std::vector<PackJob> nmoJobs, bcrJobs;
+    succeeded.assign(batch.size(), 0);
+    bool mapTga = !options.directIo;
+    for (size_t i = 0; i < batch.size(); ++i) {
+        const TextureSet& set = sets[batch[i]];
+        SetWork& setWork = work[batch[i]];
+        Clock::time_point start = Clock::now();
+        if (!loadSetImages(set, setWork, readAhead, nullptr, images[i])) {
+            continue;
+        }
+        records[i].loadSeconds = secondsSince(start);
+        records[i].outputs = getOutputList(setWork.nmo, setWork.bcr);
+        unsigned width = images[i].width;
+        unsigned height = images[i].height;
+        if ((setWork.nmo && !createOutputImage(set.baseName, "_NMO", width, height, mapTga, nmo[i])) ||
+            (setWork.bcr && !createOutputImage(set.baseName, "_BCR", width, height, mapTga, bcr[i]))) {
+            std::cerr << "Failed to allocate output images for: " << set.baseName << std::endl;
+            discardOutputImage(set.baseName, "_NMO", nmo[i], true);
+            discardOutputImage(set.baseName, "_BCR", bcr[i], true);
+            unloadSetImages(images[i]);
+            continue;
+        }
+        size_t pixels = size_t(width) * height;
+        BYTE* smdiBits = FreeImage_GetBits(images[i].smdi);
+        if (setWork.nmo) {
+            nmoJobs.push_back({ nmo[i].pixels, { FreeImage_GetBits(images[i].nohq), smdiBits, FreeImage_GetBits(images[i].as) }, pixels });
+        }
+        if (setWork.bcr) {
+            bcrJobs.push_back({ bcr[i].pixels, { FreeImage_GetBits(images[i].co), smdiBits, nullptr }, pixels });
+        }
+        succeeded[i] = 1;
+    }
+
+    ProfileStage stage("pack");
+    Clock::time_point start = Clock::now();
+    kernels().packNmoBatch(nmoJobs.data(), nmoJobs.size());
+    kernels().packBcrBatch(bcrJobs.data(), bcrJobs.size());
+    double packSeconds = secondsSince(start) / double(std::max<size_t>(1, std::count(succeeded.begin(), succeeded.end(), 1)));
+
+    for (size_t i = 0; i < batch.size(); ++i) {
+        if (!succeeded[i]) {
+            continue;
+        }
+        const TextureSet& set = sets[batch[i]];
+        SetWork& setWork = work[batch[i]];
+        records[i].packSeconds = packSeconds;
+        ProfileStage encoding("encode", set.baseName.c_str());
+        start = Clock::now();
+        std::vector<std::string> extensions = getBudgetExtensions(set.baseName, setWork, records[i]);
+        bool saved = true;
+        if (setWork.nmo) {
+            saved = saveOutputImage(set.baseName, "_NMO", nmo[i], extensions, options.directIo) && saved;
+        }
+        if (setWork.bcr) {
+            saved = saveOutputImage(set.baseName, "_BCR", bcr[i], extensions, options.directIo) && saved;
+        }
+        succeeded[i] = saved ? 1 : 0;
+        records[i].saveSeconds = secondsSince(start);
+        records[i].width = images[i].width;
+        records[i].height = images[i].height;
+        unloadSetImages(images[i]);
+    }
+}
+
+// Worker process of --isolate: one set per request line, decoded and packed into the shared memory the parent names.
+// Request: "S <nmo> <bcr> <shared memory> <nohq> <smdi> <as> <co> <reduction> <set name>" (tab separated)
+// Reply: "OK <width> <height> <load s> <pack s> <reduction>", a "T <width> <height> <tile hashes>" line per input signature, "END"
+int runWorker(const Options& options) {
+    bool profiling = !options.profile.empty() && startProfiler(options.profile, options.profileHz, true);
     FreeImage_Initialise();
-    ensurePBRFolderExists();
+    readCodecConfig(getCodecConfigPath());
+    setSimulatedStorage(options.simulatedStorage);
+    bakeThreads = std::max(1u, std::thread::hardware_concurrency() / options.jobs);
+    setLimits = options.limits;
+    // The parent keeps the index current; workers only read it
+    Vfs vfs;
+    std::vector<fs::path> sourceZips = findSourceZips();
+    if (!options.vfsRoots.empty() || !sourceZips.empty()) {
+        buildVfs(std::vector<fs::path>(options.vfsRoots.begin(), options.vfsRoots.end()), sourceZips, getVfsIndexPath(), vfs, false);
+        sourceVfs = &vfs;
+    }
+    SharedBuffer buffer;
+    std::string line;
+    while (std::getline(std::cin, line)) {
+        // The parent has mapped the previous buffer by now
+        closeSharedBuffer(buffer);
+        std::vector<std::string> fields;
+        std::istringstream row(line);
+        for (std::string field; std::getline(row, field, '\t');) {
+            fields.push_back(field);
+        }
+        if (fields.size() != 10 || fields[0] != "S") {
+            std::cout << "FAIL" << std::endl;
+            continue;
+        }
+        TextureSet set = { fields[9], fields[4], fields[5], fields[6], fields[7] };
+        SetWork work;
+        work.nmo = fields[1] == "1";
+        work.bcr = fields[2] == "1";
+        work.reduction = unsigned(std::strtoul(fields[8].c_str(), nullptr, 10));
+        if (work.nmo) {
+            work.nmoInputs = { getSourceSignature(set.nohq), getSourceSignature(set.smdi), getSourceSignature(set.as) };
+        }
+        if (work.bcr) {
+            work.bcrInputs = { getSourceSignature(set.co), getSourceSignature(set.smdi) };
+        }
+
+        ProfileStage stage("decode", set.baseName.c_str());
+        Clock::time_point start = Clock::now();
+        SetImages images;
+        if (!loadSetImages(set, work, nullptr, nullptr, images)) {
+            std::cout << "FAIL" << std::endl;
+            continue;
+        }
+        double loadSeconds = secondsSince(start);
+        setProfileStage("pack");
+        start = Clock::now();
+        size_t pixels = size_t(images.width) * images.height;
+        size_t outputs = (work.nmo ? 1 : 0) + (work.bcr ? 1 : 0);
+        if (!createSharedBuffer(fields[3], outputs * pixels * 4, buffer)) {
+            std::cerr << "Failed to create shared memory for: " << set.baseName << std::endl;
+            unloadSetImages(images);
+            std::cout << "FAIL" << std::endl;
+            continue;
+        }
+        BYTE* out = buffer.data;
+        if (work.nmo) {
+            kernels().packNmo(out, FreeImage_GetBits(images.nohq), FreeImage_GetBits(images.smdi), FreeImage_GetBits(images.as), pixels);
+            out += pixels * 4;
+        }
+        if (work.bcr) {
+            kernels().packBcr(out, FreeImage_GetBits(images.co), FreeImage_GetBits(images.smdi), pixels);
+        }
+        double packSeconds = secondsSince(start);
+
+        std::ostringstream reply;
+        reply << "OK\t" << images.width << '\t' << images.height << '\t' << loadSeconds << '\t' << packSeconds << '\t' << work.reduction << '\n';
+        unloadSetImages(images);
+        std::vector<InputSignature> signatures = work.nmoInputs;
+        signatures.insert(signatures.end(), work.bcrInputs.begin(), work.bcrInputs.end());
+        for (const auto& signature : signatures) {
+            reply << "T\t" << signature.width << '\t' << signature.height << '\t';
+            for (size_t i = 0; i < signature.tileHashes.size(); ++i) {
+                reply << (i ? "," : "") << toHex(signature.tileHashes[i]);
+            }
+            reply << '\n';
+        }
+        std::cout << reply.str() << "END" << std::endl;
+    }
+    closeSharedBuffer(buffer);
+    closeVfs(vfs);
+    FreeImage_DeInitialise();
+    if (profiling) {
+        stopProfiler(options.profile, true);
+    }
+    return 0;
+}
+
+// The worker processes of --isolate, one per job slot, restarted when one dies
+struct WorkerPool {
+    std::string executable;
+    std::vector<std::string> arguments;
+    std::vector<WorkerProcess> processes;
+};
+
+// --isolate: a worker process decodes and packs into shared memory, this thread encodes straight from it
+bool processSetIsolated(const TextureSet& set, SetWork& work, const Options& options, HistoryRecord& record, WorkerPool& pool, unsigned slot) {
+    static std::atomic<unsigned long long> sequence{ 0 };
+    WorkerProcess& process = pool.processes[slot];
+    std::string name = makeSharedBufferName(slot, ++sequence);
+    std::string request = std::string("S\t") + (work.nmo ? "1" : "0") + "\t" + (work.bcr ? "1" : "0") + "\t" + name + "\t" +
+        set.nohq + "\t" + set.smdi + "\t" + set.as + "\t" + set.co + "\t" + std::to_string(work.reduction) + "\t" + set.baseName;
+
+    std::string reply;
+    std::vector<std::string> lines;
+    bool answered = sendLine(process, request) && readLine(process, reply);
+    if (answered && reply.rfind("OK\t", 0) == 0) {
+        std::string line;
+        while ((answered = readLine(process, line)) && line != "END") {
+            lines.push_back(line);
+        }
+    }
+    if (!answered) {
+        removeSharedBuffer(name);
+        std::cerr << "Worker process died (" << stopWorker(process) << ") on set: " << set.baseName << std::endl;
+        if (!spawnWorker(pool.executable, pool.arguments, process)) {
+            std::cerr << "Failed to restart worker process " << slot << std::endl;
+        }
+        return false;
+    }
+    if (reply.rfind("OK\t", 0) != 0) {
+        std::cerr << "Failed to load or process one or more images of: " << set.baseName << std::endl;
+        return false;
+    }
+
+    unsigned width = 0, height = 0;
+    std::istringstream header(reply.substr(3));
+    unsigned reduction = 0;
+    header >> width >> height >> record.loadSeconds >> record.packSeconds >> reduction;
+    record.outputs = getOutputList(work.nmo, work.bcr);
+    if (reduction > 0) {
+        work.reduction = reduction;
+        work.fallback = describeReduction(reduction);
+    }
+    std::vector<InputSignature*> signatures;
+    for (auto& signature : work.nmoInputs) {
+        signatures.push_back(&signature);
+    }
+    for (auto& signature : work.bcrInputs) {
+        signatures.push_back(&signature);
+    }
+    for (size_t i = 0; i < lines.size() && i < signatures.size(); ++i) {
+        std::istringstream row(lines[i].substr(2));
+        std::string hashes;
+        row >> signatures[i]->width >> signatures[i]->height >> hashes;
+        std::istringstream list(hashes);
+        signatures[i]->tileHashes.clear();
+        for (std::string hash; std::getline(list, hash, ',');) {
+            signatures[i]->tileHashes.push_back(std::stoull(hash, nullptr, 16));
+        }
+    }
+
+    ProfileStage stage("encode", set.baseName.c_str());
+    Clock::time_point start = Clock::now();
+    size_t pixels = size_t(width) * height;
+    size_t outputs = (work.nmo ? 1 : 0) + (work.bcr ? 1 : 0);
+    SharedBuffer buffer;
+    bool mapped = openSharedBuffer(name, outputs * pixels * 4, buffer);
+    removeSharedBuffer(name);
+    if (!mapped) {
+        std::cerr << "Failed to open shared memory for: " << set.baseName << std::endl;
+        return false;
+    }
+    bool saved = true;
+    std::vector<std::string> extensions = getBudgetExtensions(set.baseName, work, record);
+    BYTE* pixelsIn = buffer.data;
+    for (const char* suffix : { "_NMO", "_BCR" }) {
+        if ((suffix[1] == 'N' && !work.nmo) || (suffix[1] == 'B' && !work.bcr)) {
+            continue;
+        }
+        // Header-only bitmap over the shared pixels
+        FIBITMAP* dib = FreeImage_ConvertFromRawBitsEx(FALSE, pixelsIn, FIT_BITMAP, width, height, width * 4, 32,
+            FI_RGBA_RED_MASK, FI_RGBA_GREEN_MASK, FI_RGBA_BLUE_MASK, FALSE);
+        saved = dib && saveImage(set.baseName, suffix, dib, extensions, options.directIo) && saved;
+        FreeImage_Unload(dib);
+        pixelsIn += pixels * 4;
+    }
+    closeSharedBuffer(buffer);
+    record.saveSeconds = secondsSince(start);
+    record.width = width;
+    record.height = height;
+    return saved;
+}
+
+void printFallbacks(const std::vector<std::string>& fallbacks) {
+    if (fallbacks.empty()) {
+        return;
+    }
+    std::cout << "Sets over their limits:" << std::endl;
+    for (const auto& fallback : fallbacks) {
+        std::cout << "  " << fallback << std::endl;
+    }
+}
+
+// Role of an archive entry from its name: 0 NOHQ, 1 SMDI, 2 AS, 3 CO, -1 for anything that is not a set input
+int getArchiveRole(const std::string& name) {
+    if (!findDecoder(getCodecExtension(name))) {
+        return -1;
+    }
+    std::string stem = getBaseName(name);
+    const char* suffixes[4] = { "_nohq", "_smdi", "_as", "_co" };
+    for (int role = 0; role < 4; ++role) {
+        if (stem.ends_with(suffixes[role])) {
+            return role;
+        }
+    }
+    return -1;
+}
+
+// Folder of an archive entry as an output folder: '/'-separated, without ".", ".." or empty components, so no
+// entry name can place outputs outside PBR_Result
+std::string getArchiveFolder(const std::string& name) {
+    std::string folder;
+    size_t start = 0;
+    size_t end = name.find_last_of("\\/");
+    while (end != std::string::npos && start < end) {
+        size_t separator = std::min(name.find_first_of("\\/", start), end);
+        std::string part = name.substr(start, separator - start);
+        if (!part.empty() && part != "." && part != "..") {
+            folder += (folder.empty() ? "" : "/") + part;
+        }
+        start = separator + 1;
+    }
+    return folder;
+}
+
+// --stdin-archive: inputs come from a tar or cpio stream and are grouped into sets by folder and name as they arrive.
+// Only incomplete sets are held back; a complete set is handed to the workers with its files in memory. Inputs have
+// no timestamps worth trusting, so every set is converted and the manifest is left alone
+bool convertArchiveStream(const Options& options, bool wantNmo, bool wantBcr) {
+    struct PendingSet {
+        TextureSet set;
+        std::vector<BYTE> data[4];
+        bool present[4] = {};
+    };
+    struct QueuedSet {
+        TextureSet set;
+        SetWork work;
+        uint64_t bytes = 0;
+    };
+    ArchiveStream stream;
+    openArchiveStdin(stream);
+    ReadAhead store;
+    std::map<std::string, PendingSet> pending;
+    std::deque<QueuedSet> queue;
+    std::mutex mutex;
+    std::condition_variable changed;
+    uint64_t queuedBytes = 0;
+    bool ended = false;
+    size_t converted = 0;
+    std::vector<std::string> failedSets;
+    std::vector<std::string> fallbacks;
+
+    auto worker = [&]() {
+        for (;;) {
+            QueuedSet queued;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&]() { return ended || !queue.empty(); });
+                if (queue.empty()) {
+                    return;
+                }
+                queued = std::move(queue.front());
+                queue.pop_front();
+            }
+            HistoryRecord record;
+            bool ok = processSet(queued.set, queued.work, options, record, nullptr, &store);
+            std::lock_guard<std::mutex> lock(mutex);
+            queuedBytes -= queued.bytes;
+            if (ok) {
+                ++converted;
+                if (!queued.work.fallback.empty()) {
+                    fallbacks.push_back(queued.set.baseName + ": " + queued.work.fallback);
+                }
+            }
+            else {
+                failedSets.push_back(queued.set.baseName);
+            }
+            changed.notify_all();
+        }
+    };
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < options.jobs; ++i) {
+        workers.emplace_back(worker);
+    }
+
+    // Puts the files of a set in the store and queues it; AS may be missing and is then baked
+    auto enqueue = [&](PendingSet& entry) {
+        QueuedSet queued;
+        queued.set = entry.set;
+        queued.work.nmo = wantNmo;
+        queued.work.bcr = wantBcr;
+        const std::string* files[4] = { &entry.set.nohq, &entry.set.smdi, &entry.set.as, &entry.set.co };
+        InputSignature signatures[4];
+        for (int role = 0; role < 4; ++role) {
+            signatures[role].path = *files[role];
+            signatures[role].size = entry.data[role].size();
+            if (entry.present[role] && (role == 1 || (role == 3 ? wantBcr : wantNmo))) {
+                queued.bytes += entry.data[role].size();
+                putReadAhead(store, *files[role], std::move(entry.data[role]));
+            }
+        }
+        if (wantNmo) {
+            queued.work.nmoInputs = { signatures[0], signatures[1], signatures[2] };
+        }
+        if (wantBcr) {
+            queued.work.bcrInputs = { signatures[3], signatures[1] };
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        queuedBytes += queued.bytes;
+        queue.push_back(std::move(queued));
+        changed.notify_one();
+    };
 
+    std::string name;
+    std::vector<BYTE> data;
+    // Entries that are not set inputs are skipped by name, before their data is read
+    auto isSetInput = [](const std::string& entryName) { return getArchiveRole(entryName) >= 0; };
+    while (readArchiveEntry(stream, name, data, isSetInput)) {
+        int role = getArchiveRole(name);
+        // Folder plus the name without its role suffix, so equally named sets in different folders stay apart
+        std::string stem = getBaseName(name);
+        std::string key = name.substr(0, name.find_last_of("\\/") + 1) + stem.substr(0, stem.rfind('_'));
+        PendingSet& entry = pending[key];
+        std::string* files[4] = { &entry.set.nohq, &entry.set.smdi, &entry.set.as, &entry.set.co };
+        *files[role] = name;
+        entry.data[role] = std::move(data);
+        entry.present[role] = true;
+        // Outputs mirror the folder, as for indexed installs, so equally named sets do not write the same files
+        if (role == 0) {
+            std::string folder = getArchiveFolder(name);
+            entry.set.baseName = folder.empty() ? stem : folder + "/" + stem;
+        }
+        if (entry.present[0] && entry.present[1] && (!wantNmo || entry.present[2]) && (!wantBcr || entry.present[3])) {
+            enqueue(entry);
+            pending.erase(key);
+            // Reading on is held back while the queued sets exceed the read-ahead budget
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&]() { return queuedBytes == 0 || queuedBytes < options.readAheadBytes; });
+        }
+        data.clear();
+    }
+    if (stream.damaged) {
+        std::cerr << "The archive on stdin is damaged or truncated" << std::endl;
+    }
+
+    // Sets still waiting for their AS map at the end get it baked; any other gap fails the set
+    size_t incomplete = 0;
+    for (auto& [key, entry] : pending) {
+        if (!stream.damaged && entry.present[0] && entry.present[1] && (!wantBcr || entry.present[3])) {
+            enqueue(entry);
+        }
+        else {
+            std::cerr << "Incomplete set: " << key << std::endl;
+            ++incomplete;
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ended = true;
+        changed.notify_all();
+    }
+    for (auto& thread : workers) {
+        thread.join();
+    }
+    stopReadAhead(store);
+
+    std::cout << "Read " << stream.bytesRead / (1024 * 1024) << " MB from stdin: " << converted << " sets converted" << std::endl;
+    printFallbacks(fallbacks);
+    if (!failedSets.empty()) {
+        std::cerr << "Failed sets:";
+        for (const auto& failedName : failedSets) {
+            std::cerr << " " << failedName;
+        }
+        std::cerr << std::endl;
+    }
+    return !stream.damaged && incomplete == 0 && failedSets.empty();
+}
+
+// Sets of the source textures; incomplete counts the sets skipped for a missing role
+bool pairTextureSets(bool wantNmo, bool wantBcr, std::vector<TextureSet>& sets, size_t& incomplete) {
     std::vector<std::string> nohqFiles = findFilesWithSuffix("_nohq");
     std::vector<std::string> smdiFiles = findFilesWithSuffix("_smdi");
     std::vector<std::string> asFiles = findFilesWithSuffix("_as");
     std::vector<std::string> coFiles = findFilesWithSuffix("_co");
 
-    if (nohqFiles.empty() || smdiFiles.empty() || asFiles.empty() || coFiles.empty()) {
+    // NOHQ names the sets; the other roles are only required by the outputs being built
+    if (nohqFiles.empty() || smdiFiles.empty() || (wantBcr && coFiles.empty())) {
         std::cerr << "Failed to load one or more image sets." << std::endl;
-        FreeImage_DeInitialise();
+        return false;
+    }
+    if (wantNmo && asFiles.empty()) {
+        std::cout << "No _as maps: ambient occlusion is baked from the NOHQ normals" << std::endl;
+    }
+
+    // A role is paired by folder and name first, so a set spread over a ZIP and loose files stays together and equally
+    // named sets of different addons stay apart; otherwise by position among the files of the same folder
+    struct RoleIndex {
+        std::unordered_map<std::string, std::string> byName;
+        std::unordered_map<std::string, std::vector<std::string>> byFolder;
+    };
+    auto getPairingKey = [](const std::string& file, size_t suffixLength) {
+        std::string name = getBaseName(file);
+        std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return char(tolower(c)); });
+        return getSourceFolder(file) + "/" + name.substr(0, name.size() - suffixLength);
+    };
+    auto indexRole = [&](const std::vector<std::string>& files, size_t suffixLength) {
+        RoleIndex index;
+        for (const auto& file : files) {
+            index.byName.emplace(getPairingKey(file, suffixLength), file);
+            index.byFolder[getSourceFolder(file)].push_back(file);
+        }
+        return index;
+    };
+    RoleIndex smdiIndex = indexRole(smdiFiles, 5);
+    RoleIndex asIndex = indexRole(asFiles, 3);
+    RoleIndex coIndex = indexRole(coFiles, 3);
+    std::unordered_map<std::string, size_t> nohqPositions;
+    for (const auto& nohq : nohqFiles) {
+        std::string folder = getSourceFolder(nohq);
+        std::string key = getPairingKey(nohq, 5);
+        size_t position = nohqPositions[folder]++;
+        auto pick = [&](const RoleIndex& index) {
+            auto found = index.byName.find(key);
+            if (found != index.byName.end()) {
+                return found->second;
+            }
+            auto sameFolder = index.byFolder.find(folder);
+            return sameFolder != index.byFolder.end() ? sameFolder->second[position % sameFolder->second.size()] : std::string();
+        };
+        TextureSet set = { getSetName(nohq), nohq, pick(smdiIndex), pick(asIndex), pick(coIndex) };
+        if (set.smdi.empty() || (wantBcr && set.co.empty())) {
+            std::cerr << "Incomplete set: " << set.baseName << std::endl;
+            ++incomplete;
+            continue;
+        }
+        sets.push_back(set);
+    }
+    return true;
+}
+
+bool parseArguments(int argc, char* argv[], Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        try {
+            if (arg == "--jobs" && i + 1 < argc) {
+                options.jobs = std::max(1u, static_cast<unsigned>(std::stoul(argv[++i])));
+            }
+            else if (arg == "--memory-budget" && i + 1 < argc) {
+                options.memoryBudget = std::stoull(argv[++i]) * 1024 * 1024;
+            }
+            else if (arg == "--history") {
+                options.showHistory = true;
+            }
+            else if (arg == "--capture-workload" && i + 1 < argc) {
+                options.captureWorkload = argv[++i];
+            }
+            else if (arg == "--replay-workload" && i + 1 < argc) {
+                options.replayWorkload = argv[++i];
+            }
+            else if (arg == "--replay-dir" && i + 1 < argc) {
+                options.replayFolder = argv[++i];
+            }
+            else if (arg == "--isa" && i + 1 < argc) {
+                options.isa = argv[++i];
+            }
+            else if (arg == "--selftest") {
+                options.selfTest = true;
+            }
+            else if (arg == "--benchmark-pack") {
+                options.packBenchmark = true;
+            }
+            else if (arg == "--direct-io") {
+                options.directIo = true;
+            }
+            else if (arg == "--only" && i + 1 < argc && (std::string(argv[i + 1]) == "nmo" || std::string(argv[i + 1]) == "bcr")) {
+                options.only = argv[++i];
+            }
+            else if (arg == "--force") {
+                options.force = true;
+            }
+            else if (arg == "--calibrate") {
+                options.calibrate = true;
+            }
+            else if (arg == "--read-order" && i + 1 < argc && (std::string(argv[i + 1]) == "name" || std::string(argv[i + 1]) == "physical")) {
+                options.physicalReadOrder = std::string(argv[++i]) == "physical";
+            }
+            else if (arg == "--read-ahead" && i + 1 < argc) {
+                options.readAheadBytes = std::stoull(argv[++i]) * 1024 * 1024;
+            }
+            else if (arg == "--isolate") {
+                options.isolate = true;
+            }
+            else if (arg == "--worker") {
+                options.worker = true;
+            }
+            else if (arg == "--referenced-by" && i + 1 < argc) {
+                options.referencedBy = argv[++i];
+            }
+            else if (arg == "--reuse-similar" && i + 1 < argc) {
+                options.reuseSimilar = true;
+                options.similarityBits = static_cast<unsigned>(std::stoul(argv[++i]));
+            }
+            else if (arg == "--simulate-storage" && i + 1 < argc) {
+                options.simulatedStorageText = argv[++i];
+                if (!parseSimulatedStorage(options.simulatedStorageText, options.simulatedStorage)) {
+                    std::cerr << "Expected --simulate-storage LATENCY_MS,MB_PER_S,METADATA_MS" << std::endl;
+                    return false;
+                }
+            }
+            else if (arg == "--max-set-pixels" && i + 1 < argc) {
+                // Fractions are allowed; a value that rounds to no pixel would silently mean no limit
+                double megapixels = std::stod(argv[++i]);
+                if (!(megapixels * 1e6 >= 0.5) || megapixels > 1e12) {
+                    std::cerr << "Expected --max-set-pixels MEGAPIXELS above 0" << std::endl;
+                    return false;
+                }
+                options.limits.pixels = uint64_t(std::llround(megapixels * 1e6));
+            }
+            else if (arg == "--max-set-memory" && i + 1 < argc) {
+                options.limits.bytes = std::stoull(argv[++i]) * 1024 * 1024;
+            }
+            else if (arg == "--max-set-seconds" && i + 1 < argc) {
+                options.limits.seconds = std::stod(argv[++i]);
+            }
+            else if (arg == "--stdin-archive") {
+                options.archiveInput = true;
+            }
+            else if (arg == "--background") {
+                options.background = true;
+            }
+            else if (arg == "--profile" && i + 1 < argc) {
+                options.profile = fs::absolute(argv[++i]).string();
+            }
+            else if (arg == "--profile-hz" && i + 1 < argc) {
+                options.profileHz = static_cast<unsigned>(std::stoul(argv[++i]));
+            }
+            else if (arg == "--checksums" && i + 1 < argc) {
+                options.checksums = argv[++i];
+                if (!parseChecksums(options.checksums, checksumSelection)) {
+                    std::cerr << "Expected --checksums sha256|xxh64[,...]" << std::endl;
+                    return false;
+                }
+            }
+            else if (arg == "--vfs" && i + 1 < argc) {
+                options.vfsRoots.push_back(fs::absolute(argv[++i]).lexically_normal().string());
+            }
+            else {
+                std::cerr << "Unknown argument: " << arg << std::endl;
+                return false;
+            }
+        }
+        catch (const std::exception&) {
+            std::cerr << "Invalid value for " << arg << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+void printUsage() {
+    std::cerr << "Usage: Arma-Legacy2PBR [--jobs N] [--memory-budget MB] [--history]\n"
+        "                      [--capture-workload FILE] [--replay-workload FILE [--replay-dir DIR]]\n"
+        "                      [--isa scalar|sse2|ssse3|avx2|avx512] [--selftest] [--benchmark-pack]\n"
+        "                      [--direct-io] [--only nmo|bcr] [--force] [--calibrate]\n"
+        "                      [--read-order name|physical [--read-ahead MB]] [--isolate]\n"
+        "                      [--referenced-by ADDON_DIR] [--vfs INSTALL_DIR]... [--reuse-similar BITS]\n"
+        "                      [--simulate-storage LATENCY_MS,MB_PER_S,METADATA_MS] [--stdin-archive]\n"
+        "                      [--max-set-pixels MEGAPIXELS] [--max-set-memory MB] [--max-set-seconds S]\n"
+        "                      [--background] [--checksums sha256|xxh64[,...]] [--profile FILE [--profile-hz N]]" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    if (!parseArguments(argc, argv, options)) {
+        printUsage();
         return -1;
     }
 
-    for (size_t i = 0; i < nohqFiles.size(); ++i) {
-        FIBITMAP* nohq = loadImage(nohqFiles[i]);
-        FIBITMAP* smdi = loadImage(smdiFiles[i % smdiFiles.size()]);
-        FIBITMAP* as = loadImage(asFiles[i % asFiles.size()]);
-        FIBITMAP* co = loadImage(coFiles[i % coFiles.size()]);
+    if (options.showHistory) {
+        printHistoryTrends(readHistory(getHistoryPath()));
+        return 0;
+    }
 
-        if (!nohq || !smdi || !as || !co) {
-            std::cerr << "Failed to load or process one or more images." << std::endl;
-            FreeImage_Unload(nohq);
-            FreeImage_Unload(smdi);
-            FreeImage_Unload(as);
-            FreeImage_Unload(co);
-            FreeImage_DeInitialise();
-            return -1;
+    IsaLevel isa = detectIsa();
+    if (!options.isa.empty() && !parseIsaLevel(options.isa, isa)) {
+        std::cerr << "Unknown instruction set: " << options.isa << std::endl;
+        printUsage();
+        return -1;
+    }
+    if (options.selfTest) {
+        return runKernelSelfTest() ? 0 : -1;
+    }
+    if (options.packBenchmark) {
+        runPackBenchmark();
+        return 0;
+    }
+    if (!selectIsa(isa)) {
+        return -1;
+    }
+    // Before any thread starts, so that all of them inherit the idle priorities
+    std::string backgroundMode = options.background ? enterBackgroundMode() : std::string();
+    if (options.worker) {
+        return runWorker(options);
+    }
+    std::cout << "Using " << isaName(activeIsa()) << " kernels" << std::endl;
+    if (options.background) {
+        std::cout << "Background mode: " << (backgroundMode.empty() ? "priorities unchanged" : backgroundMode) << std::endl;
+    }
+
+    FreeImage_Initialise();
+
+    // Backends per format come from codecs.cfg, written by --calibrate; FreeImage is the default
+    readCodecConfig(getCodecConfigPath());
+    if (options.calibrate) {
+        bool calibrated = calibrateCodecs(fs::current_path() / "Calibrate", 2048) && writeCodecConfig(getCodecConfigPath());
+        std::error_code error;
+        fs::remove(fs::current_path() / "Calibrate", error);
+        if (calibrated) {
+            std::cout << "Codec choices saved to: " << getCodecConfigPath().string() << std::endl;
         }
+        FreeImage_DeInitialise();
+        return calibrated ? 0 : -1;
+    }
 
-        unsigned int width = FreeImage_GetWidth(nohq);
-        unsigned int height = FreeImage_GetHeight(nohq);
+    // Calibration measures the real codecs; everything after it sees the simulated share
+    setSimulatedStorage(options.simulatedStorage);
+    setLimits = options.limits;
 
-        if (FreeImage_GetBPP(nohq) < 32 || FreeImage_GetBPP(smdi) < 32 ||
-            FreeImage_GetBPP(as) < 32 || FreeImage_GetBPP(co) < 32) {
-            std::cerr << "One or more images do not have sufficient channels for processing." << std::endl;
-            FreeImage_Unload(nohq);
-            FreeImage_Unload(smdi);
-            FreeImage_Unload(as);
-            FreeImage_Unload(co);
+    Vfs vfs;
+    std::vector<fs::path> sourceZips = findSourceZips();
+    if (!options.vfsRoots.empty() || !sourceZips.empty()) {
+        if (!buildVfs(std::vector<fs::path>(options.vfsRoots.begin(), options.vfsRoots.end()), sourceZips, getVfsIndexPath(), vfs)) {
+            std::cerr << "The virtual file system index could not be saved; it will be rebuilt next run" << std::endl;
+        }
+        std::cout << "Indexed " << vfs.archives.size() << " archives: " << vfs.entries.size() << " virtual files" << std::endl;
+        sourceVfs = &vfs;
+    }
+
+    // Replay runs on a synthesized corpus in its own folder, with its own results and history
+    std::vector<WorkloadSet> replaySets;
+    if (!options.replayWorkload.empty()) {
+        std::vector<WorkloadInput> profile = readWorkloadProfile(options.replayWorkload);
+        fs::path replayFolder = fs::absolute(options.replayFolder);
+        if (profile.empty() || !synthesizeWorkload(profile, replayFolder / "TGA_Result", replaySets)) {
             FreeImage_DeInitialise();
             return -1;
         }
+        fs::current_path(replayFolder);
+    }
+
+    ensurePBRFolderExists();
+    bool profiling = !options.profile.empty() && startProfiler(options.profile, options.profileHz, false);
+
+    if (options.archiveInput) {
+        bakeThreads = std::max(1u, std::thread::hardware_concurrency() / options.jobs);
+        bool converted = convertArchiveStream(options, options.only != "bcr", options.only != "nmo");
+        converted = writeRunManifest(getRunManifestPath()) && converted;
+        if (profiling) {
+            stopProfiler(options.profile, false);
+        }
+        printIoReport();
+        closeVfs(vfs);
+        FreeImage_DeInitialise();
+        return converted ? 0 : -1;
+    }
 
-        FIBITMAP* nohqPrepared = FreeImage_ConvertTo32Bits(nohq);
-        FIBITMAP* smdiPrepared = FreeImage_ConvertTo32Bits(smdi);
-        FIBITMAP* asPrepared = FreeImage_ConvertTo32Bits(as);
-        FIBITMAP* coPrepared = FreeImage_ConvertTo32Bits(co);
+    bool wantNmo = options.only != "bcr";
+    bool wantBcr = options.only != "nmo";
+    std::vector<TextureSet> sets;
+    size_t incomplete = 0;
+    if (!options.replayWorkload.empty()) {
+        // Replayed sets are put together as captured rather than paired again
+        for (const auto& files : replaySets) {
+            TextureSet set = { getSetName(files.nohq), files.nohq, files.smdi, files.as, files.co };
+            if (set.nohq.empty()) {
+                continue;
+            }
+            if (set.smdi.empty() || (wantBcr && set.co.empty())) {
+                std::cerr << "Incomplete set: " << set.baseName << std::endl;
+                ++incomplete;
+                continue;
+            }
+            sets.push_back(set);
+        }
+    }
+    else if (!pairTextureSets(wantNmo, wantBcr, sets, incomplete)) {
+        FreeImage_DeInitialise();
+        return -1;
+    }
+    bakeThreads = std::max(1u, std::thread::hardware_concurrency() / options.jobs);
+
+    // Sets no model, config or material refers to are dead and not converted
+    if (!options.referencedBy.empty()) {
+        std::unordered_set<std::string> referenced = scanTextureReferences(options.referencedBy, std::max(1u, std::thread::hardware_concurrency()), sourceVfs);
+        size_t total = sets.size();
+        sets.erase(std::remove_if(sets.begin(), sets.end(), [&](const TextureSet& set) {
+            for (const std::string* file : { &set.co, &set.nohq, &set.smdi, &set.as }) {
+                if (!file->empty() && referenced.count(getTextureKey(*file))) {
+                    return false;
+                }
+            }
+            std::cout << "Not referenced: " << set.baseName << std::endl;
+            return true;
+        }), sets.end());
+        std::cout << "Converting " << sets.size() << " of " << total << " sets" << std::endl;
+    }
 
-        // Check image dimensions and rescale if necessary
-        if (FreeImage_GetWidth(asPrepared) != width || FreeImage_GetHeight(asPrepared) != height) {
-            FIBITMAP* resized = FreeImage_Rescale(asPrepared, width, height);
-            FreeImage_Unload(asPrepared);
-            asPrepared = resized;
+    // Rebuild only the outputs whose inputs changed since they were last written
+    BuildManifest manifest = options.force ? BuildManifest() : readBuildManifest(getManifestPath());
+    std::vector<SetWork> work(sets.size());
+    std::vector<size_t> order;
+    for (size_t i = 0; i < sets.size(); ++i) {
+        const TextureSet& set = sets[i];
+        SetWork& setWork = work[i];
+        if (wantNmo) {
+            setWork.nmoInputs = { getSourceSignature(set.nohq), getSourceSignature(set.smdi), getSourceSignature(set.as) };
+            bool exists = outputFilesExist(set.baseName, "_NMO");
+            setWork.nmo = !isOutputUpToDate(manifest, set.baseName + "_NMO", setWork.nmoInputs) || !exists;
+            auto previous = manifest.find(set.baseName + "_NMO");
+            if (setWork.nmo && exists && previous != manifest.end()) {
+                setWork.previousNmo = previous->second;
+            }
+        }
+        if (wantBcr) {
+            setWork.bcrInputs = { getSourceSignature(set.co), getSourceSignature(set.smdi) };
+            bool exists = outputFilesExist(set.baseName, "_BCR");
+            setWork.bcr = !isOutputUpToDate(manifest, set.baseName + "_BCR", setWork.bcrInputs) || !exists;
+            auto previous = manifest.find(set.baseName + "_BCR");
+            if (setWork.bcr && exists && previous != manifest.end()) {
+                setWork.previousBcr = previous->second;
+            }
+        }
+        if (setWork.nmo || setWork.bcr) {
+            order.push_back(i);
         }
+        else {
+            std::cout << "Up to date: " << set.baseName << std::endl;
+        }
+    }
+
+    // Near-identical recolors take their NMO from an earlier set instead of decoding, packing and encoding it again
+    std::vector<std::pair<size_t, size_t>> sharedNmo;
+    if (options.reuseSimilar && std::any_of(work.begin(), work.end(), [](const SetWork& setWork) { return setWork.nmo; })) {
+        sharedNmo = findSharedNmo(sets, work, options.similarityBits);
+        order.erase(std::remove_if(order.begin(), order.end(), [&](size_t i) {
+            return !work[i].nmo && !work[i].bcr;
+        }), order.end());
+    }
 
-        // Create new images for NMO and BCR
-        FIBITMAP* nmo = FreeImage_Allocate(width, height, 32);
-        FIBITMAP* bcr = FreeImage_Allocate(width, height, 32);
+    // Predict per-set cost from earlier runs
+    CostModel model = trainCostModel(readHistory(getHistoryPath()));
+    std::vector<CostEstimate> estimates;
+    for (const auto& set : sets) {
+        estimates.push_back(predictSetCost(model, set.baseName, getSetFormats(set), getSetInputBytes(set)));
+    }
 
-        BYTE* nohqBits = FreeImage_GetBits(nohqPrepared);
-        BYTE* smdiBits = FreeImage_GetBits(smdiPrepared);
-        BYTE* asBits = FreeImage_GetBits(asPrepared);
-        BYTE* coBits = FreeImage_GetBits(coPrepared);
-        BYTE* nmoBuffer = FreeImage_GetBits(nmo);
-        BYTE* bcrBuffer = FreeImage_GetBits(bcr);
+    // Sets predicted over the per-set limits are decoded at a reduced size from the start; the scheduler and the
+    // memory budget see them at that size
+    for (size_t i = 0; i < sets.size(); ++i) {
+        work[i].reduction = getBudgetReduction(estimates[i].pixels, estimates[i].seconds);
+        estimates[i].pixels >>= 2 * work[i].reduction;
+        estimates[i].seconds /= double(1u << (2 * work[i].reduction));
+    }
 
-        for (unsigned int y = 0; y < height; ++y) {
-            for (unsigned int x = 0; x < width; ++x) {
-                unsigned int index = (x + y * width) * 4;
+    // Longest predicted sets first so no worker is left finishing a big set alone
+    if (options.jobs > 1) {
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return estimates[a].seconds > estimates[b].seconds;
+        });
+    }
 
-                nmoBuffer[index + 0] = smdiBits[index + 1];
-                nmoBuffer[index + 1] = nohqBits[index + 1];
-                nmoBuffer[index + 2] = nohqBits[index + 2];
-                nmoBuffer[index + 3] = asBits[index + 1];
-                
-                bcrBuffer[index + 0] = coBits[index + 0];
-                bcrBuffer[index + 1] = coBits[index + 1];
-                bcrBuffer[index + 2] = coBits[index + 2];
-                bcrBuffer[index + 3] = smdiBits[index + 0];
+    // On HDD arrays one thread reads every input in disk order, and sets are handed to the workers
+    // in the order their last input arrives
+    ReadAhead readAhead;
+    if (options.physicalReadOrder && !options.isolate) {
+        std::vector<std::string> files;
+        for (size_t setIndex : order) {
+            const TextureSet& set = sets[setIndex];
+            std::vector<std::string> needed = { set.smdi };
+            if (work[setIndex].nmo) {
+                needed.push_back(set.nohq);
+                needed.push_back(set.as);
             }
+            if (work[setIndex].bcr) {
+                needed.push_back(set.co);
+            }
+            // Archived inputs are already served from the archive's mapping
+            for (const auto& file : needed) {
+                if (!file.empty() && !findArchivedFile(file) && std::find(files.begin(), files.end(), file) == files.end()) {
+                    files.push_back(file);
+                }
+            }
+        }
+        std::vector<std::string> diskOrder = orderByDiskLocation(files);
+        std::unordered_map<std::string, size_t> position;
+        for (size_t i = 0; i < diskOrder.size(); ++i) {
+            position[diskOrder[i]] = i;
         }
+        std::vector<size_t> lastRead(sets.size(), 0);
+        for (size_t setIndex : order) {
+            const TextureSet& set = sets[setIndex];
+            for (const std::string* file : { &set.nohq, &set.smdi, &set.as, &set.co }) {
+                auto found = position.find(*file);
+                if (found != position.end()) {
+                    lastRead[setIndex] = std::max(lastRead[setIndex], found->second);
+                }
+            }
+        }
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return lastRead[a] < lastRead[b];
+        });
+        startReadAhead(readAhead, diskOrder, options.readAheadBytes);
+    }
 
-        std::string baseName = getBaseName(nohqFiles[i]);
-        std::vector<std::string> extensions = { ".tga", ".tif", ".png" };
+    std::string runId = makeRunId();
+    Clock::time_point runStart = Clock::now();
+    std::vector<HistoryRecord> records;
+    std::vector<std::vector<WorkloadInput>> captured(sets.size());
+    std::mutex mutex;
+    std::condition_variable admitted;
+    size_t next = 0;
+    uint64_t bytesInFlight = 0;
+    unsigned running = 0;
+    bool failed = false;
+    std::vector<std::string> failedSets;
+    std::vector<std::string> fallbacks;
 
-        saveImage(baseName, "_NMO", nmo, extensions);
-        saveImage(baseName, "_BCR", bcr, extensions);
+    // --isolate runs decoding in child processes, so a decoder crash costs one set instead of the batch
+    size_t threadCount = std::max<size_t>(1, std::min<size_t>(options.jobs, order.size()));
+    unsigned allowedWorkers = unsigned(threadCount);
+    WorkerPool pool;
+    if (options.isolate && !order.empty()) {
+        pool.executable = getExecutablePath(argv[0]);
+        pool.arguments = { "--worker", "--isa", isaName(activeIsa()), "--jobs", std::to_string(options.jobs) };
+        for (const auto& root : options.vfsRoots) {
+            pool.arguments.push_back("--vfs");
+            pool.arguments.push_back(root);
+        }
+        // Windows does not pass background processing mode on to child processes
+        if (options.background) {
+            pool.arguments.push_back("--background");
+        }
+        if (profiling) {
+            pool.arguments.insert(pool.arguments.end(), { "--profile", options.profile, "--profile-hz", std::to_string(options.profileHz) });
+        }
+        if (options.simulatedStorage.enabled) {
+            pool.arguments.push_back("--simulate-storage");
+            pool.arguments.push_back(options.simulatedStorageText);
+        }
+        // Workers reduce sets whose real size exceeds what the estimate planned for
+        if (options.limits.pixels) {
+            pool.arguments.push_back("--max-set-pixels");
+            pool.arguments.push_back(std::to_string(double(options.limits.pixels) / 1e6));
+        }
+        if (options.limits.bytes) {
+            pool.arguments.push_back("--max-set-memory");
+            pool.arguments.push_back(std::to_string(options.limits.bytes / (1024 * 1024)));
+        }
+        pool.processes.resize(threadCount);
+        for (auto& process : pool.processes) {
+            if (!spawnWorker(pool.executable, pool.arguments, process)) {
+                std::cerr << "Failed to start worker process: " << pool.executable << std::endl;
+                for (auto& started : pool.processes) {
+                    stopWorker(started);
+                }
+                FreeImage_DeInitialise();
+                return -1;
+            }
+        }
+    }
 
-        FreeImage_Unload(nohq);
-        FreeImage_Unload(smdi);
-        FreeImage_Unload(as);
-        FreeImage_Unload(co);
-        FreeImage_Unload(nmo);
-        FreeImage_Unload(bcr);
+    // Workloads are captured per set and isolated workers take one set per request, so only the in-process path batches
+    bool batchTiny = !options.isolate && options.captureWorkload.empty();
+    auto worker = [&](unsigned slot) {
+        for (;;) {
+            std::vector<size_t> batch;
+            uint64_t bytes = 0;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                // Admit the next set only while the predicted working set fits the memory budget
+                // and, in background mode, while fewer workers run than the system has room for
+                admitted.wait(lock, [&]() {
+                    if (failed || next >= order.size()) {
+                        return true;
+                    }
+                    if (running >= allowedWorkers) {
+                        return false;
+                    }
+                    if (bytesInFlight == 0 || options.memoryBudget == 0) {
+                        return true;
+                    }
+                    return bytesInFlight + estimates[order[next]].pixels * peakBytesPerPixel <= options.memoryBudget;
+                });
+                if (failed || next >= order.size()) {
+                    return;
+                }
+                batch.push_back(order[next++]);
+                // Tiny sets right behind it come along, leaving a share of them for the other threads
+                if (batchTiny && estimates[batch[0]].pixels <= tinySetPixels) {
+                    size_t share = std::min(tinyBatchSets, (order.size() - next + threadCount) / threadCount);
+                    while (batch.size() < share && next < order.size() && estimates[order[next]].pixels <= tinySetPixels) {
+                        batch.push_back(order[next++]);
+                    }
+                }
+                for (size_t setIndex : batch) {
+                    bytes += estimates[setIndex].pixels * peakBytesPerPixel;
+                }
+                bytesInFlight += bytes;
+                ++running;
+            }
+
+            std::vector<HistoryRecord> batchRecords(batch.size());
+            for (size_t i = 0; i < batch.size(); ++i) {
+                const TextureSet& set = sets[batch[i]];
+                batchRecords[i].runId = runId;
+                batchRecords[i].toolVersion = toolVersion;
+                batchRecords[i].setName = set.baseName;
+                batchRecords[i].formats = getSetFormats(set);
+                batchRecords[i].inputBytes = getSetInputBytes(set);
+            }
+            std::vector<char> succeeded(batch.size(), 0);
+            if (batch.size() > 1) {
+                processSetBatch(sets, batch, work, options, batchRecords, succeeded, options.physicalReadOrder ? &readAhead : nullptr);
+            }
+            else {
+                size_t setIndex = batch[0];
+                succeeded[0] = options.isolate ? processSetIsolated(sets[setIndex], work[setIndex], options, batchRecords[0], pool, slot) :
+                    processSet(sets[setIndex], work[setIndex], options, batchRecords[0], options.captureWorkload.empty() ? nullptr : &captured[setIndex],
+                        options.physicalReadOrder ? &readAhead : nullptr);
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            bytesInFlight -= bytes;
+            --running;
+            for (size_t i = 0; i < batch.size(); ++i) {
+                size_t setIndex = batch[i];
+                const TextureSet& set = sets[setIndex];
+                bool ok = succeeded[i] != 0;
+                if (ok && !work[setIndex].fallback.empty()) {
+                    // Reduced outputs stay out of the manifest and the history, so they are rebuilt once the limits allow
+                    fallbacks.push_back(set.baseName + ": " + work[setIndex].fallback);
+                }
+                else if (ok) {
+                    records.push_back(batchRecords[i]);
+                    if (work[setIndex].nmo) {
+                        manifest[set.baseName + "_NMO"] = work[setIndex].nmoInputs;
+                    }
+                    if (work[setIndex].bcr) {
+                        manifest[set.baseName + "_BCR"] = work[setIndex].bcrInputs;
+                    }
+                }
+                else if (options.isolate) {
+                    failedSets.push_back(set.baseName);
+                }
+                else {
+                    failed = true;
+                }
+            }
+            admitted.notify_all();
+        }
+    };
+
+    // Background mode: once a second the worker count is fitted to the cores the other processes left idle
+    bool finished = false;
+    std::thread monitor;
+    if (options.background) {
+        monitor = std::thread([&]() {
+            unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+            LoadSample previous;
+            sampleLoad(previous);
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!admitted.wait_for(lock, std::chrono::seconds(1), [&]() { return finished; })) {
+                lock.unlock();
+                LoadSample current;
+                bool sampled = sampleLoad(current);
+                unsigned workers = sampled ? getBackgroundWorkers(previous, current, unsigned(threadCount), cores) : unsigned(threadCount);
+                previous = current;
+                lock.lock();
+                if (workers != allowedWorkers) {
+                    std::cout << "Background mode: " << workers << " of " << threadCount << " workers" << std::endl;
+                    allowedWorkers = workers;
+                    admitted.notify_all();
+                }
+            }
+        });
     }
 
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < threadCount; ++i) {
+        workers.emplace_back(worker, i);
+    }
+    worker(0);
+    for (auto& thread : workers) {
+        thread.join();
+    }
+    if (monitor.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            finished = true;
+        }
+        admitted.notify_all();
+        monitor.join();
+    }
+    stopReadAhead(readAhead);
+
+    // Copied only once the source NMO is current, so a failed source is not spread further. A source reduced by
+    // its limits is not spread either: the set gets its own NMO instead
+    std::vector<size_t> unshared;
+    for (const auto& [setIndex, sourceIndex] : sharedNmo) {
+        const std::string source = sets[sourceIndex].baseName + "_NMO";
+        const std::string target = sets[setIndex].baseName + "_NMO";
+        if (!work[sourceIndex].fallback.empty()) {
+            fallbacks.push_back(sets[setIndex].baseName + ": own NMO, " + source + " was " + work[sourceIndex].fallback);
+            unshared.push_back(setIndex);
+            continue;
+        }
+        bool copied = isOutputUpToDate(manifest, source, work[sourceIndex].nmoInputs) && outputFilesExist(sets[sourceIndex].baseName, "_NMO");
+        ensureOutputFolder(sets[setIndex].baseName);
+        for (const auto& ext : outputExtensions) {
+            std::error_code error;
+            fs::path destination = fs::current_path() / "PBR_Result" / (target + ext);
+            copied = copied && fs::copy_file(fs::current_path() / "PBR_Result" / (source + ext), destination, fs::copy_options::overwrite_existing, error);
+            if (copied) {
+                std::cout << "Image copied to: " << destination.string() << std::endl;
+                auto checksum = outputChecksums.find(source + ext);
+                if (checksum != outputChecksums.end()) {
+                    outputChecksums[target + ext] = checksum->second;
+                }
+            }
+        }
+        if (copied) {
+            manifest[target] = work[setIndex].nmoInputs;
+        }
+        else {
+            std::cerr << "Failed to reuse " << source << " for: " << sets[setIndex].baseName << std::endl;
+            failed = true;
+        }
+    }
+    // Only the NMO is left; the BCR went through the scheduler with the rest
+    for (size_t setIndex : unshared) {
+        const TextureSet& set = sets[setIndex];
+        work[setIndex].nmo = true;
+        work[setIndex].bcr = false;
+        HistoryRecord record;
+        bool ok = options.isolate ? processSetIsolated(set, work[setIndex], options, record, pool, 0) :
+            processSet(set, work[setIndex], options, record, options.captureWorkload.empty() ? nullptr : &captured[setIndex], nullptr);
+        std::string fallback = set.baseName + ": " + work[setIndex].fallback;
+        if (ok && !work[setIndex].fallback.empty()) {
+            // Its BCR was most likely reduced the same way
+            if (std::find(fallbacks.begin(), fallbacks.end(), fallback) == fallbacks.end()) {
+                fallbacks.push_back(fallback);
+            }
+        }
+        else if (ok) {
+            manifest[set.baseName + "_NMO"] = work[setIndex].nmoInputs;
+        }
+        else if (options.isolate) {
+            failedSets.push_back(set.baseName);
+        }
+        else {
+            failed = true;
+        }
+    }
+
+    for (auto& process : pool.processes) {
+        stopWorker(process);
+    }
+    failed = failed || incomplete > 0;
+    if (!failedSets.empty()) {
+        failed = true;
+        std::cerr << "Failed sets:";
+        for (const auto& name : failedSets) {
+            std::cerr << " " << name;
+        }
+        std::cerr << std::endl;
+    }
+
+    if (!options.captureWorkload.empty()) {
+        // Replace paths by per-role input ids so shared inputs stay recognisable but anonymous
+        // Ids follow the files the sets were actually paired with; a baked AS has no file and is left out
+        std::vector<WorkloadInput> profile;
+        std::map<std::string, std::map<std::string, size_t>> inputIds;
+        for (size_t i = 0; i < sets.size(); ++i) {
+            for (WorkloadInput input : captured[i]) {
+                const std::string& path = input.role == "smdi" ? sets[i].smdi : input.role == "as" ? sets[i].as :
+                    input.role == "co" ? sets[i].co : sets[i].nohq;
+                if (path.empty()) {
+                    continue;
+                }
+                auto& roleIds = inputIds[input.role];
+                input.setIndex = i;
+                input.inputId = roleIds.emplace(path, roleIds.size()).first->second;
+                profile.push_back(input);
+            }
+        }
+        writeWorkloadProfile(options.captureWorkload, profile);
+    }
+
+    printFallbacks(fallbacks);
+    writeBuildManifest(getManifestPath(), manifest);
+    failed = !writeRunManifest(getRunManifestPath()) || failed;
+    // After the worker processes have exited, so their parts are complete
+    if (profiling) {
+        stopProfiler(options.profile, false);
+    }
+    printIoReport();
+    // Simulated runs are benchmarks of the I/O strategy and would skew the cost model
+    if (!options.simulatedStorage.enabled) {
+        double runSeconds = secondsSince(runStart);
+        for (auto& record : records) {
+            record.runSeconds = runSeconds;
+        }
+        reportRegressions(model, records);
+        appendHistory(getHistoryPath(), records);
+    }
+
+    closeVfs(vfs);
     FreeImage_DeInitialise();
-    return 0;
+    return failed ? -1 : 0;
 }
@@ -0,0 +1,207 @@
+#include "Background.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <tlhelp32.h>
+#else
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+// Sustained I/O stalls above this share of the time take one more worker off
+const double ioPressureLimit = 20.0;
+
+#ifdef __linux__
+// ioprio_set has no glibc wrapper
+const int ioprioWhoProcess = 1;
+const int ioprioClassIdle = 3;
+const int ioprioClassShift = 13;
+
+static bool writeText(const fs::path& path, const std::string& text) {
+    std::ofstream file(path);
+    file << text;
+    file.flush();
+    return bool(file);
+}
+
+// Only possible where the cgroup is delegated (e.g. a systemd user service); the group is shared by all runs and
+// left in place, since a process cannot remove the cgroup it runs in
+static bool enterBackgroundCgroup() {
+    std::ifstream membership("/proc/self/cgroup");
+    std::string line, current;
+    while (std::getline(membership, line)) {
+        if (line.compare(0, 3, "0::") == 0) {
+            current = line.substr(3);
+        }
+    }
+    if (current.empty()) {
+        return false;
+    }
+    fs::path group = fs::path("/sys/fs/cgroup") / fs::path(current).relative_path() / "legacy2pbr-background";
+    std::error_code error;
+    fs::create_directory(group, error);
+    if (error || !fs::exists(group / "cpu.weight")) {
+        return false;
+    }
+    // io.weight exists only with the io controller enabled; the idle I/O class covers that case too
+    writeText(group / "io.weight", "default 1");
+    return writeText(group / "cpu.weight", "1") && writeText(group / "cgroup.procs", std::to_string(getpid()));
+}
+
+// Utime and stime of /proc/<pid>/stat, in USER_HZ ticks like /proc/stat; the name field may hold spaces
+static bool readProcessTimes(const fs::path& stat, uint64_t& ticks, long& parent) {
+    std::ifstream file(stat);
+    std::string text;
+    if (!std::getline(file, text)) {
+        return false;
+    }
+    size_t close = text.rfind(')');
+    if (close == std::string::npos) {
+        return false;
+    }
+    std::istringstream fields(text.substr(close + 2));
+    std::string state;
+    uint64_t skipped, utime = 0, stime = 0;
+    fields >> state >> parent;
+    for (int i = 0; i < 9; ++i) {
+        fields >> skipped;
+    }
+    fields >> utime >> stime;
+    ticks = utime + stime;
+    return bool(fields);
+}
+#endif
+
+#ifdef _WIN32
+static uint64_t toTicks(const FILETIME& time) {
+    return (uint64_t(time.dwHighDateTime) << 32) | time.dwLowDateTime;
+}
+
+static uint64_t getProcessTicks(HANDLE process) {
+    FILETIME created, exited, kernel, user;
+    return GetProcessTimes(process, &created, &exited, &kernel, &user) ? toTicks(kernel) + toTicks(user) : 0;
+}
+#endif
+
+std::string enterBackgroundMode() {
+    std::string applied;
+#ifdef _WIN32
+    if (SetPriorityClass(GetCurrentProcess(), PROCESS_MODE_BACKGROUND_BEGIN)) {
+        applied = "background processing mode";
+    }
+#elif defined(__linux__)
+    sched_param parameters = {};
+    if (sched_setscheduler(0, SCHED_IDLE, &parameters) == 0) {
+        applied = "idle CPU scheduling";
+    }
+    if (syscall(SYS_ioprio_set, ioprioWhoProcess, 0, ioprioClassIdle << ioprioClassShift) == 0) {
+        applied += std::string(applied.empty() ? "" : ", ") + "idle I/O priority";
+    }
+    if (enterBackgroundCgroup()) {
+        applied += std::string(applied.empty() ? "" : ", ") + "cgroup with CPU and I/O weight 1";
+    }
+#else
+    if (nice(19) != -1) {
+        applied = "lowest nice level";
+    }
+#endif
+    return applied;
+}
+
+bool sampleLoad(LoadSample& sample) {
+    sample = LoadSample();
+#ifdef _WIN32
+    FILETIME idle, kernel, user;
+    if (!GetSystemTimes(&idle, &kernel, &user)) {
+        return false;
+    }
+    // Kernel time includes the idle time
+    sample.total = toTicks(kernel) + toTicks(user);
+    sample.busy = sample.total - toTicks(idle);
+    sample.own = getProcessTicks(GetCurrentProcess());
+    HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+    if (snapshot != INVALID_HANDLE_VALUE) {
+        PROCESSENTRY32 entry = {};
+        entry.dwSize = sizeof(entry);
+        DWORD self = GetCurrentProcessId();
+        for (BOOL found = Process32First(snapshot, &entry); found; found = Process32Next(snapshot, &entry)) {
+            if (entry.th32ParentProcessID != self) {
+                continue;
+            }
+            HANDLE child = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, entry.th32ProcessID);
+            if (child) {
+                sample.own += getProcessTicks(child);
+                CloseHandle(child);
+            }
+        }
+        CloseHandle(snapshot);
+    }
+    return true;
+#elif defined(__linux__)
+    std::ifstream stat("/proc/stat");
+    std::string cpu;
+    stat >> cpu;
+    if (cpu != "cpu") {
+        return false;
+    }
+    // user nice system idle iowait irq softirq steal; guest time is already counted in user
+    uint64_t values[8] = {};
+    for (uint64_t& value : values) {
+        stat >> value;
+    }
+    for (uint64_t value : values) {
+        sample.total += value;
+    }
+    sample.busy = sample.total - values[3] - values[4];
+
+    long self = long(getpid()), parent = 0;
+    uint64_t ticks = 0;
+    if (readProcessTimes("/proc/self/stat", ticks, parent)) {
+        sample.own = ticks;
+    }
+    std::error_code error;
+    for (const auto& entry : fs::directory_iterator("/proc", error)) {
+        const std::string name = entry.path().filename().string();
+        if (name.find_first_not_of("0123456789") == std::string::npos &&
+            readProcessTimes(entry.path() / "stat", ticks, parent) && parent == self) {
+            sample.own += ticks;
+        }
+    }
+
+    std::ifstream pressure("/proc/pressure/io");
+    std::string some, average;
+    if (pressure >> some >> average && some == "some" && average.compare(0, 6, "avg10=") == 0) {
+        sample.ioPressure = std::strtod(average.c_str() + 6, nullptr);
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+unsigned getBackgroundWorkers(const LoadSample& previous, const LoadSample& current, unsigned jobs, unsigned cores) {
+    if (current.total <= previous.total || cores == 0) {
+        return jobs;
+    }
+    double busy = double(current.busy - previous.busy);
+    double own = double(current.own >= previous.own ? current.own - previous.own : 0);
+    double foreignCores = std::max(0.0, busy - own) / double(current.total - previous.total) * cores;
+    // A quarter of a core of background noise does not cost a worker
+    int idleCores = int(cores) - int(std::ceil(foreignCores - 0.25));
+    if (current.ioPressure > ioPressureLimit) {
+        --idleCores;
+    }
+    return unsigned(std::clamp(idleCores, 1, int(std::max(1u, jobs))));
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// --background: idle priorities, and a worker count that follows the capacity the rest of the system leaves unused
+
+// Linux: SCHED_IDLE and the idle I/O class for the calling thread, which the threads and worker processes started
+// afterwards inherit, plus a child cgroup v2 with the lowest CPU and I/O weights where the current cgroup is
+// delegated to this user. Windows: background processing mode. Returns what was applied, empty if nothing was
+std::string enterBackgroundMode();
+
+// Cumulative CPU time counters; the load between two samples is their difference
+struct LoadSample {
+    uint64_t busy = 0;          // all cores, in the platform's tick unit
+    uint64_t total = 0;
+    uint64_t own = 0;           // this process and its direct children (the --isolate workers)
+    double ioPressure = -1.0;   // Linux PSI "some avg10" for I/O in percent; negative where not reported
+};
+
+bool sampleLoad(LoadSample& sample);
+// Workers fitting into the cores other processes left idle between the samples, between 1 and jobs
+unsigned getBackgroundWorkers(const LoadSample& previous, const LoadSample& current, unsigned jobs, unsigned cores);
@@ -0,0 +1,175 @@
+#include "BuildManifest.h"
+#include "FileIO.h"
+#include "Hash.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace fs = std::filesystem;
+
+InputSignature getInputSignature(const std::string& path) {
+    InputSignature signature;
+    signature.path = path;
+    simulateMetadata();
+    std::error_code error;
+    signature.size = fs::file_size(path, error);
+    if (error) {
+        signature.size = 0;
+    }
+    auto modified = fs::last_write_time(path, error);
+    signature.modified = error ? 0 : static_cast<int64_t>(modified.time_since_epoch().count());
+    return signature;
+}
+
+void computeTileHashes(InputSignature& signature, const unsigned char* bits, unsigned width, unsigned height, unsigned pitch, unsigned bytesPerPixel,
+    int channel) {
+    unsigned tilesX = (width + manifestTileSize - 1) / manifestTileSize;
+    unsigned tilesY = (height + manifestTileSize - 1) / manifestTileSize;
+    signature.width = width;
+    signature.height = height;
+    signature.tileHashes.assign(size_t(tilesX) * tilesY, 0);
+    unsigned char channelRow[manifestTileSize];
+    for (unsigned ty = 0; ty < tilesY; ++ty) {
+        unsigned rows = std::min(manifestTileSize, height - ty * manifestTileSize);
+        for (unsigned tx = 0; tx < tilesX; ++tx) {
+            unsigned columns = std::min(manifestTileSize, width - tx * manifestTileSize);
+            Xxh64State state;
+            xxh64Reset(state);
+            for (unsigned y = 0; y < rows; ++y) {
+                const unsigned char* row = bits + size_t(ty * manifestTileSize + y) * pitch + size_t(tx) * manifestTileSize * bytesPerPixel;
+                if (channel < 0) {
+                    xxh64Update(state, row, size_t(columns) * bytesPerPixel);
+                    continue;
+                }
+                for (unsigned x = 0; x < columns; ++x) {
+                    channelRow[x] = row[size_t(x) * bytesPerPixel + channel];
+                }
+                xxh64Update(state, channelRow, columns);
+            }
+            signature.tileHashes[size_t(ty) * tilesX + tx] = xxh64Digest(state);
+        }
+    }
+}
+
+// Marks the output tiles any input changed in; false when tiles cannot be compared and everything must be rebuilt
+bool findDirtyTiles(const std::vector<InputSignature>& previous, const std::vector<InputSignature>& current,
+    unsigned width, unsigned height, std::vector<char>& dirty) {
+    size_t tileCount = size_t((width + manifestTileSize - 1) / manifestTileSize) * ((height + manifestTileSize - 1) / manifestTileSize);
+    if (previous.size() != current.size()) {
+        return false;
+    }
+    dirty.assign(tileCount, 0);
+    for (size_t i = 0; i < current.size(); ++i) {
+        const InputSignature& before = previous[i];
+        const InputSignature& now = current[i];
+        if (before.path != now.path || now.width != width || now.height != height || before.width != width ||
+            before.height != height || before.tileHashes.size() != tileCount || now.tileHashes.size() != tileCount) {
+            return false;
+        }
+        for (size_t tile = 0; tile < tileCount; ++tile) {
+            if (before.tileHashes[tile] != now.tileHashes[tile]) {
+                dirty[tile] = 1;
+            }
+        }
+    }
+    return true;
+}
+
+bool isOutputUpToDate(const BuildManifest& manifest, const std::string& output, const std::vector<InputSignature>& inputs) {
+    auto entry = manifest.find(output);
+    if (entry == manifest.end() || entry->second.size() != inputs.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        const InputSignature& recorded = entry->second[i];
+        if (recorded.path != inputs[i].path || recorded.size != inputs[i].size || recorded.modified != inputs[i].modified) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Format: "O <output>" starts an entry, each following "I <path>\t<size>\t<mtime>[\t<width>\t<height>\t<tile hashes>]"
+// is one of its inputs, with the tile hashes as comma-separated hex
+BuildManifest readBuildManifest(const fs::path& file) {
+    BuildManifest manifest;
+    std::ifstream in(file);
+    std::string line;
+    std::vector<InputSignature>* current = nullptr;
+    while (std::getline(in, line)) {
+        if (line.size() < 2 || line[1] != ' ') {
+            continue;
+        }
+        if (line[0] == 'O') {
+            current = &manifest[line.substr(2)];
+            current->clear();
+        }
+        else if (line[0] == 'I' && current) {
+            std::istringstream row(line.substr(2));
+            InputSignature signature;
+            std::string size, modified, width, height, tiles;
+            if (std::getline(row, signature.path, '\t') && std::getline(row, size, '\t') && std::getline(row, modified, '\t')) {
+                try {
+                    signature.size = std::stoull(size);
+                    signature.modified = std::stoll(modified);
+                    if (std::getline(row, width, '\t') && std::getline(row, height, '\t') && std::getline(row, tiles)) {
+                        signature.width = static_cast<unsigned>(std::stoul(width));
+                        signature.height = static_cast<unsigned>(std::stoul(height));
+                        std::istringstream hashes(tiles);
+                        std::string hash;
+                        while (std::getline(hashes, hash, ',')) {
+                            signature.tileHashes.push_back(std::stoull(hash, nullptr, 16));
+                        }
+                    }
+                    current->push_back(signature);
+                }
+                catch (const std::exception&) {
+                    // A damaged entry only means that output is rebuilt
+                    current->clear();
+                }
+            }
+        }
+    }
+    return manifest;
+}
+
+bool writeBuildManifest(const fs::path& file, const BuildManifest& manifest) {
+    std::vector<std::string> outputs;
+    for (const auto& entry : manifest) {
+        outputs.push_back(entry.first);
+    }
+    std::sort(outputs.begin(), outputs.end());
+
+    // Write next to the old manifest and swap, so an interrupted run never leaves half a file
+    fs::path temporary = file;
+    temporary += ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::trunc);
+        for (const auto& output : outputs) {
+            out << "O " << output << '\n';
+            for (const auto& input : manifest.at(output)) {
+                out << "I " << input.path << '\t' << input.size << '\t' << input.modified;
+                if (!input.tileHashes.empty()) {
+                    out << '\t' << input.width << '\t' << input.height << '\t';
+                    for (size_t i = 0; i < input.tileHashes.size(); ++i) {
+                        out << (i ? "," : "") << toHex(input.tileHashes[i]);
+                    }
+                }
+                out << '\n';
+            }
+        }
+        if (!out) {
+            std::cerr << "Failed to write build manifest: " << temporary.string() << std::endl;
+            return false;
+        }
+    }
+    std::error_code error;
+    fs::rename(temporary, file, error);
+    if (error) {
+        std::cerr << "Failed to replace build manifest: " << file.string() << std::endl;
+        return false;
+    }
+    return true;
+}
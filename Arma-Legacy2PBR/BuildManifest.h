@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <filesystem>
+
+struct InputSignature {
+    std::string path;
+    uint64_t size = 0;
+    int64_t modified = 0;
+    // Decoded dimensions and XXH64 of every manifestTileSize square tile, row-major from the first scanline
+    unsigned width = 0;
+    unsigned height = 0;
+    std::vector<uint64_t> tileHashes;
+};
+
+const unsigned manifestTileSize = 256;
+
+// Inputs an output was last built from, keyed by output name (base name + suffix)
+using BuildManifest = std::unordered_map<std::string, std::vector<InputSignature>>;
+
+InputSignature getInputSignature(const std::string& path);
+// channel >= 0 hashes only that byte of each pixel, so a single-channel decode hashes like a full one
+void computeTileHashes(InputSignature& signature, const unsigned char* bits, unsigned width, unsigned height, unsigned pitch, unsigned bytesPerPixel,
+    int channel = -1);
+bool findDirtyTiles(const std::vector<InputSignature>& previous, const std::vector<InputSignature>& current,
+    unsigned width, unsigned height, std::vector<char>& dirty);
+bool isOutputUpToDate(const BuildManifest& manifest, const std::string& output, const std::vector<InputSignature>& inputs);
+
+BuildManifest readBuildManifest(const std::filesystem::path& file);
+bool writeBuildManifest(const std::filesystem::path& file, const BuildManifest& manifest);
@@ -0,0 +1,679 @@
+#include "Codec.h"
+#include "FileIO.h"
+#include "Paa.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+namespace fs = std::filesystem;
+
+std::string getCodecExtension(const std::string& filename) {
+    std::string extension = fs::path(filename).extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return char(tolower(c)); });
+    return extension;
+}
+
+int freeImageSaveFlags(FREE_IMAGE_FORMAT format) {
+    return (format == FIF_TARGA) ? TARGA_DEFAULT :
+        (format == FIF_TIFF) ? TIFF_NONE :
+        (format == FIF_PNG) ? PNG_Z_NO_COMPRESSION : 0;
+}
+
+// FreeImage and the stream encoders do their own file I/O; a simulated share charges the whole file
+static void simulateFileAccess(const std::string& filename) {
+    std::error_code error;
+    uint64_t size = fs::file_size(filename, error);
+    simulateOpen();
+    simulateTransfer(error ? 0 : size);
+}
+
+// FreeImage reads through this instead of stdio, so a decode makes no read calls of its own, only page faults
+struct MemoryReader {
+    const BYTE* data;
+    size_t size;
+    size_t position;
+    uint64_t reads;
+};
+
+static unsigned DLL_CALLCONV readMemory(void* buffer, unsigned size, unsigned count, fi_handle handle) {
+    MemoryReader* reader = static_cast<MemoryReader*>(handle);
+    ++reader->reads;
+    if (size == 0) {
+        return 0;
+    }
+    size_t items = std::min<size_t>(count, (reader->size - reader->position) / size);
+    memcpy(buffer, reader->data + reader->position, items * size);
+    reader->position += items * size;
+    return unsigned(items);
+}
+
+static unsigned DLL_CALLCONV writeMemory(void*, unsigned, unsigned, fi_handle) {
+    return 0;
+}
+
+static int DLL_CALLCONV seekMemory(fi_handle handle, long offset, int origin) {
+    MemoryReader* reader = static_cast<MemoryReader*>(handle);
+    long long base = origin == SEEK_SET ? 0 : origin == SEEK_CUR ? (long long)reader->position : (long long)reader->size;
+    long long target = base + offset;
+    if (target < 0 || target > (long long)reader->size) {
+        return -1;
+    }
+    reader->position = size_t(target);
+    return 0;
+}
+
+static long DLL_CALLCONV tellMemory(fi_handle handle) {
+    return long(static_cast<MemoryReader*>(handle)->position);
+}
+
+static FIBITMAP* loadFreeImageMemory(const std::string& filename, BYTE* data, size_t size) {
+    FREE_IMAGE_FORMAT format = FreeImage_GetFIFFromFilename(filename.c_str());
+    if (format == FIF_UNKNOWN) {
+        return nullptr;
+    }
+    MemoryReader reader = { data, size, 0, 0 };
+    FreeImageIO io = { readMemory, writeMemory, seekMemory, tellMemory };
+    FIBITMAP* dib = FreeImage_LoadFromHandle(format, &io, &reader);
+    // Summed once per file; the decoding threads would fight over the counter if every read added to it
+    ioStats().memoryReads += reader.reads;
+    return dib;
+}
+
+// The mapping serves every read FreeImage makes; stdio is only the fallback for files that cannot be mapped
+static FIBITMAP* loadFreeImage(const std::string& filename) {
+    MappedFile file;
+    if (!openMappedFile(filename, false, file)) {
+        simulateFileAccess(filename);
+        FREE_IMAGE_FORMAT format = FreeImage_GetFIFFromFilename(filename.c_str());
+        return format == FIF_UNKNOWN ? nullptr : FreeImage_Load(format, filename.c_str());
+    }
+    FIBITMAP* dib = loadFreeImageMemory(filename, file.data, file.size);
+    closeMappedFile(file);
+    return dib;
+}
+
+void resetOutputDigest(OutputDigest& digest) {
+    digest.size = 0;
+    digest.sequential = true;
+    sha256Reset(digest.sha256State);
+    xxh64Reset(digest.xxh64State);
+}
+
+void updateOutputDigest(OutputDigest& digest, const void* data, size_t size) {
+    if (digest.sha256) {
+        sha256Update(digest.sha256State, data, size);
+    }
+    if (digest.xxh64) {
+        xxh64Update(digest.xxh64State, data, size);
+    }
+    digest.size += size;
+}
+
+// A FILE that digests whatever FreeImage writes to it, as long as it writes front to back
+struct DigestingFile {
+    FILE* file;
+    OutputDigest* digest;
+    long position;
+};
+
+static unsigned DLL_CALLCONV readDigestingFile(void* buffer, unsigned size, unsigned count, fi_handle handle) {
+    DigestingFile* target = static_cast<DigestingFile*>(handle);
+    unsigned read = unsigned(fread(buffer, size, count, target->file));
+    target->position += long(read) * long(size);
+    return read;
+}
+
+static unsigned DLL_CALLCONV writeDigestingFile(void* buffer, unsigned size, unsigned count, fi_handle handle) {
+    DigestingFile* target = static_cast<DigestingFile*>(handle);
+    unsigned written = unsigned(fwrite(buffer, size, count, target->file));
+    if (uint64_t(target->position) != target->digest->size) {
+        target->digest->sequential = false;
+    }
+    else {
+        updateOutputDigest(*target->digest, buffer, size_t(written) * size);
+    }
+    target->position += long(written) * long(size);
+    return written;
+}
+
+static int DLL_CALLCONV seekDigestingFile(fi_handle handle, long offset, int origin) {
+    DigestingFile* target = static_cast<DigestingFile*>(handle);
+    int result = fseek(target->file, offset, origin);
+    if (result == 0) {
+        target->position = ftell(target->file);
+    }
+    return result;
+}
+
+static long DLL_CALLCONV tellDigestingFile(fi_handle handle) {
+    return static_cast<DigestingFile*>(handle)->position;
+}
+
+// libtiff seeks back to patch the directory offset once the strips are written, so a TIFF is encoded in memory
+// and digested as a whole before it goes to disk
+static bool saveFreeImageBuffered(FIBITMAP* dib, const std::string& filename, FREE_IMAGE_FORMAT format,
+    OutputDigest* digest) {
+    FIMEMORY* stream = FreeImage_OpenMemory();
+    if (!stream) {
+        return false;
+    }
+    BYTE* data = nullptr;
+    DWORD size = 0;
+    bool saved = FreeImage_SaveToMemory(format, dib, stream, freeImageSaveFlags(format)) &&
+        FreeImage_AcquireMemory(stream, &data, &size);
+    if (saved) {
+        updateOutputDigest(*digest, data, size);
+        saved = writeFileBuffered(filename, data, size);
+    }
+    FreeImage_CloseMemory(stream);
+    return saved;
+}
+
+static bool saveFreeImage(FIBITMAP* dib, const std::string& filename, OutputDigest* digest) {
+    FREE_IMAGE_FORMAT format = FreeImage_GetFIFFromFilename(filename.c_str());
+    if (format == FIF_UNKNOWN) {
+        return false;
+    }
+    if (digest && format == FIF_TIFF) {
+        return saveFreeImageBuffered(dib, filename, format, digest);
+    }
+    if (!digest) {
+        if (!FreeImage_Save(format, dib, filename.c_str(), freeImageSaveFlags(format))) {
+            return false;
+        }
+    }
+    else {
+        DigestingFile target = { fopen(filename.c_str(), "w+b"), digest, 0 };
+        if (!target.file) {
+            return false;
+        }
+        FreeImageIO io = { readDigestingFile, writeDigestingFile, seekDigestingFile, tellDigestingFile };
+        bool saved = FreeImage_SaveToHandle(format, dib, &io, &target, freeImageSaveFlags(format)) != FALSE;
+        saved = fclose(target.file) == 0 && saved;
+        if (!saved) {
+            return false;
+        }
+    }
+    simulateFileAccess(filename);
+    return true;
+}
+
+void fillTgaHeader(BYTE* header, unsigned width, unsigned height) {
+    memset(header, 0, tgaHeaderSize);
+    header[2] = 2;
+    header[12] = BYTE(width & 0xFF);
+    header[13] = BYTE(width >> 8);
+    header[14] = BYTE(height & 0xFF);
+    header[15] = BYTE(height >> 8);
+    header[16] = 32;
+    header[17] = 0x08;
+}
+
+void fillTgaFooter(BYTE* footer) {
+    memset(footer, 0, 8);
+    memcpy(footer + 8, "TRUEVISION-XFILE.", 18);
+}
+
+struct TgaLayout {
+    unsigned width = 0;
+    unsigned height = 0;
+    unsigned bytesPerPixel = 0;
+    bool rle = false;
+    bool topDown = false;
+    const BYTE* pixels = nullptr;
+    const BYTE* end = nullptr;
+};
+
+// Whether bytes more can be read at source; the pointers are compared first so a cursor past the end never wraps
+static bool tgaHas(const BYTE* source, const BYTE* end, size_t bytes) {
+    return source <= end && size_t(end - source) >= bytes;
+}
+
+// Uncompressed and RLE true-color 24/32-bit TGA; anything else is left to FreeImage
+static bool readTgaLayout(const BYTE* data, size_t size, TgaLayout& layout) {
+    unsigned bytesPerPixel = size >= tgaHeaderSize ? data[16] / 8u : 0;
+    bool supported = size >= tgaHeaderSize && size >= tgaHeaderSize + data[0] && data[1] == 0 && (data[2] == 2 || data[2] == 10) &&
+        (bytesPerPixel == 3 || bytesPerPixel == 4) && (data[17] & 0x10) == 0;
+    if (!supported) {
+        return false;
+    }
+    layout.width = data[12] | (data[13] << 8);
+    layout.height = data[14] | (data[15] << 8);
+    layout.bytesPerPixel = bytesPerPixel;
+    layout.rle = data[2] == 10;
+    layout.topDown = (data[17] & 0x20) != 0;
+    layout.pixels = data + tgaHeaderSize + data[0];
+    layout.end = data + size;
+    return layout.width > 0 && layout.height > 0;
+}
+
+// Calls visit(x, row, pixel) for every pixel in file order, rows counted from the bottom like DIB scanlines;
+// false when the data ends early
+template <typename Visit>
+static bool visitTgaPixels(const TgaLayout& layout, Visit visit) {
+    const BYTE* source = layout.pixels;
+    const BYTE* end = layout.end;
+    size_t pixels = size_t(layout.width) * layout.height;
+    size_t written = 0;
+    unsigned repeat = 0;
+    unsigned literal = 0;
+    unsigned bytesPerPixel = layout.bytesPerPixel;
+    BYTE pixel[4] = { 0, 0, 0, 0xFF };
+    while (written < pixels) {
+        if (layout.rle && repeat == 0 && literal == 0) {
+            if (!tgaHas(source, end, 1)) {
+                break;
+            }
+            BYTE packet = *source++;
+            if (packet & 0x80) {
+                repeat = (packet & 0x7F) + 1u;
+                if (!tgaHas(source, end, bytesPerPixel)) {
+                    break;
+                }
+                memcpy(pixel, source, bytesPerPixel);
+                source += bytesPerPixel;
+            }
+            else {
+                literal = packet + 1u;
+            }
+        }
+        if (repeat == 0) {
+            if (!tgaHas(source, end, bytesPerPixel)) {
+                break;
+            }
+            memcpy(pixel, source, bytesPerPixel);
+            source += bytesPerPixel;
+            if (literal > 0) {
+                --literal;
+            }
+        }
+        else {
+            --repeat;
+        }
+        unsigned y = unsigned(written / layout.width);
+        unsigned x = unsigned(written % layout.width);
+        visit(x, layout.topDown ? layout.height - 1 - y : y, pixel);
+        ++written;
+    }
+    return written == pixels;
+}
+
+// Decoded straight into a 32-bit DIB
+static FIBITMAP* loadNativeTgaMemory(const std::string&, BYTE* data, size_t size) {
+    TgaLayout layout;
+    FIBITMAP* dib = readTgaLayout(data, size, layout) ? FreeImage_Allocate(layout.width, layout.height, 32) : nullptr;
+    if (dib) {
+        size_t pixels = size_t(layout.width) * layout.height;
+        bool complete = true;
+        if (!layout.rle && layout.bytesPerPixel == 4 && !layout.topDown) {
+            // Same layout as the DIB: one copy
+            complete = tgaHas(layout.pixels, layout.end, pixels * 4);
+            if (complete) {
+                memcpy(FreeImage_GetBits(dib), layout.pixels, pixels * 4);
+            }
+        }
+        else {
+            complete = visitTgaPixels(layout, [&](unsigned x, unsigned y, const BYTE* pixel) {
+                memcpy(FreeImage_GetScanLine(dib, y) + size_t(x) * 4, pixel, 4);
+            });
+        }
+        if (!complete) {
+            FreeImage_Unload(dib);
+            dib = nullptr;
+        }
+    }
+    return dib;
+}
+
+// Box-averages blocks of 2^reduction pixels while decoding, one output row at a time, so the full-size image is
+// never allocated. Rows arrive in file order, which is monotonic in either direction
+static FIBITMAP* loadNativeTgaReduced(BYTE* data, size_t size, unsigned reduction) {
+    TgaLayout layout;
+    if (!readTgaLayout(data, size, layout)) {
+        return nullptr;
+    }
+    unsigned factor = 1u << reduction;
+    unsigned width = (layout.width + factor - 1) >> reduction;
+    unsigned height = (layout.height + factor - 1) >> reduction;
+    FIBITMAP* dib = FreeImage_Allocate(width, height, 32);
+    if (!dib) {
+        return nullptr;
+    }
+    std::vector<uint32_t> sums(size_t(width) * 4, 0);
+    unsigned currentRow = ~0u;
+    unsigned rowsSummed = 0;
+    auto flush = [&]() {
+        BYTE* target = FreeImage_GetScanLine(dib, currentRow);
+        for (unsigned x = 0; x < width; ++x) {
+            uint32_t count = std::min(factor, layout.width - x * factor) * rowsSummed;
+            for (unsigned c = 0; c < 4; ++c) {
+                target[x * 4 + c] = BYTE((sums[x * 4 + c] + count / 2) / count);
+            }
+        }
+        std::fill(sums.begin(), sums.end(), 0);
+        rowsSummed = 0;
+    };
+    bool complete = visitTgaPixels(layout, [&](unsigned x, unsigned y, const BYTE* pixel) {
+        if (x == 0) {
+            if (currentRow != ~0u && y >> reduction != currentRow) {
+                flush();
+            }
+            currentRow = y >> reduction;
+            ++rowsSummed;
+        }
+        uint32_t* sum = sums.data() + size_t(x >> reduction) * 4;
+        sum[0] += pixel[0];
+        sum[1] += pixel[1];
+        sum[2] += pixel[2];
+        sum[3] += pixel[3];
+    });
+    if (!complete) {
+        FreeImage_Unload(dib);
+        return nullptr;
+    }
+    flush();
+    return dib;
+}
+
+static FIBITMAP* loadNativeTga(const std::string& filename) {
+    MappedFile file;
+    if (!openMappedFile(filename, false, file)) {
+        return nullptr;
+    }
+    FIBITMAP* dib = loadNativeTgaMemory(filename, file.data, file.size);
+    closeMappedFile(file);
+    return dib;
+}
+
+// Header, the DIB rows as they are, footer; only 32-bit bitmaps
+static bool saveNativeTga(FIBITMAP* dib, const std::string& filename, OutputDigest* digest) {
+    unsigned width = FreeImage_GetWidth(dib);
+    unsigned height = FreeImage_GetHeight(dib);
+    if (FreeImage_GetBPP(dib) != 32 || FreeImage_GetImageType(dib) != FIT_BITMAP || width > 0xFFFF || height > 0xFFFF) {
+        return saveFreeImage(dib, filename, digest);
+    }
+    BYTE header[tgaHeaderSize];
+    BYTE footer[tgaFooterSize];
+    fillTgaHeader(header, width, height);
+    fillTgaFooter(footer);
+    std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+    // Pixels go out a megabyte at a time and are digested right after, while that chunk is still in cache
+    auto write = [&](const BYTE* data, size_t size) {
+        const size_t chunk = 1024 * 1024;
+        for (size_t offset = 0; offset < size && out; offset += chunk) {
+            size_t length = std::min(chunk, size - offset);
+            out.write(reinterpret_cast<const char*>(data + offset), std::streamsize(length));
+            if (digest) {
+                updateOutputDigest(*digest, data + offset, length);
+            }
+        }
+    };
+    write(header, tgaHeaderSize);
+    write(FreeImage_GetBits(dib), size_t(width) * height * 4);
+    write(footer, tgaFooterSize);
+    out.close();
+    if (!out) {
+        return false;
+    }
+    simulateFileAccess(filename);
+    return true;
+}
+
+static FIBITMAP* loadPaaMemory(const std::string&, BYTE* data, size_t size) {
+    return decodePaa(data, size);
+}
+
+static FIBITMAP* loadPaa(const std::string& filename) {
+    MappedFile file;
+    if (!openMappedFile(filename, false, file)) {
+        return nullptr;
+    }
+    FIBITMAP* dib = decodePaa(file.data, file.size);
+    closeMappedFile(file);
+    return dib;
+}
+
+const std::vector<CodecBackend>& codecBackends() {
+    // The first backend of an extension is its default
+    static const std::vector<CodecBackend> backends = {
+        { "freeimage", ".tga", loadFreeImage, loadFreeImageMemory, saveFreeImage },
+        { "native", ".tga", loadNativeTga, loadNativeTgaMemory, saveNativeTga },
+        { "freeimage", ".tif", loadFreeImage, loadFreeImageMemory, saveFreeImage },
+        { "freeimage", ".png", loadFreeImage, loadFreeImageMemory, saveFreeImage },
+        { "native", ".paa", loadPaa, loadPaaMemory, nullptr },
+    };
+    return backends;
+}
+
+// Selected backend name per extension; set at startup, before any worker runs
+static std::map<std::string, std::string> selectedDecoders;
+static std::map<std::string, std::string> selectedEncoders;
+
+static const CodecBackend* findBackend(const std::string& extension, bool encode) {
+    const auto& selected = encode ? selectedEncoders : selectedDecoders;
+    auto choice = selected.find(extension);
+    const CodecBackend* fallback = nullptr;
+    for (const auto& backend : codecBackends()) {
+        if (backend.extension != extension || !(encode ? backend.save != nullptr : backend.load != nullptr)) {
+            continue;
+        }
+        if (choice == selected.end() || backend.name == choice->second) {
+            return &backend;
+        }
+        if (!fallback) {
+            fallback = &backend;
+        }
+    }
+    return fallback;
+}
+
+static std::vector<std::string> codecExtensions() {
+    std::vector<std::string> extensions;
+    for (const auto& backend : codecBackends()) {
+        if (std::find(extensions.begin(), extensions.end(), backend.extension) == extensions.end()) {
+            extensions.push_back(backend.extension);
+        }
+    }
+    return extensions;
+}
+
+const CodecBackend* findDecoder(const std::string& extension) {
+    return findBackend(extension, false);
+}
+
+const CodecBackend* findEncoder(const std::string& extension) {
+    return findBackend(extension, true);
+}
+
+bool selectCodec(const std::string& extension, bool encode, const std::string& name) {
+    for (const auto& backend : codecBackends()) {
+        if (backend.extension == extension && backend.name == name && (encode ? backend.save != nullptr : backend.load != nullptr)) {
+            (encode ? selectedEncoders : selectedDecoders)[extension] = name;
+            return true;
+        }
+    }
+    std::cerr << "No " << (encode ? "encoder" : "decoder") << " '" << name << "' for " << extension << std::endl;
+    return false;
+}
+
+FIBITMAP* decodeImage(const std::string& filename) {
+    const CodecBackend* decoder = findDecoder(getCodecExtension(filename));
+    FIBITMAP* dib = decoder ? decoder->load(filename) : nullptr;
+    if (!dib && decoder && decoder->load != loadFreeImage) {
+        dib = loadFreeImage(filename);
+    }
+    return dib;
+}
+
+FIBITMAP* decodeImageFromMemory(const std::string& filename, BYTE* data, size_t size) {
+    const CodecBackend* decoder = findDecoder(getCodecExtension(filename));
+    FIBITMAP* dib = decoder ? decoder->loadFromMemory(filename, data, size) : nullptr;
+    if (!dib && decoder && decoder->loadFromMemory != loadFreeImageMemory) {
+        dib = loadFreeImageMemory(filename, data, size);
+    }
+    return dib;
+}
+
+FIBITMAP* reduceImage(FIBITMAP* dib, unsigned reduction) {
+    if (!dib || reduction == 0) {
+        return dib;
+    }
+    unsigned factor = 1u << reduction;
+    FIBITMAP* reduced = FreeImage_Rescale(dib, int((FreeImage_GetWidth(dib) + factor - 1) >> reduction),
+        int((FreeImage_GetHeight(dib) + factor - 1) >> reduction), FILTER_BOX);
+    FreeImage_Unload(dib);
+    return reduced;
+}
+
+bool decodesSingleChannel(const std::string& filename) {
+    return getCodecExtension(filename) == ".paa";
+}
+
+FIBITMAP* decodeImagePartial(const std::string& filename, BYTE* data, size_t size, unsigned reduction, int channel) {
+    if (channel >= 0 && decodesSingleChannel(filename)) {
+        return reduceImage(decodePaaChannel(data, size, unsigned(channel)), reduction);
+    }
+    if (reduction == 0) {
+        return decodeImageFromMemory(filename, data, size);
+    }
+    FIBITMAP* dib = getCodecExtension(filename) == ".tga" ? loadNativeTgaReduced(data, size, reduction) : nullptr;
+    return dib ? dib : reduceImage(decodeImageFromMemory(filename, data, size), reduction);
+}
+
+bool encodeImage(FIBITMAP* dib, const std::string& filename, OutputDigest* digest) {
+    const CodecBackend* encoder = findEncoder(getCodecExtension(filename));
+    return encoder ? encoder->save(dib, filename, digest) : saveFreeImage(dib, filename, digest);
+}
+
+bool readCodecConfig(const fs::path& file) {
+    std::ifstream in(file);
+    if (!in) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::istringstream row(line);
+        std::string extension, operation, name;
+        if (!(row >> extension >> operation >> name) || (operation != "load" && operation != "save")) {
+            std::cerr << "Ignoring codec config line: " << line << std::endl;
+            continue;
+        }
+        selectCodec(extension, operation == "save", name);
+    }
+    return true;
+}
+
+bool writeCodecConfig(const fs::path& file) {
+    std::ofstream out(file, std::ios::trunc);
+    out << "# extension operation backend\n";
+    for (const auto& extension : codecExtensions()) {
+        if (const CodecBackend* decoder = findDecoder(extension)) {
+            out << extension << " load " << decoder->name << '\n';
+        }
+        if (const CodecBackend* encoder = findEncoder(extension)) {
+            out << extension << " save " << encoder->name << '\n';
+        }
+    }
+    if (!out) {
+        std::cerr << "Failed to write codec config: " << file.string() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Best of a few runs, so one page fault burst does not decide
+static double timeBest(const std::function<bool()>& run) {
+    double best = -1.0;
+    for (int i = 0; i < 3; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        if (!run()) {
+            return -1.0;
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        best = (best < 0.0 || seconds < best) ? seconds : best;
+    }
+    return best;
+}
+
+bool calibrateCodecs(const fs::path& folder, unsigned size) {
+    // Smooth gradients with noise compress roughly like real texture content
+    FIBITMAP* sample = FreeImage_Allocate(size, size, 32);
+    if (!sample) {
+        std::cerr << "Failed to allocate calibration image." << std::endl;
+        return false;
+    }
+    BYTE* bits = FreeImage_GetBits(sample);
+    uint32_t noise = 2463534242u;
+    for (size_t i = 0; i < size_t(size) * size * 4; ++i) {
+        noise ^= noise << 13;
+        noise ^= noise >> 17;
+        noise ^= noise << 5;
+        size_t pixel = i / 4;
+        bits[i] = BYTE((pixel % size + pixel / size + (i & 3) * 64 + (noise & 7)) & 0xFF);
+    }
+
+    std::error_code error;
+    fs::create_directories(folder, error);
+    bool ok = true;
+    for (const auto& extension : codecExtensions()) {
+        std::string reference = (folder / ("calibrate_reference" + extension)).string();
+        // PAA has a single decoder and no sample to time it on
+        if (FreeImage_GetFIFFromFilename(reference.c_str()) == FIF_UNKNOWN) {
+            continue;
+        }
+        if (!saveFreeImage(sample, reference, nullptr)) {
+            std::cerr << "Failed to write calibration sample: " << reference << std::endl;
+            ok = false;
+            continue;
+        }
+        const CodecBackend* fastestLoad = nullptr;
+        const CodecBackend* fastestSave = nullptr;
+        double bestLoad = 0.0, bestSave = 0.0;
+        for (const auto& candidate : codecBackends()) {
+            if (candidate.extension != extension) {
+                continue;
+            }
+            double loadSeconds = -1.0, saveSeconds = -1.0;
+            if (candidate.load) {
+                loadSeconds = timeBest([&]() {
+                    FIBITMAP* dib = candidate.load(reference);
+                    FreeImage_Unload(dib);
+                    return dib != nullptr;
+                });
+            }
+            if (candidate.save) {
+                std::string target = (folder / ("calibrate_" + candidate.name + extension)).string();
+                saveSeconds = timeBest([&]() { return candidate.save(sample, target, nullptr); });
+                fs::remove(target, error);
+            }
+            std::cout << extension << " " << candidate.name << ": load " << (loadSeconds < 0.0 ? 0.0 : loadSeconds * 1000.0)
+                << " ms, save " << (saveSeconds < 0.0 ? 0.0 : saveSeconds * 1000.0) << " ms" << std::endl;
+            if (loadSeconds >= 0.0 && (!fastestLoad || loadSeconds < bestLoad)) {
+                fastestLoad = &candidate;
+                bestLoad = loadSeconds;
+            }
+            if (saveSeconds >= 0.0 && (!fastestSave || saveSeconds < bestSave)) {
+                fastestSave = &candidate;
+                bestSave = saveSeconds;
+            }
+        }
+        if (fastestLoad) {
+            selectCodec(extension, false, fastestLoad->name);
+        }
+        if (fastestSave) {
+            selectCodec(extension, true, fastestSave->name);
+        }
+        fs::remove(reference, error);
+    }
+    FreeImage_Unload(sample);
+    return ok;
+}
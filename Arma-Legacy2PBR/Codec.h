@@ -0,0 +1,66 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <FreeImage.h>
+#include "Hash.h"
+
+// Digests of one encoded file, taken from the bytes as the encoder writes them instead of reading the file back
+struct OutputDigest {
+    bool sha256 = false;
+    bool xxh64 = false;
+    uint64_t size = 0;
+    // Cleared when an encoder seeks back to patch bytes it already wrote; the digests then describe no file
+    bool sequential = true;
+    Sha256State sha256State;
+    Xxh64State xxh64State;
+};
+
+// Starts a new file with the same digest selection
+void resetOutputDigest(OutputDigest& digest);
+void updateOutputDigest(OutputDigest& digest, const void* data, size_t size);
+
+// One implementation of a file format; an extension may have several, chosen per operation
+struct CodecBackend {
+    std::string name;
+    std::string extension;
+    // Either may be null. A decoder returns nullptr for variants it does not handle, and FreeImage is tried instead
+    FIBITMAP* (*load)(const std::string& filename);
+    // Same decoder over a file already read into memory; the filename only names the format
+    FIBITMAP* (*loadFromMemory)(const std::string& filename, BYTE* data, size_t size);
+    // digest may be null; otherwise it is fed every byte of the file in order
+    bool (*save)(FIBITMAP* dib, const std::string& filename, OutputDigest* digest);
+};
+
+const std::vector<CodecBackend>& codecBackends();
+const CodecBackend* findDecoder(const std::string& extension);
+const CodecBackend* findEncoder(const std::string& extension);
+bool selectCodec(const std::string& extension, bool encode, const std::string& backend);
+
+// Lower-case extension with the dot, the registry key
+std::string getCodecExtension(const std::string& filename);
+// Decodes/encodes through the backend selected for the file extension
+FIBITMAP* decodeImage(const std::string& filename);
+FIBITMAP* decodeImageFromMemory(const std::string& filename, BYTE* data, size_t size);
+// Halves both sides reduction times, the fallback of sets over their budget; odd sizes round up. Takes ownership
+FIBITMAP* reduceImage(FIBITMAP* dib, unsigned reduction);
+// Formats that can decode one channel without the others (PAA)
+bool decodesSingleChannel(const std::string& filename);
+// Only what a role needs: reduced (TGA is box-filtered row by row while decoding, so the full-size image never
+// exists; other formats are decoded and reduced) and, with channel >= 0, only that channel as gray where supported
+FIBITMAP* decodeImagePartial(const std::string& filename, BYTE* data, size_t size, unsigned reduction, int channel = -1);
+bool encodeImage(FIBITMAP* dib, const std::string& filename, OutputDigest* digest = nullptr);
+int freeImageSaveFlags(FREE_IMAGE_FORMAT format);
+
+// Lines of "<extension> load|save <backend>"
+bool readCodecConfig(const std::filesystem::path& file);
+bool writeCodecConfig(const std::filesystem::path& file);
+// Times every backend on a synthetic texture in the given folder and selects the fastest per operation
+bool calibrateCodecs(const std::filesystem::path& folder, unsigned size);
+
+const size_t tgaHeaderSize = 18;
+const size_t tgaFooterSize = 26;
+// Uncompressed true-color, 8 alpha bits, bottom-up rows like a FreeImage DIB
+void fillTgaHeader(BYTE* header, unsigned width, unsigned height);
+void fillTgaFooter(BYTE* footer);
@@ -0,0 +1,343 @@
+#include "CpuDispatch.h"
+#include "Kernels.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#ifdef KERNELS_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#ifdef KERNELS_X86
+static void cpuid(int leaf, int subleaf, unsigned registers[4]) {
+#ifdef _MSC_VER
+    int values[4];
+    __cpuidex(values, leaf, subleaf);
+    for (int i = 0; i < 4; ++i) {
+        registers[i] = static_cast<unsigned>(values[i]);
+    }
+#else
+    __cpuid_count(leaf, subleaf, registers[0], registers[1], registers[2], registers[3]);
+#endif
+}
+
+static unsigned long long readXcr0() {
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    unsigned eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return (static_cast<unsigned long long>(edx) << 32) | eax;
+#endif
+}
+#endif
+
+IsaLevel detectIsa() {
+#ifdef KERNELS_X86
+    static const IsaLevel detected = []() {
+        unsigned leaf0[4], leaf1[4], leaf7[4] = {};
+        cpuid(0, 0, leaf0);
+        cpuid(1, 0, leaf1);
+        if (leaf0[0] >= 7) {
+            cpuid(7, 0, leaf7);
+        }
+        bool sse2 = (leaf1[3] >> 26) & 1;
+        bool ssse3 = (leaf1[2] >> 9) & 1;
+        bool osxsave = (leaf1[2] >> 27) & 1;
+        unsigned long long xcr0 = osxsave ? readXcr0() : 0;
+        // The OS must save YMM (bits 1-2) and ZMM/opmask state (bits 5-7) on context switches
+        bool avxState = (xcr0 & 0x6) == 0x6;
+        bool avx512State = (xcr0 & 0xE6) == 0xE6;
+        bool avx2 = avxState && ((leaf7[1] >> 5) & 1);
+        bool avx512f = avx512State && ((leaf7[1] >> 16) & 1);
+
+        if (avx512f && avx2) {
+            return IsaLevel::AVX512;
+        }
+        if (avx2) {
+            return IsaLevel::AVX2;
+        }
+        if (ssse3 && sse2) {
+            return IsaLevel::SSSE3;
+        }
+        return sse2 ? IsaLevel::SSE2 : IsaLevel::Scalar;
+    }();
+    return detected;
+#else
+    return IsaLevel::Scalar;
+#endif
+}
+
+bool detectSha() {
+#ifdef KERNELS_X86
+    static const bool detected = []() {
+        unsigned leaf0[4], leaf1[4], leaf7[4] = {};
+        cpuid(0, 0, leaf0);
+        cpuid(1, 0, leaf1);
+        if (leaf0[0] >= 7) {
+            cpuid(7, 0, leaf7);
+        }
+        // The kernel also shuffles with SSE4.1
+        return ((leaf1[2] >> 19) & 1) && ((leaf7[1] >> 29) & 1);
+    }();
+    return detected;
+#else
+    return false;
+#endif
+}
+
+const char* isaName(IsaLevel level) {
+    switch (level) {
+    case IsaLevel::SSE2: return "sse2";
+    case IsaLevel::SSSE3: return "ssse3";
+    case IsaLevel::AVX2: return "avx2";
+    case IsaLevel::AVX512: return "avx512";
+    default: return "scalar";
+    }
+}
+
+bool parseIsaLevel(const std::string& name, IsaLevel& level) {
+    const IsaLevel levels[] = { IsaLevel::Scalar, IsaLevel::SSE2, IsaLevel::SSSE3, IsaLevel::AVX2, IsaLevel::AVX512 };
+    for (IsaLevel candidate : levels) {
+        if (name == isaName(candidate)) {
+            level = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Each kernel uses the best variant at or below the requested level
+KernelTable kernelTableFor(IsaLevel level) {
+    KernelTable table;
+    table.packNmo = packNmoScalar;
+    table.packBcr = packBcrScalar;
+    table.packNmoBatch = packNmoBatchScalar;
+    table.packBcrBatch = packBcrBatchScalar;
+    table.horizonAo = horizonAoScalar;
+    table.decodeBcChannel = decodeBcChannelScalar;
+    table.sha256Blocks = sha256BlocksScalar;
+#ifdef KERNELS_X86
+    if (level >= IsaLevel::SSE2) {
+        table.packNmo = packNmoSse2;
+        table.packBcr = packBcrSse2;
+        table.packNmoBatch = packNmoBatchSse2;
+        table.packBcrBatch = packBcrBatchSse2;
+        table.horizonAo = horizonAoSse2;
+    }
+    if (level >= IsaLevel::SSSE3) {
+        table.decodeBcChannel = decodeBcChannelSsse3;
+        if (detectSha()) {
+            table.sha256Blocks = sha256BlocksShaNi;
+        }
+    }
+    if (level >= IsaLevel::AVX2) {
+        table.packNmo = packNmoAvx2;
+        table.packBcr = packBcrAvx2;
+        table.packNmoBatch = packNmoBatchAvx2;
+        table.packBcrBatch = packBcrBatchAvx2;
+        table.horizonAo = horizonAoAvx2;
+    }
+    if (level >= IsaLevel::AVX512) {
+        table.packNmo = packNmoAvx512;
+        table.packBcr = packBcrAvx512;
+        table.packNmoBatch = packNmoBatchAvx512;
+        table.packBcrBatch = packBcrBatchAvx512;
+    }
+#endif
+    return table;
+}
+
+static IsaLevel selectedLevel = IsaLevel::Scalar;
+static KernelTable selectedTable = kernelTableFor(IsaLevel::Scalar);
+static bool tableBound = false;
+
+bool selectIsa(IsaLevel level) {
+    if (level > detectIsa()) {
+        std::cerr << "This CPU does not support " << isaName(level) << " (best available: "
+            << isaName(detectIsa()) << ")" << std::endl;
+        return false;
+    }
+    selectedLevel = level;
+    selectedTable = kernelTableFor(level);
+    tableBound = true;
+    return true;
+}
+
+IsaLevel activeIsa() {
+    return tableBound ? selectedLevel : detectIsa();
+}
+
+const KernelTable& kernels() {
+    if (!tableBound) {
+        selectIsa(detectIsa());
+    }
+    return selectedTable;
+}
+
+// Differential check of every supported level against the scalar reference
+bool runKernelSelfTest() {
+    std::mt19937 random(42);
+    const size_t lengths[] = { 0, 1, 3, 4, 7, 8, 15, 16, 17, 31, 33, 64, 100, 1023, 4099 };
+    const size_t maxPixels = 4099;
+    // One extra pixel of slack lets every length also run from an unaligned offset
+    std::vector<BYTE> a((maxPixels + 1) * 4), b((maxPixels + 1) * 4), c((maxPixels + 1) * 4);
+    for (auto* buffer : { &a, &b, &c }) {
+        for (BYTE& value : *buffer) {
+            value = BYTE(random());
+        }
+    }
+
+    // A random height field, sampled by every step of every direction on both sides of a row
+    HorizonSamples samples;
+    const ptrdiff_t margin = 64;
+    for (unsigned k = 0; k < horizonDirections * horizonSteps; ++k) {
+        samples.offsets[k] = ptrdiff_t(random() % (2 * margin + 1)) - margin;
+        samples.inverseDistances[k] = 1.0f / float(k % horizonSteps + 1);
+    }
+    std::uniform_real_distribution<float> height(-4.0f, 4.0f);
+    std::vector<float> heights(maxPixels + 1 + 2 * margin);
+    for (float& value : heights) {
+        value = height(random);
+    }
+
+    KernelTable reference = kernelTableFor(IsaLevel::Scalar);
+    bool allPassed = true;
+    for (int levelIndex = 0; levelIndex <= int(detectIsa()); ++levelIndex) {
+        IsaLevel level = IsaLevel(levelIndex);
+        KernelTable table = kernelTableFor(level);
+        bool passed = true;
+        for (size_t pixels : lengths) {
+            for (size_t offset : { size_t(0), size_t(1) }) {
+                std::vector<BYTE> expected(maxPixels * 4 + 8, 0xCD), actual(maxPixels * 4 + 8, 0xCD);
+                const BYTE* inA = a.data() + offset;
+                const BYTE* inB = b.data() + offset;
+                const BYTE* inC = c.data() + offset;
+
+                reference.packNmo(expected.data() + offset, inA, inB, inC, pixels);
+                table.packNmo(actual.data() + offset, inA, inB, inC, pixels);
+                passed = passed && expected == actual;
+
+                reference.packBcr(expected.data() + offset, inA, inB, pixels);
+                table.packBcr(actual.data() + offset, inA, inB, pixels);
+                passed = passed && expected == actual;
+
+                std::vector<float> expectedAo(pixels + 1, -1.0f), actualAo(pixels + 1, -1.0f);
+                reference.horizonAo(expectedAo.data() + offset, heights.data() + margin + offset, samples, pixels);
+                table.horizonAo(actualAo.data() + offset, heights.data() + margin + offset, samples, pixels);
+                passed = passed && std::memcmp(expectedAo.data(), actualAo.data(), expectedAo.size() * sizeof(float)) == 0;
+            }
+        }
+        // One batch over every length, so that tails of several jobs share the staging stream
+        for (bool nmo : { true, false }) {
+            std::vector<std::vector<BYTE>> expected, actual;
+            std::vector<PackJob> jobs;
+            for (size_t pixels : lengths) {
+                expected.emplace_back(pixels * 4 + 4, BYTE(0xCD));
+                actual.emplace_back(pixels * 4 + 4, BYTE(0xCD));
+                size_t offset = jobs.size() % 2;
+                const BYTE* inputs[3] = { a.data() + offset, b.data() + offset, c.data() + offset };
+                if (nmo) {
+                    reference.packNmo(expected.back().data(), inputs[0], inputs[1], inputs[2], pixels);
+                }
+                else {
+                    reference.packBcr(expected.back().data(), inputs[0], inputs[1], pixels);
+                }
+                jobs.push_back({ actual.back().data(), { inputs[0], inputs[1], inputs[2] }, pixels });
+            }
+            (nmo ? table.packNmoBatch : table.packBcrBatch)(jobs.data(), jobs.size());
+            passed = passed && expected == actual;
+        }
+        // Random blocks cover both BC1 color modes and both BC3 alpha modes
+        const size_t blockCount = 33;
+        for (bool bc3 : { false, true }) {
+            for (unsigned channel = 0; channel < 4; ++channel) {
+                for (size_t step : { size_t(1), size_t(4) }) {
+                    ptrdiff_t pitch = ptrdiff_t(blockCount * 4 * step);
+                    std::vector<BYTE> expected(size_t(pitch) * 4, 0xCD), actual(size_t(pitch) * 4, 0xCD);
+                    reference.decodeBcChannel(expected.data(), pitch, step, a.data(), blockCount, bc3, channel);
+                    table.decodeBcChannel(actual.data(), pitch, step, a.data(), blockCount, bc3, channel);
+                    passed = passed && expected == actual;
+                }
+            }
+        }
+        // Block runs of several lengths into states that already differ
+        for (size_t count : { size_t(0), size_t(1), size_t(2), size_t(7), size_t(64) }) {
+            uint32_t expected[8], actual[8];
+            for (int i = 0; i < 8; ++i) {
+                expected[i] = actual[i] = uint32_t(random());
+            }
+            reference.sha256Blocks(expected, a.data() + count % 2, count);
+            table.sha256Blocks(actual, a.data() + count % 2, count);
+            passed = passed && std::memcmp(expected, actual, sizeof(expected)) == 0;
+        }
+        std::cout << "Kernel self-test (" << isaName(level) << "): " << (passed ? "ok" : "FAILED") << std::endl;
+        allPassed = allPassed && passed;
+    }
+    return allPassed;
+}
+
+// Tiny sets (icons, decals, UI) packed one call per set through the table against one batched call for all of them
+void runPackBenchmark() {
+    const unsigned sizes[] = { 16, 31, 32, 64 };
+    // One batch as the converter forms them
+    const size_t setCount = 64;
+    const size_t targetPixels = size_t(256) << 20;
+    std::mt19937 random(42);
+    for (int levelIndex = 0; levelIndex <= int(detectIsa()); ++levelIndex) {
+        IsaLevel level = IsaLevel(levelIndex);
+        KernelTable table = kernelTableFor(level);
+        for (unsigned size : sizes) {
+            size_t pixels = size_t(size) * size;
+            // Separate buffers per set, as the loaded images are
+            std::vector<std::vector<BYTE>> buffers(setCount * 4, std::vector<BYTE>(pixels * 4));
+            for (auto& buffer : buffers) {
+                for (BYTE& value : buffer) {
+                    value = BYTE(random());
+                }
+            }
+            std::vector<PackJob> jobs;
+            for (size_t i = 0; i < setCount; ++i) {
+                jobs.push_back({ buffers[i * 4].data(), { buffers[i * 4 + 1].data(), buffers[i * 4 + 2].data(), buffers[i * 4 + 3].data() }, pixels });
+            }
+            size_t rounds = std::max<size_t>(1, targetPixels / (pixels * setCount));
+
+            auto packSingle = [&]() {
+                for (const PackJob& job : jobs) {
+                    table.packNmo(job.out, job.inputs[0], job.inputs[1], job.inputs[2], job.pixels);
+                }
+                for (const PackJob& job : jobs) {
+                    table.packBcr(job.out, job.inputs[0], job.inputs[1], job.pixels);
+                }
+            };
+            // Warm the caches so neither variant pays for the first touch
+            packSingle();
+            auto start = std::chrono::steady_clock::now();
+            for (size_t round = 0; round < rounds; ++round) {
+                packSingle();
+            }
+            double single = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            start = std::chrono::steady_clock::now();
+            for (size_t round = 0; round < rounds; ++round) {
+                table.packNmoBatch(jobs.data(), jobs.size());
+                table.packBcrBatch(jobs.data(), jobs.size());
+            }
+            double batched = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            double scale = 1e9 / double(rounds * setCount);
+            std::cout << "Pack benchmark (" << isaName(level) << ", " << size << "x" << size << "): "
+                << std::fixed << std::setprecision(1) << single * scale << " ns per set, "
+                << batched * scale << " ns per set batched" << std::endl;
+        }
+    }
+}
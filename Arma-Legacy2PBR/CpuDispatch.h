@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <FreeImage.h>
+
+struct HorizonSamples;
+struct PackJob;
+
+enum class IsaLevel {
+    Scalar,
+    SSE2,
+    SSSE3,
+    AVX2,
+    AVX512
+};
+
+// Every SIMD kernel is reached through this table; it is bound once at startup
+struct KernelTable {
+    // NMO = (B: SMDI.G, G: NOHQ.G, R: NOHQ.R, A: AS.G), pixels are 32-bit BGRA
+    void (*packNmo)(BYTE* out, const BYTE* nohq, const BYTE* smdi, const BYTE* as, size_t pixels);
+    // BCR = (BGR: CO.BGR, A: SMDI.B)
+    void (*packBcr)(BYTE* out, const BYTE* co, const BYTE* smdi, size_t pixels);
+    // Many small sets in one call: the short tails of all jobs are packed together as one stream
+    void (*packNmoBatch)(const PackJob* jobs, size_t count);
+    void (*packBcrBatch)(const PackJob* jobs, size_t count);
+    // One row of horizon-based ambient occlusion over a padded height field
+    void (*horizonAo)(float* out, const float* heights, const HorizonSamples& samples, size_t pixels);
+    // One row of BC1 (8-byte) or BC3 (16-byte) blocks reduced to one channel (0 B, 1 G, 2 R, 3 A): four rows of
+    // 4 * blockCount pixels, step bytes apart, pitch bytes between rows. Only that channel's palette is built
+    void (*decodeBcChannel)(BYTE* out, ptrdiff_t pitch, size_t step, const BYTE* blocks, size_t blockCount, bool bc3, unsigned channel);
+    // SHA-256 compression of count 64-byte blocks into the eight state words
+    void (*sha256Blocks)(uint32_t* hash, const BYTE* blocks, size_t count);
+};
+
+IsaLevel detectIsa();
+// The SHA extensions come with some CPUs of every level from SSSE3 up, so they are detected on their own
+bool detectSha();
+const char* isaName(IsaLevel level);
+bool parseIsaLevel(const std::string& name, IsaLevel& level);
+
+KernelTable kernelTableFor(IsaLevel level);
+bool selectIsa(IsaLevel level);
+IsaLevel activeIsa();
+const KernelTable& kernels();
+
+bool runKernelSelfTest();
+void runPackBenchmark();
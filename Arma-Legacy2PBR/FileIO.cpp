@@ -0,0 +1,528 @@
+#include "FileIO.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <winioctl.h>
+#include <malloc.h>
+#else
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#endif
+#endif
+
+namespace fs = std::filesystem;
+
+IoStats& ioStats() {
+    static IoStats stats;
+    return stats;
+}
+
+static SimulatedStorage simulatedStorage;
+static std::mutex linkMutex;
+static std::chrono::steady_clock::time_point linkFreeAt;
+
+bool parseSimulatedStorage(const std::string& text, SimulatedStorage& storage) {
+    std::istringstream fields(text);
+    std::string latency, bandwidth, metadata;
+    if (!std::getline(fields, latency, ',') || !std::getline(fields, bandwidth, ',') || !std::getline(fields, metadata)) {
+        return false;
+    }
+    try {
+        storage.latencyMilliseconds = std::stod(latency);
+        storage.megabytesPerSecond = std::stod(bandwidth);
+        storage.metadataMilliseconds = std::stod(metadata);
+    }
+    catch (const std::exception&) {
+        return false;
+    }
+    storage.enabled = storage.latencyMilliseconds >= 0.0 && storage.megabytesPerSecond >= 0.0 && storage.metadataMilliseconds >= 0.0;
+    return storage.enabled;
+}
+
+void setSimulatedStorage(const SimulatedStorage& storage) {
+    simulatedStorage = storage;
+    linkFreeAt = std::chrono::steady_clock::now();
+}
+
+static void simulateWait(std::chrono::steady_clock::time_point until) {
+    auto start = std::chrono::steady_clock::now();
+    std::this_thread::sleep_until(until);
+    ++ioStats().simulatedOperations;
+    ioStats().simulatedMicroseconds += std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+static std::chrono::steady_clock::duration toDuration(double milliseconds) {
+    return std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double, std::milli>(milliseconds));
+}
+
+void simulateOpen() {
+    if (simulatedStorage.enabled) {
+        simulateWait(std::chrono::steady_clock::now() + toDuration(simulatedStorage.latencyMilliseconds));
+    }
+}
+
+// Round trips overlap between threads; the bytes themselves take turns on the link
+void simulateTransfer(uint64_t bytes) {
+    if (!simulatedStorage.enabled) {
+        return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    auto done = now + toDuration(simulatedStorage.latencyMilliseconds);
+    if (simulatedStorage.megabytesPerSecond > 0.0) {
+        double milliseconds = double(bytes) / (simulatedStorage.megabytesPerSecond * 1024.0 * 1024.0) * 1000.0;
+        std::lock_guard<std::mutex> lock(linkMutex);
+        linkFreeAt = std::max(linkFreeAt, now) + toDuration(milliseconds);
+        done = std::max(done, linkFreeAt);
+    }
+    simulateWait(done);
+}
+
+void simulateMetadata() {
+    if (simulatedStorage.enabled) {
+        simulateWait(std::chrono::steady_clock::now() + toDuration(simulatedStorage.metadataMilliseconds));
+    }
+}
+
+BYTE* allocateAligned(size_t size) {
+    size_t rounded = (size + directIoAlignment - 1) / directIoAlignment * directIoAlignment;
+#ifdef _WIN32
+    return static_cast<BYTE*>(_aligned_malloc(rounded, directIoAlignment));
+#else
+    return static_cast<BYTE*>(std::aligned_alloc(directIoAlignment, rounded));
+#endif
+}
+
+void freeAligned(BYTE* data) {
+#ifdef _WIN32
+    _aligned_free(data);
+#else
+    std::free(data);
+#endif
+}
+
+double pageCacheResidency(const std::string& filename, uint64_t* size) {
+#ifdef _WIN32
+    (void)filename;
+    (void)size;
+    return -1.0;
+#else
+    simulateOpen();
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        ++ioStats().residencySyscalls;
+        return -1.0;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        close(fd);
+        ioStats().residencySyscalls += 3;
+        return -1.0;
+    }
+    size_t length = static_cast<size_t>(info.st_size);
+    void* mapping = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        ioStats().residencySyscalls += 4;
+        return -1.0;
+    }
+    size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    std::vector<unsigned char> pages((length + pageSize - 1) / pageSize);
+    double residency = -1.0;
+    if (mincore(mapping, length, pages.data()) == 0) {
+        size_t resident = 0;
+        for (unsigned char page : pages) {
+            resident += page & 1;
+        }
+        residency = double(resident) / double(pages.size());
+    }
+    munmap(mapping, length);
+    ioStats().residencySyscalls += 6;
+    if (size) {
+        *size = length;
+    }
+    return residency;
+#endif
+}
+
+void trackInputResidency(const std::string& filename) {
+    uint64_t size = 0;
+    double residency = pageCacheResidency(filename, &size);
+    if (residency < 0.0) {
+        return;
+    }
+    ioStats().inputBytes += size;
+    ioStats().inputCachedBytes += static_cast<uint64_t>(residency * double(size));
+    ++ioStats().inputFilesMeasured;
+}
+
+// The whole file in as few reads as the OS allows, each one counted
+bool readFile(const std::string& filename, std::vector<BYTE>& data) {
+    simulateOpen();
+    ++ioStats().inputFiles;
+    uint64_t calls = 1;
+    bool complete = false;
+#ifdef _WIN32
+    HANDLE file = CreateFileW(fs::path(filename).c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+        FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file != INVALID_HANDLE_VALUE) {
+        LARGE_INTEGER length;
+        ++calls;
+        if (GetFileSizeEx(file, &length)) {
+            data.resize(static_cast<size_t>(length.QuadPart));
+            size_t done = 0;
+            DWORD read = 1;
+            while (done < data.size() && read > 0) {
+                DWORD chunk = static_cast<DWORD>(std::min<size_t>(data.size() - done, 1u << 30));
+                ++calls;
+                if (!ReadFile(file, data.data() + done, chunk, &read, nullptr)) {
+                    break;
+                }
+                done += read;
+            }
+            complete = done == data.size();
+        }
+        ++calls;
+        CloseHandle(file);
+    }
+#else
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        struct stat info;
+        ++calls;
+        if (fstat(fd, &info) == 0) {
+            data.resize(static_cast<size_t>(info.st_size));
+            size_t done = 0;
+            ssize_t got = 1;
+            while (done < data.size() && got > 0) {
+                ++calls;
+                got = read(fd, data.data() + done, data.size() - done);
+                done += got > 0 ? size_t(got) : 0;
+            }
+            complete = done == data.size();
+        }
+        ++calls;
+        close(fd);
+    }
+#endif
+    ioStats().inputSyscalls += calls;
+    if (complete) {
+        simulateTransfer(data.size());
+    }
+    return complete;
+}
+
+bool getPhysicalOffset(const std::string& filename, uint64_t& offset) {
+#ifdef _WIN32
+    HANDLE file = CreateFileW(fs::path(filename).c_str(), FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE,
+        nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    // One extent is enough; ERROR_MORE_DATA still fills it
+    STARTING_VCN_INPUT_BUFFER input = {};
+    RETRIEVAL_POINTERS_BUFFER output = {};
+    DWORD returned = 0;
+    BOOL ok = DeviceIoControl(file, FSCTL_GET_RETRIEVAL_POINTERS, &input, sizeof(input), &output, sizeof(output), &returned, nullptr);
+    bool found = (ok || GetLastError() == ERROR_MORE_DATA) && output.ExtentCount > 0 && output.Extents[0].Lcn.QuadPart >= 0;
+    CloseHandle(file);
+    if (found) {
+        offset = static_cast<uint64_t>(output.Extents[0].Lcn.QuadPart);
+    }
+    return found;
+#elif defined(__linux__)
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    // Room for the header and one extent
+    alignas(struct fiemap) unsigned char buffer[sizeof(struct fiemap) + sizeof(struct fiemap_extent)] = {};
+    struct fiemap* request = reinterpret_cast<struct fiemap*>(buffer);
+    request->fm_length = FIEMAP_MAX_OFFSET;
+    request->fm_extent_count = 1;
+    bool found = ioctl(fd, FS_IOC_FIEMAP, request) == 0 && request->fm_mapped_extents > 0 &&
+        !(request->fm_extents[0].fe_flags & FIEMAP_EXTENT_UNKNOWN);
+    close(fd);
+    if (found) {
+        offset = request->fm_extents[0].fe_physical;
+    }
+    return found;
+#else
+    (void)filename;
+    (void)offset;
+    return false;
+#endif
+}
+
+uint64_t getFileIndex(const std::string& filename) {
+#ifdef _WIN32
+    HANDLE file = CreateFileW(fs::path(filename).c_str(), FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE,
+        nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return 0;
+    }
+    BY_HANDLE_FILE_INFORMATION info;
+    uint64_t index = GetFileInformationByHandle(file, &info) ? (uint64_t(info.nFileIndexHigh) << 32) | info.nFileIndexLow : 0;
+    CloseHandle(file);
+    return index;
+#else
+    struct stat info;
+    return stat(filename.c_str(), &info) == 0 ? static_cast<uint64_t>(info.st_ino) : 0;
+#endif
+}
+
+static bool writeStream(const std::string& filename, const BYTE* data, size_t size) {
+    std::ofstream out(fs::path(filename), std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(size));
+    if (!out) {
+        return false;
+    }
+    ++ioStats().bufferedWrites;
+    return true;
+}
+
+bool writeFileBuffered(const std::string& filename, const BYTE* data, size_t size) {
+    simulateOpen();
+    simulateTransfer(size);
+    return writeStream(filename, data, size);
+}
+
+bool writeFileDirect(const std::string& filename, BYTE* data, size_t size) {
+    size_t padded = (size + directIoAlignment - 1) / directIoAlignment * directIoAlignment;
+    std::memset(data + size, 0, padded - size);
+    simulateOpen();
+    simulateTransfer(size);
+#ifdef _WIN32
+    HANDLE file = CreateFileW(fs::path(filename).c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH, nullptr);
+    if (file != INVALID_HANDLE_VALUE) {
+        bool written = true;
+        size_t offset = 0;
+        while (written && offset < padded) {
+            DWORD chunk = static_cast<DWORD>(std::min<size_t>(padded - offset, 1u << 30));
+            DWORD done = 0;
+            written = WriteFile(file, data + offset, chunk, &done, nullptr) && done == chunk;
+            offset += done;
+        }
+        // Unbuffered writes are whole sectors; cut the zero padding back off
+        FILE_END_OF_FILE_INFO end;
+        end.EndOfFile.QuadPart = static_cast<LONGLONG>(size);
+        written = written && SetFileInformationByHandle(file, FileEndOfFileInfo, &end, sizeof(end));
+        CloseHandle(file);
+        if (written) {
+            ++ioStats().directWrites;
+            return true;
+        }
+    }
+#else
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+    flags |= O_DIRECT;
+#endif
+    int fd = open(filename.c_str(), flags, 0644);
+    if (fd >= 0) {
+        bool written = true;
+        size_t offset = 0;
+        while (written && offset < padded) {
+            ssize_t done = write(fd, data + offset, padded - offset);
+            written = done > 0;
+            offset += written ? static_cast<size_t>(done) : 0;
+        }
+        // O_DIRECT writes are whole blocks; cut the zero padding back off
+        written = written && ftruncate(fd, static_cast<off_t>(size)) == 0;
+        close(fd);
+        if (written) {
+            ++ioStats().directWrites;
+            return true;
+        }
+    }
+#endif
+    // The file system refused unbuffered I/O (tmpfs, some network shares): write normally
+    return writeStream(filename, data, size);
+}
+
+// Mapped pages fault in and write back out of sight, so the whole mapping is charged when it is opened
+bool createMappedFile(const std::string& filename, size_t size, MappedFile& mapped) {
+    mapped = MappedFile();
+    simulateOpen();
+    simulateTransfer(size);
+#ifdef _WIN32
+    HANDLE file = CreateFileW(fs::path(filename).c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr,
+        CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER length;
+    length.QuadPart = static_cast<LONGLONG>(size);
+    HANDLE mapping = nullptr;
+    if (SetFilePointerEx(file, length, nullptr, FILE_BEGIN) && SetEndOfFile(file)) {
+        mapping = CreateFileMappingW(file, nullptr, PAGE_READWRITE, 0, 0, nullptr);
+    }
+    void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, size) : nullptr;
+    if (!view) {
+        if (mapping) {
+            CloseHandle(mapping);
+        }
+        CloseHandle(file);
+        return false;
+    }
+    mapped.file = file;
+    mapped.mapping = mapping;
+    mapped.data = static_cast<BYTE*>(view);
+#else
+    int fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    void* view = MAP_FAILED;
+    if (ftruncate(fd, static_cast<off_t>(size)) == 0) {
+        view = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (view == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    mapped.fd = fd;
+    mapped.data = static_cast<BYTE*>(view);
+#endif
+    mapped.size = size;
+    return true;
+}
+
+bool openMappedFile(const std::string& filename, bool writable, MappedFile& mapped) {
+    mapped = MappedFile();
+    simulateOpen();
+#ifdef _WIN32
+    HANDLE file = CreateFileW(fs::path(filename).c_str(), GENERIC_READ | (writable ? GENERIC_WRITE : 0), FILE_SHARE_READ,
+        nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER length;
+    HANDLE mapping = nullptr;
+    if (GetFileSizeEx(file, &length) && length.QuadPart > 0) {
+        mapping = CreateFileMappingW(file, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, nullptr);
+    }
+    void* view = mapping ? MapViewOfFile(mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!view) {
+        if (mapping) {
+            CloseHandle(mapping);
+        }
+        CloseHandle(file);
+        return false;
+    }
+    mapped.file = file;
+    mapped.mapping = mapping;
+    mapped.data = static_cast<BYTE*>(view);
+    mapped.size = static_cast<size_t>(length.QuadPart);
+#else
+    int fd = open(filename.c_str(), writable ? O_RDWR : O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    void* view = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        view = mmap(nullptr, static_cast<size_t>(info.st_size), writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    }
+    if (view == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    mapped.fd = fd;
+    mapped.data = static_cast<BYTE*>(view);
+    mapped.size = static_cast<size_t>(info.st_size);
+#endif
+    simulateTransfer(mapped.size);
+    if (!writable) {
+        // Open, size, map, and the unmap and close to come; the reads themselves are page faults
+        ++ioStats().inputFiles;
+#ifdef _WIN32
+        ioStats().inputSyscalls += 7;
+#else
+        ioStats().inputSyscalls += 5;
+#endif
+    }
+    return true;
+}
+
+void closeMappedFile(MappedFile& mapped) {
+#ifdef _WIN32
+    if (mapped.data) {
+        UnmapViewOfFile(mapped.data);
+    }
+    if (mapped.mapping) {
+        CloseHandle(mapped.mapping);
+    }
+    if (mapped.file) {
+        CloseHandle(mapped.file);
+    }
+#else
+    if (mapped.data) {
+        munmap(mapped.data, mapped.size);
+    }
+    if (mapped.fd >= 0) {
+        close(mapped.fd);
+    }
+#endif
+    mapped = MappedFile();
+}
+
+void printIoReport() {
+    IoStats& stats = ioStats();
+    std::cout << "I/O report:" << std::endl;
+    if (stats.inputFilesMeasured > 0 && stats.inputBytes > 0) {
+        std::cout << "  Input page cache hits: " << std::fixed << std::setprecision(1)
+            << 100.0 * double(stats.inputCachedBytes) / double(stats.inputBytes) << "% of "
+            << double(stats.inputBytes) / (1024.0 * 1024.0) << " MB in " << stats.inputFilesMeasured
+            << " files, measured with " << stats.residencySyscalls << " more system calls" << std::defaultfloat << std::endl;
+    }
+    else {
+        std::cout << "  Input page cache hits: not available on this platform" << std::endl;
+    }
+    double seconds = double(stats.outputMicroseconds) / 1e6;
+    double megabytes = double(stats.outputBytes) / (1024.0 * 1024.0);
+    std::cout << "  Output: " << std::fixed << std::setprecision(1) << megabytes << " MB in "
+        << std::setprecision(3) << seconds << " s (" << std::setprecision(1)
+        << (seconds > 0.0 ? megabytes / seconds : 0.0) << " MB/s), " << stats.directWrites
+        << " direct and " << stats.bufferedWrites << " buffered writes" << std::defaultfloat << std::endl;
+    if (stats.inputFiles > 0) {
+        std::cout << "  Input: " << stats.inputFiles << " files, " << stats.inputSyscalls << " I/O system calls ("
+            << std::fixed << std::setprecision(1) << double(stats.inputSyscalls) / double(stats.inputFiles) << " per file), "
+            << stats.memoryReads << " FreeImage reads served from memory" << std::defaultfloat << std::endl;
+    }
+    if (stats.readAheadBytes > 0) {
+        double readSeconds = double(stats.readAheadMicroseconds) / 1e6;
+        double readMegabytes = double(stats.readAheadBytes) / (1024.0 * 1024.0);
+        std::cout << "  Read-ahead: " << std::fixed << std::setprecision(1) << readMegabytes << " MB in "
+            << std::setprecision(3) << readSeconds << " s (" << std::setprecision(1)
+            << (readSeconds > 0.0 ? readMegabytes / readSeconds : 0.0) << " MB/s)" << std::defaultfloat << std::endl;
+    }
+    if (simulatedStorage.enabled) {
+        std::cout << "  Simulated storage (" << std::setprecision(6) << simulatedStorage.latencyMilliseconds << " ms, "
+            << simulatedStorage.megabytesPerSecond << " MB/s, " << simulatedStorage.metadataMilliseconds << " ms metadata): "
+            << stats.simulatedOperations << " operations waited " << std::fixed << std::setprecision(3)
+            << double(stats.simulatedMicroseconds) / 1e6 << " s in total" << std::defaultfloat << std::endl;
+    }
+}
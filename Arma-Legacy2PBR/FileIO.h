@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <FreeImage.h>
+
+struct IoStats {
+    std::atomic<uint64_t> inputBytes{ 0 };
+    std::atomic<uint64_t> inputCachedBytes{ 0 };
+    std::atomic<uint64_t> inputFilesMeasured{ 0 };
+    // Calls the page cache probe made on top of the reads (open, size, map, mincore, unmap, close)
+    std::atomic<uint64_t> residencySyscalls{ 0 };
+    std::atomic<uint64_t> outputBytes{ 0 };
+    std::atomic<uint64_t> outputMicroseconds{ 0 };
+    std::atomic<uint64_t> directWrites{ 0 };
+    std::atomic<uint64_t> bufferedWrites{ 0 };
+    std::atomic<uint64_t> readAheadBytes{ 0 };
+    std::atomic<uint64_t> readAheadMicroseconds{ 0 };
+    std::atomic<uint64_t> simulatedOperations{ 0 };
+    std::atomic<uint64_t> simulatedMicroseconds{ 0 };
+    // Input files opened by readFile and openMappedFile, the system calls that took (open, size, read or map,
+    // unmap, close), and the reads FreeImage made from memory that would have been stdio reads
+    std::atomic<uint64_t> inputFiles{ 0 };
+    std::atomic<uint64_t> inputSyscalls{ 0 };
+    std::atomic<uint64_t> memoryReads{ 0 };
+};
+
+IoStats& ioStats();
+
+// Network share model for benchmarking on a local disk: every open, read and write waits a round trip,
+// transfers queue on one link of the given bandwidth, and stat-like calls pay the metadata cost
+struct SimulatedStorage {
+    bool enabled = false;
+    double latencyMilliseconds = 0.0;
+    double megabytesPerSecond = 0.0;   // 0 = unlimited
+    double metadataMilliseconds = 0.0;
+};
+
+// "LATENCY_MS,MB_PER_S,METADATA_MS", e.g. "2,110,1" for NFS over gigabit
+bool parseSimulatedStorage(const std::string& text, SimulatedStorage& storage);
+void setSimulatedStorage(const SimulatedStorage& storage);
+void simulateOpen();
+void simulateTransfer(uint64_t bytes);
+void simulateMetadata();
+
+BYTE* allocateAligned(size_t size);
+void freeAligned(BYTE* data);
+
+// Fraction of the file currently in the page cache, or -1 when the platform cannot tell; size is set when known.
+// The probe opens the file like any read, so it waits on simulated storage and its calls are counted
+double pageCacheResidency(const std::string& filename, uint64_t* size = nullptr);
+void trackInputResidency(const std::string& filename);
+
+bool readFile(const std::string& filename, std::vector<BYTE>& data);
+// Where the file starts on its volume (first extent), or false when the file system does not say
+bool getPhysicalOffset(const std::string& filename, uint64_t& offset);
+// Inode / file index, which tends to follow allocation order on HDD file systems
+uint64_t getFileIndex(const std::string& filename);
+
+bool writeFileBuffered(const std::string& filename, const BYTE* data, size_t size);
+// Bypasses the page cache; data must come from allocateAligned with room up to the next directIoAlignment
+bool writeFileDirect(const std::string& filename, BYTE* data, size_t size);
+
+const size_t directIoAlignment = 4096;
+
+struct MappedFile {
+    BYTE* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    void* file = nullptr;
+    void* mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+};
+
+// Creates (or truncates) the file at the given size and maps it writable
+bool createMappedFile(const std::string& filename, size_t size, MappedFile& mapped);
+bool openMappedFile(const std::string& filename, bool writable, MappedFile& mapped);
+void closeMappedFile(MappedFile& mapped);
+
+void printIoReport();
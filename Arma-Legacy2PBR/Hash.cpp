@@ -0,0 +1,189 @@
+#include "Hash.h"
+#include "CpuDispatch.h"
+
+#include <algorithm>
+#include <cstring>
+
+static const uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t prime3 = 0x165667B19E3779F9ULL;
+static const uint64_t prime4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t prime5 = 0x27D4EB2F165667C5ULL;
+
+static uint64_t rotateLeft(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static uint64_t read64(const unsigned char* p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint32_t read32(const unsigned char* p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint64_t round64(uint64_t accumulator, uint64_t input) {
+    accumulator += input * prime2;
+    accumulator = rotateLeft(accumulator, 31);
+    return accumulator * prime1;
+}
+
+static uint64_t mergeRound(uint64_t hash, uint64_t accumulator) {
+    hash ^= round64(0, accumulator);
+    return hash * prime1 + prime4;
+}
+
+void xxh64Reset(Xxh64State& state, uint64_t seed) {
+    state.accumulators[0] = seed + prime1 + prime2;
+    state.accumulators[1] = seed + prime2;
+    state.accumulators[2] = seed;
+    state.accumulators[3] = seed - prime1;
+    state.seed = seed;
+    state.totalLength = 0;
+    state.buffered = 0;
+}
+
+void xxh64Update(Xxh64State& state, const void* data, size_t length) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    state.totalLength += length;
+
+    if (state.buffered + length < 32) {
+        memcpy(state.buffer + state.buffered, p, length);
+        state.buffered += length;
+        return;
+    }
+    if (state.buffered > 0) {
+        size_t fill = 32 - state.buffered;
+        memcpy(state.buffer + state.buffered, p, fill);
+        for (int i = 0; i < 4; ++i) {
+            state.accumulators[i] = round64(state.accumulators[i], read64(state.buffer + i * 8));
+        }
+        p += fill;
+        length -= fill;
+        state.buffered = 0;
+    }
+    while (length >= 32) {
+        for (int i = 0; i < 4; ++i) {
+            state.accumulators[i] = round64(state.accumulators[i], read64(p + i * 8));
+        }
+        p += 32;
+        length -= 32;
+    }
+    memcpy(state.buffer, p, length);
+    state.buffered = length;
+}
+
+uint64_t xxh64Digest(const Xxh64State& state) {
+    uint64_t hash;
+    if (state.totalLength >= 32) {
+        const uint64_t* a = state.accumulators;
+        hash = rotateLeft(a[0], 1) + rotateLeft(a[1], 7) + rotateLeft(a[2], 12) + rotateLeft(a[3], 18);
+        for (int i = 0; i < 4; ++i) {
+            hash = mergeRound(hash, a[i]);
+        }
+    }
+    else {
+        hash = state.seed + prime5;
+    }
+    hash += state.totalLength;
+
+    const unsigned char* p = state.buffer;
+    size_t remaining = state.buffered;
+    while (remaining >= 8) {
+        hash ^= round64(0, read64(p));
+        hash = rotateLeft(hash, 27) * prime1 + prime4;
+        p += 8;
+        remaining -= 8;
+    }
+    if (remaining >= 4) {
+        hash ^= uint64_t(read32(p)) * prime1;
+        hash = rotateLeft(hash, 23) * prime2 + prime3;
+        p += 4;
+        remaining -= 4;
+    }
+    while (remaining > 0) {
+        hash ^= uint64_t(*p) * prime5;
+        hash = rotateLeft(hash, 11) * prime1;
+        ++p;
+        --remaining;
+    }
+
+    hash ^= hash >> 33;
+    hash *= prime2;
+    hash ^= hash >> 29;
+    hash *= prime3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+uint64_t xxh64(const void* data, size_t length, uint64_t seed) {
+    Xxh64State state;
+    xxh64Reset(state, seed);
+    xxh64Update(state, data, length);
+    return xxh64Digest(state);
+}
+
+void sha256Reset(Sha256State& state) {
+    static const uint32_t initial[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+    memcpy(state.hash, initial, sizeof(initial));
+    state.totalLength = 0;
+    state.buffered = 0;
+}
+
+void sha256Update(Sha256State& state, const void* data, size_t length) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    state.totalLength += length;
+    if (state.buffered > 0) {
+        size_t fill = std::min(length, sizeof(state.buffer) - state.buffered);
+        memcpy(state.buffer + state.buffered, p, fill);
+        state.buffered += fill;
+        p += fill;
+        length -= fill;
+        if (state.buffered < sizeof(state.buffer)) {
+            return;
+        }
+        kernels().sha256Blocks(state.hash, state.buffer, 1);
+        state.buffered = 0;
+    }
+    size_t blocks = length / 64;
+    kernels().sha256Blocks(state.hash, p, blocks);
+    p += blocks * 64;
+    length -= blocks * 64;
+    memcpy(state.buffer, p, length);
+    state.buffered = length;
+}
+
+std::string sha256Digest(const Sha256State& state) {
+    // Pad a copy: 0x80, zeros up to 56 bytes into the block, then the length in bits, big-endian
+    Sha256State padded = state;
+    uint64_t bits = state.totalLength * 8;
+    unsigned char padding[72] = { 0x80 };
+    size_t padLength = (padded.buffered < 56 ? 56 : 120) - padded.buffered;
+    for (int i = 0; i < 8; ++i) {
+        padding[padLength + i] = static_cast<unsigned char>(bits >> (56 - i * 8));
+    }
+    sha256Update(padded, padding, padLength + 8);
+
+    static const char digits[] = "0123456789abcdef";
+    std::string text(64, '0');
+    for (int i = 0; i < 32; ++i) {
+        unsigned char byte = static_cast<unsigned char>(padded.hash[i / 4] >> (24 - (i % 4) * 8));
+        text[i * 2] = digits[byte >> 4];
+        text[i * 2 + 1] = digits[byte & 0xF];
+    }
+    return text;
+}
+
+std::string toHex(uint64_t value) {
+    static const char digits[] = "0123456789abcdef";
+    std::string text(16, '0');
+    for (int i = 15; i >= 0; --i) {
+        text[i] = digits[value & 0xF];
+        value >>= 4;
+    }
+    return text;
+}
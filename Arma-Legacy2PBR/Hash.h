@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Streaming XXH64
+struct Xxh64State {
+    uint64_t accumulators[4];
+    uint64_t seed;
+    uint64_t totalLength;
+    unsigned char buffer[32];
+    size_t buffered;
+};
+
+void xxh64Reset(Xxh64State& state, uint64_t seed = 0);
+void xxh64Update(Xxh64State& state, const void* data, size_t length);
+uint64_t xxh64Digest(const Xxh64State& state);
+uint64_t xxh64(const void* data, size_t length, uint64_t seed = 0);
+
+// Streaming SHA-256 (FIPS 180-4)
+struct Sha256State {
+    uint32_t hash[8];
+    uint64_t totalLength;
+    unsigned char buffer[64];
+    size_t buffered;
+};
+
+void sha256Reset(Sha256State& state);
+void sha256Update(Sha256State& state, const void* data, size_t length);
+// Lower-case hex of the 32-byte digest; the state itself is left as it is
+std::string sha256Digest(const Sha256State& state);
+
+std::string toHex(uint64_t value);
@@ -0,0 +1,465 @@
+#include "Kernels.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#ifdef KERNELS_X86
+#include <immintrin.h>
+#endif
+
+// Scalar reference: every SIMD variant must produce exactly these bytes
+void packNmoScalar(BYTE* out, const BYTE* nohq, const BYTE* smdi, const BYTE* as, size_t pixels) {
+    for (size_t i = 0; i < pixels; ++i) {
+        size_t index = i * 4;
+        out[index + 0] = smdi[index + 1];
+        out[index + 1] = nohq[index + 1];
+        out[index + 2] = nohq[index + 2];
+        out[index + 3] = as[index + 1];
+    }
+}
+
+void packBcrScalar(BYTE* out, const BYTE* co, const BYTE* smdi, size_t pixels) {
+    for (size_t i = 0; i < pixels; ++i) {
+        size_t index = i * 4;
+        out[index + 0] = co[index + 0];
+        out[index + 1] = co[index + 1];
+        out[index + 2] = co[index + 2];
+        out[index + 3] = smdi[index + 0];
+    }
+}
+
+// Per pixel, the steepest rise seen along each direction gives the sine of its horizon angle; AO is one minus their
+// mean. The SIMD variants do the same float operations in the same order, so they match bit for bit
+void horizonAoScalar(float* out, const float* heights, const HorizonSamples& samples, size_t pixels) {
+    for (size_t i = 0; i < pixels; ++i) {
+        float center = heights[i];
+        float sum = 0.0f;
+        for (unsigned d = 0; d < horizonDirections; ++d) {
+            float steepest = 0.0f;
+            for (unsigned s = 0; s < horizonSteps; ++s) {
+                unsigned k = d * horizonSteps + s;
+                float slope = (heights[ptrdiff_t(i) + samples.offsets[k]] - center) * samples.inverseDistances[k];
+                steepest = slope > steepest ? slope : steepest;
+            }
+            sum = sum + steepest / std::sqrt(1.0f + steepest * steepest);
+        }
+        out[i] = 1.0f - sum * (1.0f / horizonDirections);
+    }
+}
+
+// Leftovers shorter than a vector, gathered from all jobs of a batch into one stream so that they are packed as
+// whole vectors too, instead of every job ending in its own scalar tail
+struct PackTails {
+    static const size_t capacity = 64;
+    BYTE inputs[3][capacity * 4];
+    BYTE out[capacity * 4];
+    BYTE* targets[capacity];
+    size_t pixels = 0;
+};
+
+template <typename Pack>
+static void flushTails(PackTails& tails, Pack pack) {
+    pack(tails.out, tails.inputs[0], tails.inputs[1], tails.inputs[2], tails.pixels);
+    for (size_t i = 0; i < tails.pixels; ++i) {
+        memcpy(tails.targets[i], tails.out + i * 4, 4);
+    }
+    tails.pixels = 0;
+}
+
+// Width is the pixel count of one vector; variants with masked tails pass 1 and never stage anything
+template <size_t Width, typename Pack>
+static void packBatch(const PackJob* jobs, size_t count, unsigned inputCount, Pack pack) {
+    PackTails tails;
+    for (size_t j = 0; j < count; ++j) {
+        const PackJob& job = jobs[j];
+        size_t whole = job.pixels / Width * Width;
+        pack(job.out, job.inputs[0], job.inputs[1], job.inputs[2], whole);
+        for (size_t i = whole; i < job.pixels; ++i) {
+            for (unsigned k = 0; k < inputCount; ++k) {
+                memcpy(tails.inputs[k] + tails.pixels * 4, job.inputs[k] + i * 4, 4);
+            }
+            tails.targets[tails.pixels++] = job.out + i * 4;
+            if (tails.pixels == PackTails::capacity) {
+                flushTails(tails, pack);
+            }
+        }
+    }
+    if (tails.pixels > 0) {
+        flushTails(tails, pack);
+    }
+}
+
+void packNmoBatchScalar(const PackJob* jobs, size_t count) {
+    packBatch<1>(jobs, count, 3, [](BYTE* out, const BYTE* nohq, const BYTE* smdi, const BYTE* as, size_t pixels) {
+        packNmoScalar(out, nohq, smdi, as, pixels);
+    });
+}
+
+void packBcrBatchScalar(const PackJob* jobs, size_t count) {
+    packBatch<1>(jobs, count, 2, [](BYTE* out, const BYTE* co, const BYTE* smdi, const BYTE*, size_t pixels) {
+        packBcrScalar(out, co, smdi, pixels);
+    });
+}
+
+// Widens one channel of a 5:6:5 endpoint to 8 bits
+static unsigned expandEndpoint(unsigned color, unsigned channel) {
+    unsigned value = channel == 0 ? color & 31 : channel == 1 ? (color >> 5) & 63 : color >> 11;
+    return channel == 1 ? (value << 2) | (value >> 4) : (value << 3) | (value >> 2);
+}
+
+// Palette of one block in the requested channel and the block's indices: 2 bits per pixel for colors, 3 for BC3
+// alpha. BC3 color blocks always use four colors; BC1 alpha is only the punch-through of the three-color mode
+static uint64_t readBcBlock(const BYTE* block, bool bc3, unsigned channel, BYTE* palette, unsigned& bits) {
+    if (bc3 && channel == 3) {
+        unsigned a0 = block[0], a1 = block[1];
+        palette[0] = BYTE(a0);
+        palette[1] = BYTE(a1);
+        if (a0 > a1) {
+            for (unsigned i = 2; i < 8; ++i) {
+                palette[i] = BYTE(((8 - i) * a0 + (i - 1) * a1) / 7);
+            }
+        }
+        else {
+            for (unsigned i = 2; i < 6; ++i) {
+                palette[i] = BYTE(((6 - i) * a0 + (i - 1) * a1) / 5);
+            }
+            palette[6] = 0;
+            palette[7] = 255;
+        }
+        bits = 3;
+        uint64_t indices = 0;
+        for (unsigned i = 0; i < 6; ++i) {
+            indices |= uint64_t(block[2 + i]) << (8 * i);
+        }
+        return indices;
+    }
+    const BYTE* color = bc3 ? block + 8 : block;
+    unsigned c0 = color[0] | (color[1] << 8);
+    unsigned c1 = color[2] | (color[3] << 8);
+    bool fourColors = bc3 || c0 > c1;
+    if (channel == 3) {
+        palette[0] = palette[1] = palette[2] = 255;
+        palette[3] = fourColors ? 255 : 0;
+    }
+    else {
+        unsigned e0 = expandEndpoint(c0, channel), e1 = expandEndpoint(c1, channel);
+        palette[0] = BYTE(e0);
+        palette[1] = BYTE(e1);
+        palette[2] = BYTE(fourColors ? (2 * e0 + e1) / 3 : (e0 + e1) / 2);
+        palette[3] = BYTE(fourColors ? (e0 + 2 * e1) / 3 : 0);
+    }
+    bits = 2;
+    return uint64_t(color[4]) | (uint64_t(color[5]) << 8) | (uint64_t(color[6]) << 16) | (uint64_t(color[7]) << 24);
+}
+
+void decodeBcChannelScalar(BYTE* out, ptrdiff_t pitch, size_t step, const BYTE* blocks, size_t blockCount, bool bc3, unsigned channel) {
+    size_t blockBytes = bc3 ? 16 : 8;
+    for (size_t b = 0; b < blockCount; ++b) {
+        BYTE palette[8];
+        unsigned bits = 0;
+        uint64_t indices = readBcBlock(blocks + b * blockBytes, bc3, channel, palette, bits);
+        BYTE* target = out + b * 4 * step;
+        for (unsigned i = 0; i < 16; ++i) {
+            target[ptrdiff_t(i / 4) * pitch + ptrdiff_t((i % 4) * step)] = palette[(indices >> (bits * i)) & ((1u << bits) - 1)];
+        }
+    }
+}
+
+static const uint32_t sha256Constants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static uint32_t rotateRight(uint32_t value, int bits) {
+    return (value >> bits) | (value << (32 - bits));
+}
+
+void sha256BlocksScalar(uint32_t* hash, const BYTE* blocks, size_t count) {
+    for (; count > 0; --count, blocks += 64) {
+        uint32_t w[64];
+        for (int i = 0; i < 16; ++i) {
+            w[i] = (uint32_t(blocks[i * 4]) << 24) | (uint32_t(blocks[i * 4 + 1]) << 16) | (uint32_t(blocks[i * 4 + 2]) << 8) | blocks[i * 4 + 3];
+        }
+        for (int i = 16; i < 64; ++i) {
+            uint32_t s0 = rotateRight(w[i - 15], 7) ^ rotateRight(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotateRight(w[i - 2], 17) ^ rotateRight(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = hash[0], b = hash[1], c = hash[2], d = hash[3], e = hash[4], f = hash[5], g = hash[6], h = hash[7];
+        for (int i = 0; i < 64; ++i) {
+            uint32_t t1 = h + (rotateRight(e, 6) ^ rotateRight(e, 11) ^ rotateRight(e, 25)) + ((e & f) ^ (~e & g)) + sha256Constants[i] + w[i];
+            uint32_t t2 = (rotateRight(a, 2) ^ rotateRight(a, 13) ^ rotateRight(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        hash[0] += a;
+        hash[1] += b;
+        hash[2] += c;
+        hash[3] += d;
+        hash[4] += e;
+        hash[5] += f;
+        hash[6] += g;
+        hash[7] += h;
+    }
+}
+
+#ifdef KERNELS_X86
+
+// On little-endian BGRA words both layouts reduce to masks and shifts, no byte shuffles needed:
+//   NMO = (nohq & 0x00FFFF00) | ((smdi >> 8) & 0xFF) | ((as << 16) & 0xFF000000)
+//   BCR = (co & 0x00FFFFFF) | (smdi << 24)
+
+void packNmoSse2(BYTE* out, const BYTE* nohq, const BYTE* smdi, const BYTE* as, size_t pixels) {
+    const __m128i nohqMask = _mm_set1_epi32(0x00FFFF00);
+    const __m128i lowMask = _mm_set1_epi32(0x000000FF);
+    const __m128i highMask = _mm_set1_epi32(int(0xFF000000));
+    size_t i = 0;
+    for (; i + 4 <= pixels; i += 4) {
+        __m128i n = _mm_loadu_si128(reinterpret_cast<const __m128i*>(nohq + i * 4));
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(smdi + i * 4));
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(as + i * 4));
+        __m128i result = _mm_or_si128(_mm_and_si128(n, nohqMask),
+            _mm_or_si128(_mm_and_si128(_mm_srli_epi32(s, 8), lowMask), _mm_and_si128(_mm_slli_epi32(a, 16), highMask)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i * 4), result);
+    }
+    packNmoScalar(out + i * 4, nohq + i * 4, smdi + i * 4, as + i * 4, pixels - i);
+}
+
+void packBcrSse2(BYTE* out, const BYTE* co, const BYTE* smdi, size_t pixels) {
+    const __m128i colorMask = _mm_set1_epi32(0x00FFFFFF);
+    size_t i = 0;
+    for (; i + 4 <= pixels; i += 4) {
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(co + i * 4));
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(smdi + i * 4));
+        __m128i result = _mm_or_si128(_mm_and_si128(c, colorMask), _mm_slli_epi32(s, 24));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i * 4), result);
+    }
+    packBcrScalar(out + i * 4, co + i * 4, smdi + i * 4, pixels - i);
+}
+
+void horizonAoSse2(float* out, const float* heights, const HorizonSamples& samples, size_t pixels) {
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 scale = _mm_set1_ps(1.0f / horizonDirections);
+    size_t i = 0;
+    for (; i + 4 <= pixels; i += 4) {
+        __m128 center = _mm_loadu_ps(heights + i);
+        __m128 sum = _mm_setzero_ps();
+        for (unsigned d = 0; d < horizonDirections; ++d) {
+            __m128 steepest = _mm_setzero_ps();
+            for (unsigned s = 0; s < horizonSteps; ++s) {
+                unsigned k = d * horizonSteps + s;
+                __m128 rise = _mm_sub_ps(_mm_loadu_ps(heights + ptrdiff_t(i) + samples.offsets[k]), center);
+                steepest = _mm_max_ps(_mm_mul_ps(rise, _mm_set1_ps(samples.inverseDistances[k])), steepest);
+            }
+            sum = _mm_add_ps(sum, _mm_div_ps(steepest, _mm_sqrt_ps(_mm_add_ps(one, _mm_mul_ps(steepest, steepest)))));
+        }
+        _mm_storeu_ps(out + i, _mm_sub_ps(one, _mm_mul_ps(sum, scale)));
+    }
+    horizonAoScalar(out + i, heights + i, samples, pixels - i);
+}
+
+// The 16 lookups of a block are one byte shuffle. Two-bit indices are spread one per byte, pixel j of each row
+// ending up as index << 2j for j < 2 and index << 2(j - 2) otherwise; the palette is laid out at both spacings
+TARGET_SSSE3 void decodeBcChannelSsse3(BYTE* out, ptrdiff_t pitch, size_t step, const BYTE* blocks, size_t blockCount, bool bc3, unsigned channel) {
+    if (step != 1) {
+        decodeBcChannelScalar(out, pitch, step, blocks, blockCount, bc3, channel);
+        return;
+    }
+    const __m128i spread = _mm_setr_epi8(0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3);
+    const __m128i lowMask = _mm_set1_epi32(0x00000C03);
+    const __m128i highMask = _mm_set1_epi32(0x0C030000);
+    size_t blockBytes = bc3 ? 16 : 8;
+    for (size_t b = 0; b < blockCount; ++b) {
+        BYTE palette[8];
+        unsigned bits = 0;
+        uint64_t indices = readBcBlock(blocks + b * blockBytes, bc3, channel, palette, bits);
+        __m128i selectors;
+        __m128i table;
+        if (bits == 2) {
+            __m128i packed = _mm_shuffle_epi8(_mm_cvtsi32_si128(int(uint32_t(indices))), spread);
+            selectors = _mm_or_si128(_mm_and_si128(packed, lowMask), _mm_and_si128(_mm_srli_epi16(packed, 4), highMask));
+            table = _mm_setr_epi8(char(palette[0]), char(palette[1]), char(palette[2]), char(palette[3]), char(palette[1]), 0, 0, 0,
+                char(palette[2]), 0, 0, 0, char(palette[3]), 0, 0, 0);
+        }
+        else {
+            alignas(16) BYTE unpacked[16];
+            for (unsigned i = 0; i < 16; ++i) {
+                unpacked[i] = BYTE((indices >> (3 * i)) & 7);
+            }
+            selectors = _mm_load_si128(reinterpret_cast<const __m128i*>(unpacked));
+            table = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(palette));
+        }
+        __m128i values = _mm_shuffle_epi8(table, selectors);
+        BYTE* target = out + b * 4;
+        for (int row = 0; row < 4; ++row) {
+            uint32_t word = uint32_t(_mm_cvtsi128_si32(values));
+            memcpy(target + row * pitch, &word, 4);
+            values = _mm_srli_si128(values, 4);
+        }
+    }
+}
+
+TARGET_AVX2 void packNmoAvx2(BYTE* out, const BYTE* nohq, const BYTE* smdi, const BYTE* as, size_t pixels) {
+    const __m256i nohqMask = _mm256_set1_epi32(0x00FFFF00);
+    const __m256i lowMask = _mm256_set1_epi32(0x000000FF);
+    const __m256i highMask = _mm256_set1_epi32(int(0xFF000000));
+    size_t i = 0;
+    for (; i + 8 <= pixels; i += 8) {
+        __m256i n = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(nohq + i * 4));
+        __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(smdi + i * 4));
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(as + i * 4));
+        __m256i result = _mm256_or_si256(_mm256_and_si256(n, nohqMask),
+            _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(s, 8), lowMask), _mm256_and_si256(_mm256_slli_epi32(a, 16), highMask)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i * 4), result);
+    }
+    packNmoScalar(out + i * 4, nohq + i * 4, smdi + i * 4, as + i * 4, pixels - i);
+}
+
+TARGET_AVX2 void packBcrAvx2(BYTE* out, const BYTE* co, const BYTE* smdi, size_t pixels) {
+    const __m256i colorMask = _mm256_set1_epi32(0x00FFFFFF);
+    size_t i = 0;
+    for (; i + 8 <= pixels; i += 8) {
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(co + i * 4));
+        __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(smdi + i * 4));
+        __m256i result = _mm256_or_si256(_mm256_and_si256(c, colorMask), _mm256_slli_epi32(s, 24));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i * 4), result);
+    }
+    packBcrScalar(out + i * 4, co + i * 4, smdi + i * 4, pixels - i);
+}
+
+TARGET_AVX2 void horizonAoAvx2(float* out, const float* heights, const HorizonSamples& samples, size_t pixels) {
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 scale = _mm256_set1_ps(1.0f / horizonDirections);
+    size_t i = 0;
+    for (; i + 8 <= pixels; i += 8) {
+        __m256 center = _mm256_loadu_ps(heights + i);
+        __m256 sum = _mm256_setzero_ps();
+        for (unsigned d = 0; d < horizonDirections; ++d) {
+            __m256 steepest = _mm256_setzero_ps();
+            for (unsigned s = 0; s < horizonSteps; ++s) {
+                unsigned k = d * horizonSteps + s;
+                __m256 rise = _mm256_sub_ps(_mm256_loadu_ps(heights + ptrdiff_t(i) + samples.offsets[k]), center);
+                steepest = _mm256_max_ps(_mm256_mul_ps(rise, _mm256_set1_ps(samples.inverseDistances[k])), steepest);
+            }
+            sum = _mm256_add_ps(sum, _mm256_div_ps(steepest, _mm256_sqrt_ps(_mm256_add_ps(one, _mm256_mul_ps(steepest, steepest)))));
+        }
+        _mm256_storeu_ps(out + i, _mm256_sub_ps(one, _mm256_mul_ps(sum, scale)));
+    }
+    horizonAoScalar(out + i, heights + i, samples, pixels - i);
+}
+
+// AVX-512 handles the tail with masked loads and stores instead of a scalar loop. The shifts take the same mask:
+// the unmasked forms start from an undefined vector, which GCC 12 reports as maybe uninitialised
+TARGET_AVX512 void packNmoAvx512(BYTE* out, const BYTE* nohq, const BYTE* smdi, const BYTE* as, size_t pixels) {
+    const __m512i nohqMask = _mm512_set1_epi32(0x00FFFF00);
+    const __m512i lowMask = _mm512_set1_epi32(0x000000FF);
+    const __m512i highMask = _mm512_set1_epi32(int(0xFF000000));
+    for (size_t i = 0; i < pixels; i += 16) {
+        size_t remaining = pixels - i;
+        __mmask16 mask = remaining >= 16 ? __mmask16(0xFFFF) : __mmask16((1u << remaining) - 1);
+        __m512i n = _mm512_maskz_loadu_epi32(mask, nohq + i * 4);
+        __m512i s = _mm512_maskz_loadu_epi32(mask, smdi + i * 4);
+        __m512i a = _mm512_maskz_loadu_epi32(mask, as + i * 4);
+        __m512i result = _mm512_or_si512(_mm512_and_si512(n, nohqMask),
+            _mm512_or_si512(_mm512_and_si512(_mm512_maskz_srli_epi32(mask, s, 8), lowMask), _mm512_and_si512(_mm512_maskz_slli_epi32(mask, a, 16), highMask)));
+        _mm512_mask_storeu_epi32(out + i * 4, mask, result);
+    }
+}
+
+TARGET_AVX512 void packBcrAvx512(BYTE* out, const BYTE* co, const BYTE* smdi, size_t pixels) {
+    const __m512i colorMask = _mm512_set1_epi32(0x00FFFFFF);
+    for (size_t i = 0; i < pixels; i += 16) {
+        size_t remaining = pixels - i;
+        __mmask16 mask = remaining >= 16 ? __mmask16(0xFFFF) : __mmask16((1u << remaining) - 1);
+        __m512i c = _mm512_maskz_loadu_epi32(mask, co + i * 4);
+        __m512i s = _mm512_maskz_loadu_epi32(mask, smdi + i * 4);
+        __m512i result = _mm512_or_si512(_mm512_and_si512(c, colorMask), _mm512_maskz_slli_epi32(mask, s, 24));
+        _mm512_mask_storeu_epi32(out + i * 4, mask, result);
+    }
+}
+
+void packNmoBatchSse2(const PackJob* jobs, size_t count) {
+    packBatch<4>(jobs, count, 3, [](BYTE* out, const BYTE* nohq, const BYTE* smdi, const BYTE* as, size_t pixels) {
+        packNmoSse2(out, nohq, smdi, as, pixels);
+    });
+}
+
+void packBcrBatchSse2(const PackJob* jobs, size_t count) {
+    packBatch<4>(jobs, count, 2, [](BYTE* out, const BYTE* co, const BYTE* smdi, const BYTE*, size_t pixels) {
+        packBcrSse2(out, co, smdi, pixels);
+    });
+}
+
+void packNmoBatchAvx2(const PackJob* jobs, size_t count) {
+    packBatch<8>(jobs, count, 3, [](BYTE* out, const BYTE* nohq, const BYTE* smdi, const BYTE* as, size_t pixels) {
+        packNmoAvx2(out, nohq, smdi, as, pixels);
+    });
+}
+
+void packBcrBatchAvx2(const PackJob* jobs, size_t count) {
+    packBatch<8>(jobs, count, 2, [](BYTE* out, const BYTE* co, const BYTE* smdi, const BYTE*, size_t pixels) {
+        packBcrAvx2(out, co, smdi, pixels);
+    });
+}
+
+void packNmoBatchAvx512(const PackJob* jobs, size_t count) {
+    packBatch<1>(jobs, count, 3, [](BYTE* out, const BYTE* nohq, const BYTE* smdi, const BYTE* as, size_t pixels) {
+        packNmoAvx512(out, nohq, smdi, as, pixels);
+    });
+}
+
+void packBcrBatchAvx512(const PackJob* jobs, size_t count) {
+    packBatch<1>(jobs, count, 2, [](BYTE* out, const BYTE* co, const BYTE* smdi, const BYTE*, size_t pixels) {
+        packBcrAvx512(out, co, smdi, pixels);
+    });
+}
+
+// The SHA extensions keep the state as ABEF/CDGH and take two rounds per instruction; message groups of four
+// words are extended in place, slot g & 3 holding group g - 4 until it is replaced by group g
+TARGET_SHA void sha256BlocksShaNi(uint32_t* hash, const BYTE* blocks, size_t count) {
+    const __m128i byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bLL, 0x0405060700010203LL);
+    __m128i dcba = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(hash)), 0xB1);
+    __m128i efgh = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(hash + 4)), 0x1B);
+    __m128i abef = _mm_alignr_epi8(dcba, efgh, 8);
+    __m128i cdgh = _mm_blend_epi16(efgh, dcba, 0xF0);
+    for (; count > 0; --count, blocks += 64) {
+        __m128i previousAbef = abef;
+        __m128i previousCdgh = cdgh;
+        __m128i message[4];
+        for (int i = 0; i < 4; ++i) {
+            message[i] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(blocks + i * 16)), byteSwap);
+        }
+        for (int g = 0; g < 16; ++g) {
+            if (g >= 4) {
+                __m128i last = message[(g + 3) & 3];
+                __m128i extended = _mm_add_epi32(_mm_sha256msg1_epu32(message[g & 3], message[(g + 1) & 3]),
+                    _mm_alignr_epi8(last, message[(g + 2) & 3], 4));
+                message[g & 3] = _mm_sha256msg2_epu32(extended, last);
+            }
+            __m128i words = _mm_add_epi32(message[g & 3], _mm_loadu_si128(reinterpret_cast<const __m128i*>(sha256Constants + g * 4)));
+            cdgh = _mm_sha256rnds2_epu32(cdgh, abef, words);
+            abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(words, 0x0E));
+        }
+        abef = _mm_add_epi32(abef, previousAbef);
+        cdgh = _mm_add_epi32(cdgh, previousCdgh);
+    }
+    __m128i feba = _mm_shuffle_epi32(abef, 0x1B);
+    __m128i dchg = _mm_shuffle_epi32(cdgh, 0xB1);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(hash), _mm_blend_epi16(feba, dchg, 0xF0));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(hash + 4), _mm_alignr_epi8(dchg, feba, 8));
+}
+
+#endif
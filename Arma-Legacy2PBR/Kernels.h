@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <FreeImage.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define KERNELS_X86 1
+#endif
+
+// GCC and Clang need per-function target attributes for intrinsics above the baseline; MSVC does not
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_AVX512 __attribute__((target("avx512f")))
+#define TARGET_SHA __attribute__((target("sha,sse4.1")))
+#else
+#define TARGET_SSSE3
+#define TARGET_AVX2
+#define TARGET_AVX512
+#define TARGET_SHA
+#endif
+
+// Ambient occlusion samples: for each direction, steps at growing distance along it, given as offsets into a
+// padded row-major height field and the inverse horizontal distance of each step
+const unsigned horizonDirections = 8;
+const unsigned horizonSteps = 6;
+
+struct HorizonSamples {
+    ptrdiff_t offsets[horizonDirections * horizonSteps];
+    float inverseDistances[horizonDirections * horizonSteps];
+};
+
+// One set for the batched pack kernels; inputs are in the argument order of packNmo (NOHQ, SMDI, AS) or packBcr
+// (CO, SMDI)
+struct PackJob {
+    BYTE* out;
+    const BYTE* inputs[3];
+    size_t pixels;
+};
+
+void packNmoScalar(BYTE* out, const BYTE* nohq, const BYTE* smdi, const BYTE* as, size_t pixels);
+void packBcrScalar(BYTE* out, const BYTE* co, const BYTE* smdi, size_t pixels);
+void horizonAoScalar(float* out, const float* heights, const HorizonSamples& samples, size_t pixels);
+void decodeBcChannelScalar(BYTE* out, ptrdiff_t pitch, size_t step, const BYTE* blocks, size_t blockCount, bool bc3, unsigned channel);
+void packNmoBatchScalar(const PackJob* jobs, size_t count);
+void packBcrBatchScalar(const PackJob* jobs, size_t count);
+void sha256BlocksScalar(uint32_t* hash, const BYTE* blocks, size_t count);
+
+#ifdef KERNELS_X86
+void packNmoSse2(BYTE* out, const BYTE* nohq, const BYTE* smdi, const BYTE* as, size_t pixels);
+void packBcrSse2(BYTE* out, const BYTE* co, const BYTE* smdi, size_t pixels);
+void horizonAoSse2(float* out, const float* heights, const HorizonSamples& samples, size_t pixels);
+void decodeBcChannelSsse3(BYTE* out, ptrdiff_t pitch, size_t step, const BYTE* blocks, size_t blockCount, bool bc3, unsigned channel);
+void packNmoAvx2(BYTE* out, const BYTE* nohq, const BYTE* smdi, const BYTE* as, size_t pixels);
+void packBcrAvx2(BYTE* out, const BYTE* co, const BYTE* smdi, size_t pixels);
+void horizonAoAvx2(float* out, const float* heights, const HorizonSamples& samples, size_t pixels);
+void packNmoAvx512(BYTE* out, const BYTE* nohq, const BYTE* smdi, const BYTE* as, size_t pixels);
+void packBcrAvx512(BYTE* out, const BYTE* co, const BYTE* smdi, size_t pixels);
+void packNmoBatchSse2(const PackJob* jobs, size_t count);
+void packBcrBatchSse2(const PackJob* jobs, size_t count);
+void packNmoBatchAvx2(const PackJob* jobs, size_t count);
+void packBcrBatchAvx2(const PackJob* jobs, size_t count);
+void packNmoBatchAvx512(const PackJob* jobs, size_t count);
+void packBcrBatchAvx512(const PackJob* jobs, size_t count);
+void sha256BlocksShaNi(uint32_t* hash, const BYTE* blocks, size_t count);
+#endif
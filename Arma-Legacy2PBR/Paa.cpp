@@ -0,0 +1,262 @@
+#include "Paa.h"
+#include "CpuDispatch.h"
+#include "Vfs.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+static const unsigned paaDxt1 = 0xFF01;
+static const unsigned paaDxt5 = 0xFF05;
+static const unsigned paaArgb8888 = 0x8888;
+
+struct PaaMip {
+    unsigned type = 0;
+    unsigned width = 0;
+    unsigned height = 0;
+    // DXT blocks or BGRA pixels, rows top-down
+    std::vector<BYTE> pixels;
+};
+
+// Runs of zero bytes extend a length by 255 each, the first non-zero byte ends it
+static bool readLzoLength(const BYTE*& in, const BYTE* end, size_t& length, size_t base) {
+    size_t extra = 0;
+    while (in < end && *in == 0) {
+        extra += 255;
+        ++in;
+    }
+    if (in >= end) {
+        return false;
+    }
+    length = base + extra + *in++;
+    return true;
+}
+
+bool decompressLzo(const BYTE* in, size_t inSize, BYTE* out, size_t outSize) {
+    const BYTE* end = in + inSize;
+    size_t written = 0;
+    size_t state = 0;
+    auto copyLiterals = [&](size_t count) {
+        if (size_t(end - in) < count || outSize - written < count) {
+            return false;
+        }
+        memcpy(out + written, in, count);
+        in += count;
+        written += count;
+        return true;
+    };
+    // Matches may overlap their own output, so they are copied byte by byte
+    auto copyMatch = [&](size_t distance, size_t length) {
+        if (distance == 0 || distance > written || outSize - written < length) {
+            return false;
+        }
+        for (size_t i = 0; i < length; ++i, ++written) {
+            out[written] = out[written - distance];
+        }
+        return true;
+    };
+
+    if (in < end && *in > 17) {
+        size_t count = size_t(*in++) - 17;
+        if (!copyLiterals(count)) {
+            return false;
+        }
+        state = count < 4 ? count : 4;
+    }
+    while (in < end) {
+        size_t token = *in++;
+        size_t distance = 0;
+        size_t length = 0;
+        size_t next = 0;
+        if (token < 16) {
+            if (state == 0) {
+                // Literal run
+                length = token + 3;
+                if (token == 0 && !readLzoLength(in, end, length, 18)) {
+                    return false;
+                }
+                if (!copyLiterals(length)) {
+                    return false;
+                }
+                state = 4;
+                continue;
+            }
+            if (in >= end) {
+                return false;
+            }
+            // Short matches right after literals: two bytes nearby, or three bytes 2 KB further back
+            distance = (token >> 2) + (size_t(*in++) << 2) + (state < 4 ? 1 : 0x801);
+            length = state < 4 ? 2 : 3;
+            next = token & 3;
+        }
+        else if (token >= 64) {
+            if (in >= end) {
+                return false;
+            }
+            distance = ((token >> 2) & 7) + (size_t(*in++) << 3) + 1;
+            length = (token >> 5) + 1;
+            next = token & 3;
+        }
+        else if (token >= 32) {
+            length = (token & 31) + 2;
+            if ((token & 31) == 0 && !readLzoLength(in, end, length, 33)) {
+                return false;
+            }
+            if (end - in < 2) {
+                return false;
+            }
+            size_t word = in[0] | (size_t(in[1]) << 8);
+            in += 2;
+            distance = (word >> 2) + 1;
+            next = word & 3;
+        }
+        else {
+            length = (token & 7) + 2;
+            if ((token & 7) == 0 && !readLzoLength(in, end, length, 9)) {
+                return false;
+            }
+            if (end - in < 2) {
+                return false;
+            }
+            size_t word = in[0] | (size_t(in[1]) << 8);
+            in += 2;
+            distance = ((token & 8) << 11) + (word >> 2);
+            if (distance == 0) {
+                // End of stream marker
+                return written == outSize;
+            }
+            distance += 0x4000;
+            next = word & 3;
+        }
+        if (!copyMatch(distance, length) || !copyLiterals(next)) {
+            return false;
+        }
+        state = next;
+    }
+    return false;
+}
+
+static unsigned readLe16(const BYTE* data) {
+    return data[0] | (unsigned(data[1]) << 8);
+}
+
+// Type tag, tagged blocks ("GGAT" + name + length: average color, max color, mip offsets), palette, then the mips
+// from the largest: width, height, 24-bit size and data. The top bit of a DXT mip's width marks LZO compression
+static bool readTopMip(const BYTE* data, size_t size, PaaMip& mip) {
+    if (size < 2) {
+        return false;
+    }
+    mip.type = readLe16(data);
+    size_t position = 2;
+    while (size - position >= 12 && memcmp(data + position, "GGAT", 4) == 0) {
+        uint32_t length = data[position + 8] | (uint32_t(data[position + 9]) << 8) | (uint32_t(data[position + 10]) << 16) |
+            (uint32_t(data[position + 11]) << 24);
+        if (length > size - position - 12) {
+            return false;
+        }
+        position += 12 + length;
+    }
+    if (size - position < 2 || size_t(readLe16(data + position)) * 3 > size - position - 2) {
+        return false;
+    }
+    position += 2 + size_t(readLe16(data + position)) * 3;
+    if (size - position < 7) {
+        return false;
+    }
+    unsigned width = readLe16(data + position);
+    unsigned height = readLe16(data + position + 2);
+    size_t dataSize = data[position + 4] | (size_t(data[position + 5]) << 8) | (size_t(data[position + 6]) << 16);
+    position += 7;
+    bool lzo = (width & 0x8000) != 0;
+    mip.width = width & 0x7FFF;
+    mip.height = height;
+    if (mip.width == 0 || mip.height == 0 || dataSize > size - position) {
+        return false;
+    }
+    size_t blocks = size_t((mip.width + 3) / 4) * ((mip.height + 3) / 4);
+    size_t expected = mip.type == paaDxt1 ? blocks * 8 : mip.type == paaDxt5 ? blocks * 16 :
+        mip.type == paaArgb8888 ? size_t(mip.width) * mip.height * 4 : 0;
+    if (expected == 0) {
+        return false;
+    }
+    mip.pixels.resize(expected);
+    const BYTE* source = data + position;
+    if (lzo) {
+        return decompressLzo(source, dataSize, mip.pixels.data(), expected);
+    }
+    if (dataSize == expected) {
+        memcpy(mip.pixels.data(), source, expected);
+        return true;
+    }
+    return mip.type == paaArgb8888 && decompressLzss(source, dataSize, mip.pixels.data(), expected);
+}
+
+// Decodes channel of every block into rows of a plane padded to whole blocks, step bytes between pixels
+static void decodeBlocks(const PaaMip& mip, unsigned channel, BYTE* plane, size_t step) {
+    bool bc3 = mip.type == paaDxt5;
+    size_t blocksPerRow = (mip.width + 3) / 4;
+    size_t blockRows = (mip.height + 3) / 4;
+    ptrdiff_t pitch = ptrdiff_t(blocksPerRow * 4 * step);
+    const KernelTable& table = kernels();
+    for (size_t row = 0; row < blockRows; ++row) {
+        table.decodeBcChannel(plane + ptrdiff_t(row * 4) * pitch, pitch, step, mip.pixels.data() + row * blocksPerRow * (bc3 ? 16 : 8),
+            blocksPerRow, bc3, channel);
+    }
+}
+
+FIBITMAP* decodePaa(const BYTE* data, size_t size) {
+    PaaMip mip;
+    if (!readTopMip(data, size, mip)) {
+        return nullptr;
+    }
+    FIBITMAP* dib = FreeImage_Allocate(mip.width, mip.height, 32);
+    if (!dib) {
+        return nullptr;
+    }
+    size_t paddedWidth = mip.type == paaArgb8888 ? mip.width : (mip.width + 3) / 4 * 4;
+    const BYTE* source = mip.pixels.data();
+    std::vector<BYTE> decoded;
+    if (mip.type != paaArgb8888) {
+        decoded.resize(paddedWidth * ((mip.height + 3) / 4 * 4) * 4);
+        for (unsigned channel = 0; channel < 4; ++channel) {
+            decodeBlocks(mip, channel, decoded.data() + channel, 4);
+        }
+        source = decoded.data();
+    }
+    // PAA rows run top-down, DIB rows bottom-up
+    for (unsigned y = 0; y < mip.height; ++y) {
+        memcpy(FreeImage_GetScanLine(dib, int(mip.height - 1 - y)), source + size_t(y) * paddedWidth * 4, size_t(mip.width) * 4);
+    }
+    return dib;
+}
+
+FIBITMAP* decodePaaChannel(const BYTE* data, size_t size, unsigned channel) {
+    PaaMip mip;
+    if (channel > 3 || !readTopMip(data, size, mip)) {
+        return nullptr;
+    }
+    FIBITMAP* dib = FreeImage_Allocate(mip.width, mip.height, 32);
+    if (!dib) {
+        return nullptr;
+    }
+    size_t paddedWidth = mip.width;
+    const BYTE* plane = mip.pixels.data() + channel;
+    size_t step = 4;
+    std::vector<BYTE> decoded;
+    if (mip.type != paaArgb8888) {
+        paddedWidth = (mip.width + 3) / 4 * 4;
+        decoded.resize(paddedWidth * ((mip.height + 3) / 4 * 4));
+        decodeBlocks(mip, channel, decoded.data(), 1);
+        plane = decoded.data();
+        step = 1;
+    }
+    for (unsigned y = 0; y < mip.height; ++y) {
+        const BYTE* source = plane + size_t(y) * paddedWidth * step;
+        uint32_t* row = reinterpret_cast<uint32_t*>(FreeImage_GetScanLine(dib, int(mip.height - 1 - y)));
+        for (unsigned x = 0; x < mip.width; ++x) {
+            row[x] = 0xFF000000u | (uint32_t(source[x * step]) * 0x010101u);
+        }
+    }
+    return dib;
+}
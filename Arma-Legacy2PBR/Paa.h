@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+#include <FreeImage.h>
+
+// Arma PAA textures: DXT1 and DXT5 (stored or LZO-compressed) and ARGB8888 (stored or LZSS-compressed). Only the
+// top mip is read; other pixel formats return nullptr
+FIBITMAP* decodePaa(const BYTE* data, size_t size);
+// One channel (0 B, 1 G, 2 R, 3 A) as a 32-bit gray bitmap, for roles that need no other. DXT blocks are decoded
+// for that channel alone into an 8-bit plane, which is then widened
+FIBITMAP* decodePaaChannel(const BYTE* data, size_t size, unsigned channel);
+
+// LZO1X, the compression of DXT mips; false when the input is damaged or does not give exactly outSize bytes
+bool decompressLzo(const BYTE* in, size_t inSize, BYTE* out, size_t outSize);
@@ -0,0 +1,283 @@
+#include "ProcessPool.h"
+
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <csignal>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+extern char** environ;
+#endif
+
+namespace fs = std::filesystem;
+
+// Pipe ends are inheritable only between creation and spawn; serializing that keeps them out of sibling workers,
+// which would otherwise hold a crashed worker's pipe open
+static std::mutex spawnMutex;
+
+std::string makeSharedBufferName(unsigned slot, unsigned long long sequence) {
+#ifdef _WIN32
+    return "Local\\Legacy2PBR-" + std::to_string(GetCurrentProcessId()) + "-" + std::to_string(slot) + "-" + std::to_string(sequence);
+#else
+    return "/l2p-" + std::to_string(getpid()) + "-" + std::to_string(slot) + "-" + std::to_string(sequence);
+#endif
+}
+
+static bool mapSharedBuffer(const std::string& name, size_t size, bool create, SharedBuffer& buffer) {
+    buffer = SharedBuffer();
+    if (size == 0) {
+        return false;
+    }
+#ifdef _WIN32
+    std::wstring wideName(name.begin(), name.end());
+    HANDLE mapping = create ?
+        CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, DWORD(uint64_t(size) >> 32), DWORD(size & 0xFFFFFFFF), wideName.c_str()) :
+        OpenFileMappingW(FILE_MAP_READ | FILE_MAP_WRITE, FALSE, wideName.c_str());
+    if (!mapping) {
+        return false;
+    }
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, size);
+    if (!view) {
+        CloseHandle(mapping);
+        return false;
+    }
+    buffer.mapping = mapping;
+#else
+    int fd = shm_open(name.c_str(), create ? O_RDWR | O_CREAT | O_EXCL : O_RDWR, 0600);
+    if (fd < 0) {
+        return false;
+    }
+    if (create && ftruncate(fd, static_cast<off_t>(size)) != 0) {
+        close(fd);
+        shm_unlink(name.c_str());
+        return false;
+    }
+    void* view = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (view == MAP_FAILED) {
+        if (create) {
+            shm_unlink(name.c_str());
+        }
+        return false;
+    }
+#endif
+    buffer.data = static_cast<BYTE*>(view);
+    buffer.size = size;
+    buffer.name = name;
+    return true;
+}
+
+bool createSharedBuffer(const std::string& name, size_t size, SharedBuffer& buffer) {
+    return mapSharedBuffer(name, size, true, buffer);
+}
+
+bool openSharedBuffer(const std::string& name, size_t size, SharedBuffer& buffer) {
+    return mapSharedBuffer(name, size, false, buffer);
+}
+
+void closeSharedBuffer(SharedBuffer& buffer) {
+    if (buffer.data) {
+#ifdef _WIN32
+        UnmapViewOfFile(buffer.data);
+        CloseHandle(buffer.mapping);
+#else
+        munmap(buffer.data, buffer.size);
+#endif
+    }
+    buffer = SharedBuffer();
+}
+
+void removeSharedBuffer(const std::string& name) {
+#ifdef _WIN32
+    (void)name;
+#else
+    shm_unlink(name.c_str());
+#endif
+}
+
+std::string getExecutablePath(const char* argv0) {
+#ifdef _WIN32
+    (void)argv0;
+    std::wstring path(MAX_PATH, L'\0');
+    DWORD length = GetModuleFileNameW(nullptr, path.data(), DWORD(path.size()));
+    path.resize(length);
+    return fs::path(path).string();
+#else
+    std::error_code error;
+    fs::path self = fs::read_symlink("/proc/self/exe", error);
+    return error ? fs::absolute(argv0).string() : self.string();
+#endif
+}
+
+bool spawnWorker(const std::string& executable, const std::vector<std::string>& arguments, WorkerProcess& worker) {
+    worker = WorkerProcess();
+    std::lock_guard<std::mutex> lock(spawnMutex);
+#ifdef _WIN32
+    SECURITY_ATTRIBUTES inherit = { sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE };
+    HANDLE childInput = nullptr, parentInput = nullptr, parentOutput = nullptr, childOutput = nullptr;
+    if (!CreatePipe(&childInput, &parentInput, &inherit, 0) || !CreatePipe(&parentOutput, &childOutput, &inherit, 0)) {
+        return false;
+    }
+    SetHandleInformation(parentInput, HANDLE_FLAG_INHERIT, 0);
+    SetHandleInformation(parentOutput, HANDLE_FLAG_INHERIT, 0);
+
+    std::wstring commandLine = L"\"" + fs::path(executable).wstring() + L"\"";
+    for (const auto& argument : arguments) {
+        commandLine += L" \"" + fs::path(argument).wstring() + L"\"";
+    }
+    STARTUPINFOW startup = {};
+    startup.cb = sizeof(startup);
+    startup.dwFlags = STARTF_USESTDHANDLES;
+    startup.hStdInput = childInput;
+    startup.hStdOutput = childOutput;
+    startup.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+    PROCESS_INFORMATION info = {};
+    BOOL created = CreateProcessW(nullptr, commandLine.data(), nullptr, nullptr, TRUE, 0, nullptr, nullptr, &startup, &info);
+    CloseHandle(childInput);
+    CloseHandle(childOutput);
+    if (!created) {
+        CloseHandle(parentInput);
+        CloseHandle(parentOutput);
+        return false;
+    }
+    CloseHandle(info.hThread);
+    worker.process = info.hProcess;
+    worker.input = parentInput;
+    worker.output = parentOutput;
+#else
+    // A write to a crashed worker must fail with EPIPE instead of killing the parent
+    signal(SIGPIPE, SIG_IGN);
+    int toChild[2], fromChild[2];
+    if (pipe(toChild) != 0) {
+        return false;
+    }
+    if (pipe(fromChild) != 0) {
+        close(toChild[0]);
+        close(toChild[1]);
+        return false;
+    }
+    fcntl(toChild[1], F_SETFD, FD_CLOEXEC);
+    fcntl(fromChild[0], F_SETFD, FD_CLOEXEC);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, toChild[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, fromChild[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addclose(&actions, toChild[0]);
+    posix_spawn_file_actions_addclose(&actions, fromChild[1]);
+
+    std::vector<char*> argv = { const_cast<char*>(executable.c_str()) };
+    for (const auto& argument : arguments) {
+        argv.push_back(const_cast<char*>(argument.c_str()));
+    }
+    argv.push_back(nullptr);
+    pid_t pid = -1;
+    int result = posix_spawn(&pid, executable.c_str(), &actions, nullptr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(toChild[0]);
+    close(fromChild[1]);
+    if (result != 0) {
+        close(toChild[1]);
+        close(fromChild[0]);
+        return false;
+    }
+    worker.pid = pid;
+    worker.input = toChild[1];
+    worker.output = fromChild[0];
+#endif
+    return true;
+}
+
+bool sendLine(WorkerProcess& worker, const std::string& line) {
+    std::string message = line + "\n";
+    const char* data = message.data();
+    size_t remaining = message.size();
+    while (remaining > 0) {
+#ifdef _WIN32
+        DWORD written = 0;
+        if (!WriteFile(worker.input, data, DWORD(remaining), &written, nullptr) || written == 0) {
+            return false;
+        }
+#else
+        ssize_t written = write(worker.input, data, remaining);
+        if (written <= 0) {
+            return false;
+        }
+#endif
+        data += written;
+        remaining -= size_t(written);
+    }
+    return true;
+}
+
+bool readLine(WorkerProcess& worker, std::string& line) {
+    for (;;) {
+        size_t end = worker.pending.find('\n');
+        if (end != std::string::npos) {
+            line = worker.pending.substr(0, end);
+            worker.pending.erase(0, end + 1);
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            return true;
+        }
+        char chunk[4096];
+#ifdef _WIN32
+        DWORD received = 0;
+        if (!ReadFile(worker.output, chunk, sizeof(chunk), &received, nullptr) || received == 0) {
+            return false;
+        }
+#else
+        ssize_t received = read(worker.output, chunk, sizeof(chunk));
+        if (received <= 0) {
+            return false;
+        }
+#endif
+        worker.pending.append(chunk, size_t(received));
+    }
+}
+
+std::string stopWorker(WorkerProcess& worker) {
+    std::string status = "exited";
+#ifdef _WIN32
+    if (worker.input) {
+        CloseHandle(worker.input);
+    }
+    if (worker.output) {
+        CloseHandle(worker.output);
+    }
+    if (worker.process) {
+        WaitForSingleObject(worker.process, INFINITE);
+        DWORD code = 0;
+        GetExitCodeProcess(worker.process, &code);
+        status = "exit code " + std::to_string(code);
+        CloseHandle(worker.process);
+    }
+#else
+    if (worker.input >= 0) {
+        close(worker.input);
+    }
+    if (worker.output >= 0) {
+        close(worker.output);
+    }
+    if (worker.pid > 0) {
+        int result = 0;
+        if (waitpid(worker.pid, &result, 0) == worker.pid) {
+            status = WIFSIGNALED(result) ? "signal " + std::to_string(WTERMSIG(result)) :
+                "exit code " + std::to_string(WEXITSTATUS(result));
+        }
+    }
+#endif
+    worker = WorkerProcess();
+    return status;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <FreeImage.h>
+
+// Named shared memory a worker process packs into and the parent encodes from
+struct SharedBuffer {
+    BYTE* data = nullptr;
+    size_t size = 0;
+    std::string name;
+#ifdef _WIN32
+    void* mapping = nullptr;
+#endif
+};
+
+std::string makeSharedBufferName(unsigned slot, unsigned long long sequence);
+bool createSharedBuffer(const std::string& name, size_t size, SharedBuffer& buffer);
+bool openSharedBuffer(const std::string& name, size_t size, SharedBuffer& buffer);
+void closeSharedBuffer(SharedBuffer& buffer);
+// Drops the name so a crashed worker does not leak the memory (no-op on Windows, where it goes with the last handle)
+void removeSharedBuffer(const std::string& name);
+
+// A child process talking line by line over its stdin/stdout
+struct WorkerProcess {
+#ifdef _WIN32
+    void* process = nullptr;
+    void* input = nullptr;
+    void* output = nullptr;
+#else
+    int pid = -1;
+    int input = -1;
+    int output = -1;
+#endif
+    std::string pending;
+};
+
+std::string getExecutablePath(const char* argv0);
+bool spawnWorker(const std::string& executable, const std::vector<std::string>& arguments, WorkerProcess& worker);
+bool sendLine(WorkerProcess& worker, const std::string& line);
+// False on end of stream, i.e. the worker exited or crashed
+bool readLine(WorkerProcess& worker, std::string& line);
+// Closes the pipes and reaps the process; returns a description of how it ended
+std::string stopWorker(WorkerProcess& worker);
@@ -0,0 +1,319 @@
+#include "Profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <csignal>
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+static thread_local const char* stageTag = nullptr;
+static thread_local const char* setTag = nullptr;
+
+ProfileStage::ProfileStage(const char* stage, const char* set) : outerStage(stageTag), outerSet(setTag) {
+    stageTag = stage;
+    if (set) {
+        setTag = set;
+    }
+}
+
+ProfileStage::~ProfileStage() {
+    stageTag = outerStage;
+    setTag = outerSet;
+}
+
+void setProfileStage(const char* stage) {
+    stageTag = stage;
+}
+
+ProfileTags getProfileTags() {
+    return { stageTag, setTag };
+}
+
+void setProfileTags(const ProfileTags& tags) {
+    stageTag = tags.stage;
+    setTag = tags.set;
+}
+
+#ifdef _WIN32
+
+bool startProfiler(const std::string&, unsigned, bool) {
+    std::cerr << "The sampling profiler needs SIGPROF and is not available on Windows" << std::endl;
+    return false;
+}
+
+bool stopProfiler(const std::string&, bool) {
+    return false;
+}
+
+#else
+
+static const int maxFrames = 64;
+// The handler and the backtrace call it makes
+static const int handlerFrames = 2;
+// Samples in flight between a signal and the collector; at 20 ms per drain this covers thousands of threads
+static const size_t ringSize = 4096;
+
+struct Sample {
+    std::atomic<bool> ready;
+    const char* stage;
+    char set[64];
+    int depth;
+    void* frames[maxFrames];
+};
+
+// Signals claim slots at head, in order; the collector frees them at tail, in order, once each is filled
+static Sample* ring = nullptr;
+static std::atomic<uint64_t> head{ 0 };
+static std::atomic<uint64_t> tail{ 0 };
+static std::atomic<uint64_t> dropped{ 0 };
+
+// Raw stacks (tags and return addresses) and how often each was seen; symbolized only when written
+static std::unordered_map<std::string, uint64_t> stacks;
+static uint64_t sampleCount = 0;
+static std::thread collector;
+static std::mutex collectorMutex;
+static std::condition_variable collectorWake;
+static bool collectorStopping = false;
+
+// Async-signal-safe apart from backtrace, whose only unsafe step (loading the unwinder) is done by startProfiler
+static void onProfileSignal(int) {
+    int savedErrno = errno;
+    uint64_t index = head.load(std::memory_order_relaxed);
+    do {
+        if (index - tail.load(std::memory_order_acquire) >= ringSize) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            errno = savedErrno;
+            return;
+        }
+    } while (!head.compare_exchange_weak(index, index + 1, std::memory_order_relaxed));
+    Sample& sample = ring[index % ringSize];
+    sample.depth = backtrace(sample.frames, maxFrames);
+    sample.stage = stageTag;
+    size_t length = 0;
+    for (const char* set = setTag; set && set[length] && length + 1 < sizeof(sample.set); ++length) {
+        sample.set[length] = set[length];
+    }
+    sample.set[length] = '\0';
+    sample.ready.store(true, std::memory_order_release);
+    errno = savedErrno;
+}
+
+static void drainSamples() {
+    for (;;) {
+        uint64_t index = tail.load(std::memory_order_relaxed);
+        Sample& sample = ring[index % ringSize];
+        if (!sample.ready.load(std::memory_order_acquire)) {
+            return;
+        }
+        std::string key = std::string(sample.stage ? sample.stage : "other") + '\x1f' + sample.set + '\x1f';
+        int first = std::min(handlerFrames, sample.depth);
+        key.append(reinterpret_cast<const char*>(sample.frames + first), size_t(sample.depth - first) * sizeof(void*));
+        ++stacks[key];
+        ++sampleCount;
+        sample.ready.store(false, std::memory_order_relaxed);
+        tail.store(index + 1, std::memory_order_release);
+    }
+}
+
+static void collectSamples() {
+    ProfileStage stage("profiler");
+    std::unique_lock<std::mutex> lock(collectorMutex);
+    while (!collectorStopping) {
+        collectorWake.wait_for(lock, std::chrono::milliseconds(20));
+        drainSamples();
+    }
+}
+
+// Folded stacks summed over the part files of the worker processes
+static void mergeParts(const std::string& file, std::map<std::string, uint64_t>& folded, bool remove) {
+    fs::path target = fs::absolute(file);
+    std::string prefix = target.filename().string() + ".part";
+    std::error_code error;
+    std::vector<fs::path> parts;
+    for (const auto& entry : fs::directory_iterator(target.parent_path(), error)) {
+        if (entry.path().filename().string().rfind(prefix, 0) == 0) {
+            parts.push_back(entry.path());
+        }
+    }
+    for (const auto& part : parts) {
+        std::ifstream in(part);
+        std::string line;
+        while (std::getline(in, line)) {
+            size_t space = line.find_last_of(' ');
+            if (space != std::string::npos) {
+                folded[line.substr(0, space)] += std::strtoull(line.c_str() + space + 1, nullptr, 10);
+            }
+        }
+        in.close();
+        if (remove) {
+            fs::remove(part, error);
+        }
+    }
+}
+
+static std::string getPartPath(const std::string& file) {
+    return file + ".part" + std::to_string(getpid());
+}
+
+bool startProfiler(const std::string& file, unsigned hz, bool part) {
+    if (hz == 0 || hz > 10000) {
+        std::cerr << "Profiling rate must be between 1 and 10000 Hz" << std::endl;
+        return false;
+    }
+    if (!part) {
+        std::map<std::string, uint64_t> stale;
+        mergeParts(file, stale, true);
+    }
+    // Never freed: after stopping, a handler may still be running on another thread
+    ring = new Sample[ringSize];
+    for (size_t i = 0; i < ringSize; ++i) {
+        ring[i].ready.store(false);
+    }
+    // The first backtrace loads the unwinder, which must not happen inside the handler
+    void* warmUp[4];
+    backtrace(warmUp, 4);
+    collectorStopping = false;
+    collector = std::thread(collectSamples);
+
+    struct sigaction action = {};
+    action.sa_handler = onProfileSignal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    struct itimerval timer = {};
+    timer.it_interval.tv_sec = time_t(1 / hz);
+    timer.it_interval.tv_usec = suseconds_t(1000000 / hz % 1000000);
+    timer.it_value = timer.it_interval;
+    if (sigaction(SIGPROF, &action, nullptr) != 0 || setitimer(ITIMER_PROF, &timer, nullptr) != 0) {
+        std::cerr << "Failed to start the sampling profiler" << std::endl;
+        stopProfiler(std::string(), true);
+        return false;
+    }
+    return true;
+}
+
+static std::string nameFrame(void* address, bool innermost) {
+    // Return addresses point past the call, which may already be the next function
+    const char* lookup = static_cast<const char*>(address) - (innermost ? 0 : 1);
+    Dl_info info = {};
+    std::string name;
+    if (dladdr(lookup, &info) && info.dli_sname) {
+        int status = 0;
+        char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+        name = status == 0 && demangled ? demangled : info.dli_sname;
+        std::free(demangled);
+        // Without the parameter list (and a trailing const), which would make most frames too wide to read
+        size_t end = name.size();
+        if (name.size() > 6 && name.compare(name.size() - 6, 6, " const") == 0) {
+            end -= 6;
+        }
+        if (end > 0 && name[end - 1] == ')') {
+            int nesting = 0;
+            for (size_t i = end; i-- > 0;) {
+                nesting += name[i] == ')' ? 1 : name[i] == '(' ? -1 : 0;
+                if (nesting == 0) {
+                    name.resize(i);
+                    break;
+                }
+            }
+        }
+    }
+    else {
+        char offset[32];
+        uintptr_t base = reinterpret_cast<uintptr_t>(info.dli_fbase);
+        snprintf(offset, sizeof(offset), "+0x%llx", static_cast<unsigned long long>(reinterpret_cast<uintptr_t>(lookup) - base));
+        name = (info.dli_fname ? fs::path(info.dli_fname).filename().string() : std::string("?")) + offset;
+    }
+    // ';' separates frames and the last space the count
+    std::replace(name.begin(), name.end(), ';', ':');
+    std::replace(name.begin(), name.end(), '\n', ' ');
+    return name;
+}
+
+bool stopProfiler(const std::string& file, bool part) {
+    struct itimerval timer = {};
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    signal(SIGPROF, SIG_IGN);
+    {
+        std::lock_guard<std::mutex> lock(collectorMutex);
+        collectorStopping = true;
+    }
+    collectorWake.notify_all();
+    if (collector.joinable()) {
+        collector.join();
+    }
+    drainSamples();
+    if (file.empty()) {
+        return false;
+    }
+
+    std::map<std::string, uint64_t> folded;
+    std::unordered_map<void*, std::string> names;
+    for (const auto& [key, count] : stacks) {
+        size_t stageEnd = key.find('\x1f');
+        size_t setEnd = key.find('\x1f', stageEnd + 1);
+        std::string line = key.substr(0, stageEnd);
+        if (setEnd > stageEnd + 1) {
+            line += ';' + key.substr(stageEnd + 1, setEnd - stageEnd - 1);
+        }
+        size_t depth = (key.size() - setEnd - 1) / sizeof(void*);
+        std::vector<void*> frames(depth);
+        memcpy(frames.data(), key.data() + setEnd + 1, depth * sizeof(void*));
+        // backtrace lists the innermost frame first, folded stacks the outermost
+        for (size_t i = depth; i-- > 0;) {
+            auto name = names.find(frames[i]);
+            if (name == names.end()) {
+                name = names.emplace(frames[i], nameFrame(frames[i], i == 0)).first;
+            }
+            line += ';' + name->second;
+        }
+        folded[line] += count;
+    }
+    uint64_t samples = sampleCount;
+    if (!part) {
+        mergeParts(file, folded, true);
+    }
+
+    std::string path = part ? getPartPath(file) : file;
+    std::ofstream out(path, std::ios::trunc);
+    for (const auto& [line, count] : folded) {
+        out << line << ' ' << count << '\n';
+    }
+    if (!out) {
+        std::cerr << "Failed to write profile: " << path << std::endl;
+        return false;
+    }
+    if (!part) {
+        uint64_t total = 0;
+        for (const auto& entry : folded) {
+            total += entry.second;
+        }
+        std::cout << "Profile: " << total << " samples (" << samples << " in this process, " << dropped.load()
+            << " dropped) written to: " << path << std::endl;
+    }
+    return true;
+}
+
+#endif
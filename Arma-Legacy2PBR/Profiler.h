@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+
+// --profile: samples the stacks of all threads on SIGPROF (CPU time, so waiting threads are not sampled) and writes
+// them as folded stacks, "stage;set;outermost;...;innermost count", for flamegraph.pl or speedscope. Frames are
+// named by dladdr, so a Linux build linked with -rdynamic shows function names; otherwise module+offset, which
+// addr2line resolves. POSIX only: elsewhere startProfiler says so and returns false
+
+// A worker process of --isolate profiles into a part file next to the parent's; the parent sums the parts into
+// its own profile when it writes it, and removes stale parts when it starts
+bool startProfiler(const std::string& file, unsigned hz, bool part);
+bool stopProfiler(const std::string& file, bool part);
+
+// Tags the calling thread with a pipeline stage and, unless null, a set until the scope ends; the outer tags come
+// back afterwards. Two thread-local stores, so the scopes cost nothing worth measuring when profiling is off.
+// Both strings must outlive the scope
+struct ProfileStage {
+    ProfileStage(const char* stage, const char* set = nullptr);
+    ~ProfileStage();
+    const char* outerStage;
+    const char* outerSet;
+};
+
+// Moves the thread to the next stage of the same scope, e.g. from decoding to packing
+void setProfileStage(const char* stage);
+
+// For threads a tagged thread starts: they take over its tags
+struct ProfileTags {
+    const char* stage;
+    const char* set;
+};
+
+ProfileTags getProfileTags();
+void setProfileTags(const ProfileTags& tags);
@@ -0,0 +1,123 @@
+#include "ReadAhead.h"
+#include "Profiler.h"
+#include "FileIO.h"
+
+#include <algorithm>
+#include <chrono>
+
+std::vector<std::string> orderByDiskLocation(const std::vector<std::string>& files) {
+    std::vector<std::pair<uint64_t, std::string>> located;
+    bool physical = true;
+    for (const auto& file : files) {
+        uint64_t offset = 0;
+        if (physical && !getPhysicalOffset(file, offset)) {
+            physical = false;
+        }
+        located.push_back({ offset, file });
+    }
+    // Extent offsets and file indexes cannot be mixed in one order
+    if (!physical) {
+        for (auto& entry : located) {
+            entry.first = getFileIndex(entry.second);
+        }
+    }
+    std::stable_sort(located.begin(), located.end(), [](const auto& a, const auto& b) {
+        return a.first < b.first;
+    });
+    std::vector<std::string> ordered;
+    for (auto& entry : located) {
+        ordered.push_back(std::move(entry.second));
+    }
+    return ordered;
+}
+
+static void readFiles(ReadAhead& readAhead) {
+    ProfileStage stage("read-ahead");
+    for (;;) {
+        std::string file;
+        {
+            std::unique_lock<std::mutex> lock(readAhead.mutex);
+            // Stay within the read-ahead limit unless a decoder is blocked on a file still to come
+            readAhead.changed.wait(lock, [&]() {
+                return readAhead.stopping || readAhead.bufferedBytes < readAhead.limitBytes || readAhead.waiting > 0;
+            });
+            if (readAhead.stopping || readAhead.nextFile >= readAhead.files.size()) {
+                return;
+            }
+            file = readAhead.files[readAhead.nextFile];
+        }
+
+        trackInputResidency(file);
+        std::vector<BYTE> data;
+        auto start = std::chrono::steady_clock::now();
+        bool read = readFile(file, data);
+        ioStats().readAheadMicroseconds += std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count();
+
+        std::lock_guard<std::mutex> lock(readAhead.mutex);
+        if (read) {
+            ioStats().readAheadBytes += data.size();
+            readAhead.bufferedBytes += data.size();
+            readAhead.buffers[file] = std::move(data);
+        }
+        else {
+            readAhead.failed.insert(file);
+        }
+        ++readAhead.nextFile;
+        readAhead.changed.notify_all();
+    }
+}
+
+void startReadAhead(ReadAhead& readAhead, const std::vector<std::string>& files, uint64_t limitBytes) {
+    readAhead.files = files;
+    for (size_t i = 0; i < files.size(); ++i) {
+        readAhead.positions.emplace(files[i], i);
+    }
+    readAhead.limitBytes = limitBytes;
+    readAhead.reader = std::thread(readFiles, std::ref(readAhead));
+}
+
+bool takeReadAhead(ReadAhead& readAhead, const std::string& filename, std::vector<BYTE>& data) {
+    std::unique_lock<std::mutex> lock(readAhead.mutex);
+    auto position = readAhead.positions.find(filename);
+    if (position == readAhead.positions.end()) {
+        return false;
+    }
+    // Files put by another thread may rehash positions while this one waits
+    size_t index = position->second;
+    ++readAhead.waiting;
+    readAhead.changed.notify_all();
+    readAhead.changed.wait(lock, [&]() {
+        return readAhead.stopping || readAhead.nextFile > index || readAhead.buffers.count(filename);
+    });
+    --readAhead.waiting;
+    auto buffer = readAhead.buffers.find(filename);
+    if (buffer == readAhead.buffers.end()) {
+        return false;
+    }
+    data = std::move(buffer->second);
+    readAhead.buffers.erase(buffer);
+    readAhead.positions.erase(filename);
+    readAhead.bufferedBytes -= data.size();
+    readAhead.changed.notify_all();
+    return true;
+}
+
+void putReadAhead(ReadAhead& readAhead, const std::string& filename, std::vector<BYTE> data) {
+    std::lock_guard<std::mutex> lock(readAhead.mutex);
+    readAhead.positions.emplace(filename, readAhead.files.size());
+    readAhead.bufferedBytes += data.size();
+    readAhead.buffers[filename] = std::move(data);
+    readAhead.changed.notify_all();
+}
+
+void stopReadAhead(ReadAhead& readAhead) {
+    {
+        std::lock_guard<std::mutex> lock(readAhead.mutex);
+        readAhead.stopping = true;
+        readAhead.changed.notify_all();
+    }
+    if (readAhead.reader.joinable()) {
+        readAhead.reader.join();
+    }
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <FreeImage.h>
+
+// One thread reads the input files in a fixed (disk) order; decoders take each file when it has arrived
+struct ReadAhead {
+    std::vector<std::string> files;
+    std::unordered_map<std::string, size_t> positions;
+    std::unordered_map<std::string, std::vector<BYTE>> buffers;
+    std::unordered_set<std::string> failed;
+    size_t nextFile = 0;
+    uint64_t bufferedBytes = 0;
+    uint64_t limitBytes = 0;
+    unsigned waiting = 0;
+    bool stopping = false;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::thread reader;
+};
+
+// Sorted by first physical extent when every file reports one, otherwise by inode / file index
+std::vector<std::string> orderByDiskLocation(const std::vector<std::string>& files);
+
+void startReadAhead(ReadAhead& readAhead, const std::vector<std::string>& files, uint64_t limitBytes);
+// Blocks until a scheduled file is read and moves its contents out; false when it is not scheduled or could not be read
+bool takeReadAhead(ReadAhead& readAhead, const std::string& filename, std::vector<BYTE>& data);
+// Hands over a file read elsewhere (an archive stream); it is taken like a scheduled file that has arrived
+void putReadAhead(ReadAhead& readAhead, const std::string& filename, std::vector<BYTE> data);
+void stopReadAhead(ReadAhead& readAhead);
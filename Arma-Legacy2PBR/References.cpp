@@ -0,0 +1,169 @@
+#include "References.h"
+#include "FileIO.h"
+#include "Vfs.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+static std::string toLower(std::string text) {
+    std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c) { return char(tolower(c)); });
+    return text;
+}
+
+std::string getTextureKey(const std::string& path) {
+    size_t start = path.find_last_of("\\/");
+    std::string name = path.substr(start == std::string::npos ? 0 : start + 1);
+    size_t dot = name.find_last_of('.');
+    return toLower(dot == std::string::npos ? name : name.substr(0, dot));
+}
+
+static bool endsWith(const std::string& text, const char* suffix) {
+    size_t length = strlen(suffix);
+    return text.size() >= length && text.compare(text.size() - length, length, suffix) == 0;
+}
+
+// Texture and material paths are plain strings in every format we read: null-terminated in ODOL/MLOD texture and
+// material tables and in rapified config.bin, quoted in config.cpp and .rvmat. Anything that is not part of a
+// path ends a token, so one pass over the bytes finds them all.
+static void collectPaths(const BYTE* data, size_t size, std::vector<std::string>& textures, std::vector<std::string>& materials) {
+    std::string token;
+    for (size_t i = 0; i <= size; ++i) {
+        unsigned char c = i < size ? data[i] : 0;
+        bool pathChar = c >= 0x20 && c < 0x7F && c != '"' && c != '\'' && c != '=' && c != ',' && c != ';' &&
+            c != '{' && c != '}' && c != '[' && c != ']' && c != '(' && c != ')';
+        if (pathChar) {
+            token.push_back(char(c));
+            continue;
+        }
+        if (token.size() > 4) {
+            size_t first = token.find_first_not_of(' ');
+            size_t last = token.find_last_not_of(' ');
+            std::string path = toLower(token.substr(first, last - first + 1));
+            if (endsWith(path, ".paa") || endsWith(path, ".pac") || endsWith(path, ".tga") || endsWith(path, ".png") ||
+                endsWith(path, ".tif")) {
+                textures.push_back(path);
+            }
+            else if (endsWith(path, ".rvmat")) {
+                materials.push_back(path);
+            }
+        }
+        token.clear();
+    }
+}
+
+// A loose file, or a file inside a PBO when entry is set
+struct ScanSource {
+    std::string path;
+    const VfsEntry* entry = nullptr;
+};
+
+// Scans the files on several threads, adding texture keys and the paths of referenced materials
+static void scanFiles(const std::vector<ScanSource>& files, Vfs* vfs, unsigned threads, std::unordered_set<std::string>& textures,
+    std::unordered_set<std::string>* materials) {
+    std::atomic<size_t> next{ 0 };
+    std::mutex mutex;
+    auto scan = [&]() {
+        std::unordered_set<std::string> localTextures, localMaterials;
+        std::vector<BYTE> buffer;
+        std::vector<std::string> texturePaths, materialPaths;
+        for (size_t i = next++; i < files.size(); i = next++) {
+            const BYTE* data = nullptr;
+            size_t size = 0;
+            bool read = files[i].entry ? readVfsEntry(*vfs, *files[i].entry, buffer, data, size) : readFile(files[i].path, buffer);
+            if (!read) {
+                std::cerr << "Failed to read: " << files[i].path << std::endl;
+                continue;
+            }
+            if (!files[i].entry) {
+                data = buffer.data();
+                size = buffer.size();
+            }
+            texturePaths.clear();
+            materialPaths.clear();
+            collectPaths(data, size, texturePaths, materialPaths);
+            for (const auto& path : texturePaths) {
+                localTextures.insert(getTextureKey(path));
+            }
+            localMaterials.insert(materialPaths.begin(), materialPaths.end());
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        textures.insert(localTextures.begin(), localTextures.end());
+        if (materials) {
+            materials->insert(localMaterials.begin(), localMaterials.end());
+        }
+    };
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < std::max(1u, threads); ++i) {
+        workers.emplace_back(scan);
+    }
+    scan();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+// Configs keep most of their classes in #include'd headers, which are scanned like the configs themselves
+static bool isReferenceSource(const std::string& name) {
+    return endsWith(name, ".p3d") || endsWith(name, "config.cpp") || endsWith(name, "config.bin") || endsWith(name, ".hpp") ||
+        endsWith(name, ".h") || endsWith(name, ".inc");
+}
+
+std::unordered_set<std::string> scanTextureReferences(const fs::path& root, unsigned threads, Vfs* vfs) {
+    std::vector<ScanSource> sources;
+    std::unordered_map<std::string, std::vector<ScanSource>> materialFiles;
+    std::error_code error;
+    for (auto it = fs::recursive_directory_iterator(root, fs::directory_options::skip_permission_denied, error);
+        !error && it != fs::recursive_directory_iterator(); it.increment(error)) {
+        if (!it->is_regular_file(error)) {
+            continue;
+        }
+        std::string name = toLower(it->path().filename().string());
+        if (isReferenceSource(name)) {
+            sources.push_back({ it->path().string() });
+        }
+        else if (endsWith(name, ".rvmat")) {
+            materialFiles[getTextureKey(name)].push_back({ it->path().string() });
+        }
+    }
+    if (error) {
+        std::cerr << "Error reading directory: " << root.string() << std::endl;
+    }
+    if (vfs) {
+        for (const auto& file : vfs->entries) {
+            if (file.second.archive >= 0 && isReferenceSource(file.first)) {
+                sources.push_back({ file.first, &file.second });
+            }
+        }
+    }
+
+    std::unordered_set<std::string> textures, materials;
+    scanFiles(sources, vfs, threads, textures, &materials);
+
+    // Only materials something uses count; dead .rvmat files would otherwise keep their textures alive.
+    // The virtual file system resolves the exact path, loose folders fall back to the file name
+    std::vector<ScanSource> usedMaterials;
+    for (const auto& material : materials) {
+        const VfsEntry* entry = vfs ? findVfsEntry(*vfs, material) : nullptr;
+        if (entry) {
+            usedMaterials.push_back({ material, entry });
+            continue;
+        }
+        auto found = materialFiles.find(getTextureKey(material));
+        if (found != materialFiles.end()) {
+            usedMaterials.insert(usedMaterials.end(), found->second.begin(), found->second.end());
+        }
+    }
+    scanFiles(usedMaterials, vfs, threads, textures, nullptr);
+
+    std::cout << "Scanned " << sources.size() << " models/configs and " << usedMaterials.size() << " materials: "
+        << textures.size() << " referenced textures" << std::endl;
+    return textures;
+}
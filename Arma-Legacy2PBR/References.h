@@ -0,0 +1,15 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <unordered_set>
+
+struct Vfs;
+
+// Lower-case file name without folder or extension: "A3\Data\Tank_CO.paa" and "TGA_Result/tank_co.tga" both give "tank_co"
+std::string getTextureKey(const std::string& path);
+
+// Keys of every texture referenced by the .p3d models, config.cpp/config.bin files and config headers (.hpp, .h, .inc)
+// under root (and inside the PBOs of vfs, when given), and by the .rvmat materials those reference; files are scanned on
+// the given number of threads
+std::unordered_set<std::string> scanTextureReferences(const std::filesystem::path& root, unsigned threads, Vfs* vfs = nullptr);
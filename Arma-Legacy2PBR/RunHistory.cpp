@@ -0,0 +1,242 @@
+#include "RunHistory.h"
+
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+namespace fs = std::filesystem;
+
+std::string makeRunId() {
+    auto clock = std::chrono::system_clock::now();
+    std::time_t now = std::chrono::system_clock::to_time_t(clock);
+    auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(clock.time_since_epoch()).count() % 1000;
+    std::tm utc{};
+#ifdef _WIN32
+    gmtime_s(&utc, &now);
+#else
+    gmtime_r(&now, &utc);
+#endif
+    std::ostringstream id;
+    id << std::put_time(&utc, "%Y-%m-%dT%H:%M:%S") << '.' << std::setw(3) << std::setfill('0') << millis << 'Z';
+    return id.str();
+}
+
+double totalSeconds(const HistoryRecord& record) {
+    return record.loadSeconds + record.packSeconds + record.saveSeconds;
+}
+
+bool isFullBuild(const HistoryRecord& record) {
+    return record.outputs == "NMO+BCR" && record.dirtyTiles == record.tiles;
+}
+
+std::vector<HistoryRecord> readHistory(const fs::path& file) {
+    std::vector<HistoryRecord> records;
+    std::ifstream in(file);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::vector<std::string> fields;
+        std::istringstream row(line);
+        std::string field;
+        while (std::getline(row, field, '\t')) {
+            fields.push_back(field);
+        }
+        // Columns after save_s were added later and are missing in older rows
+        if (fields.size() < 10) {
+            continue;
+        }
+        try {
+            HistoryRecord record;
+            record.runId = fields[0];
+            record.toolVersion = fields[1];
+            record.setName = fields[2];
+            record.width = static_cast<unsigned>(std::stoul(fields[3]));
+            record.height = static_cast<unsigned>(std::stoul(fields[4]));
+            record.formats = fields[5];
+            record.inputBytes = std::stoull(fields[6]);
+            record.loadSeconds = std::stod(fields[7]);
+            record.packSeconds = std::stod(fields[8]);
+            record.saveSeconds = std::stod(fields[9]);
+            if (fields.size() >= 12) {
+                record.tiles = static_cast<unsigned>(std::stoul(fields[10]));
+                record.dirtyTiles = static_cast<unsigned>(std::stoul(fields[11]));
+            }
+            if (fields.size() >= 13) {
+                record.outputs = fields[12];
+            }
+            if (fields.size() >= 14) {
+                record.runSeconds = std::stod(fields[13]);
+            }
+            records.push_back(record);
+        }
+        catch (const std::exception&) {
+            // Skip damaged rows rather than losing the whole history
+        }
+    }
+    return records;
+}
+
+bool appendHistory(const fs::path& file, const std::vector<HistoryRecord>& records) {
+    bool writeHeader = !fs::exists(file);
+    std::ofstream out(file, std::ios::app);
+    if (!out) {
+        std::cerr << "Failed to open run history: " << file.string() << std::endl;
+        return false;
+    }
+    if (writeHeader) {
+        out << "# run\tversion\tset\twidth\theight\tformats\tinput_bytes\tload_s\tpack_s\tsave_s\ttiles\tdirty_tiles\toutputs\trun_s\n";
+    }
+    for (const auto& record : records) {
+        out << record.runId << '\t' << record.toolVersion << '\t' << record.setName << '\t'
+            << record.width << '\t' << record.height << '\t' << record.formats << '\t'
+            << record.inputBytes << '\t' << record.loadSeconds << '\t'
+            << record.packSeconds << '\t' << record.saveSeconds << '\t'
+            << record.tiles << '\t' << record.dirtyTiles << '\t' << record.outputs << '\t'
+            << record.runSeconds << '\n';
+    }
+    return static_cast<bool>(out);
+}
+
+static FormatCost fitFormatCost(const std::vector<const HistoryRecord*>& records) {
+    FormatCost cost;
+    double n = 0.0, sumX = 0.0, sumY = 0.0, sumXX = 0.0, sumXY = 0.0;
+    double pixels = 0.0, bytes = 0.0;
+    for (const HistoryRecord* record : records) {
+        double megapixels = double(record->width) * record->height / 1e6;
+        double seconds = totalSeconds(*record);
+        n += 1.0;
+        sumX += megapixels;
+        sumY += seconds;
+        sumXX += megapixels * megapixels;
+        sumXY += megapixels * seconds;
+        pixels += double(record->width) * record->height;
+        bytes += double(record->inputBytes);
+    }
+    if (n == 0.0) {
+        return cost;
+    }
+    double denominator = n * sumXX - sumX * sumX;
+    if (denominator > 1e-12) {
+        cost.secondsPerMegapixel = (n * sumXY - sumX * sumY) / denominator;
+        cost.baseSeconds = (sumY - cost.secondsPerMegapixel * sumX) / n;
+    }
+    // Degenerate fit (all sets the same size or a negative slope): fall back to a plain rate
+    if (denominator <= 1e-12 || cost.secondsPerMegapixel <= 0.0 || cost.baseSeconds < 0.0) {
+        cost.baseSeconds = 0.0;
+        cost.secondsPerMegapixel = sumX > 0.0 ? sumY / sumX : 0.0;
+    }
+    cost.pixelsPerInputByte = bytes > 0.0 ? pixels / bytes : 0.0;
+    return cost;
+}
+
+CostModel trainCostModel(const std::vector<HistoryRecord>& history) {
+    CostModel model;
+    std::unordered_map<std::string, std::vector<const HistoryRecord*>> formatGroups;
+    std::vector<const HistoryRecord*> all;
+    for (const auto& record : history) {
+        if (!isFullBuild(record)) {
+            continue;
+        }
+        model.bySet[record.setName].push_back(record);
+        formatGroups[record.formats].push_back(&record);
+        all.push_back(&record);
+    }
+    for (const auto& [formats, records] : formatGroups) {
+        model.byFormats[formats] = fitFormatCost(records);
+    }
+    model.overall = fitFormatCost(all);
+    return model;
+}
+
+static double medianSeconds(const std::vector<HistoryRecord>& records, size_t count) {
+    std::vector<double> seconds;
+    size_t first = records.size() > count ? records.size() - count : 0;
+    for (size_t i = first; i < records.size(); ++i) {
+        seconds.push_back(totalSeconds(records[i]));
+    }
+    if (seconds.empty()) {
+        return 0.0;
+    }
+    std::sort(seconds.begin(), seconds.end());
+    return seconds[seconds.size() / 2];
+}
+
+CostEstimate predictSetCost(const CostModel& model, const std::string& setName, const std::string& formats, uint64_t inputBytes) {
+    CostEstimate estimate;
+    auto known = model.bySet.find(setName);
+    if (known != model.bySet.end() && !known->second.empty()) {
+        const HistoryRecord& last = known->second.back();
+        estimate.seconds = medianSeconds(known->second, 5);
+        estimate.pixels = uint64_t(last.width) * last.height;
+        estimate.fromHistory = true;
+        return estimate;
+    }
+
+    auto group = model.byFormats.find(formats);
+    const FormatCost& cost = group != model.byFormats.end() ? group->second : model.overall;
+    // Without history assume uncompressed 32-bit sources: four inputs of four bytes per pixel
+    double pixelsPerByte = cost.pixelsPerInputByte > 0.0 ? cost.pixelsPerInputByte : 1.0 / 16.0;
+    estimate.pixels = static_cast<uint64_t>(double(inputBytes) * pixelsPerByte);
+    estimate.seconds = cost.baseSeconds + cost.secondsPerMegapixel * double(estimate.pixels) / 1e6;
+    return estimate;
+}
+
+void reportRegressions(const CostModel& model, const std::vector<HistoryRecord>& current) {
+    for (const auto& record : current) {
+        if (!isFullBuild(record)) {
+            continue;
+        }
+        auto known = model.bySet.find(record.setName);
+        if (known == model.bySet.end() || known->second.size() < 2) {
+            continue;
+        }
+        const HistoryRecord& last = known->second.back();
+        if (last.width != record.width || last.height != record.height) {
+            continue;
+        }
+        double baseline = medianSeconds(known->second, 5);
+        double seconds = totalSeconds(record);
+        if (seconds > baseline * 1.5 && seconds - baseline > 0.1) {
+            std::cerr << "Regression: " << record.setName << " took " << std::fixed << std::setprecision(2)
+                << seconds << " s (median " << baseline << " s over " << known->second.size()
+                << " runs)" << std::defaultfloat << std::endl;
+        }
+    }
+}
+
+void printHistoryTrends(const std::vector<HistoryRecord>& history) {
+    if (history.empty()) {
+        std::cout << "No run history recorded yet." << std::endl;
+        return;
+    }
+    std::cout << std::left << std::setw(26) << "Run" << std::setw(10) << "Version"
+        << std::right << std::setw(8) << "Sets" << std::setw(12) << "Mpixels"
+        << std::setw(12) << "Seconds" << std::setw(12) << "Mpixel/s" << std::endl;
+
+    size_t i = 0;
+    while (i < history.size()) {
+        const std::string& runId = history[i].runId;
+        size_t sets = 0;
+        double megapixels = 0.0, setSeconds = 0.0;
+        std::string version = history[i].toolVersion;
+        double runSeconds = history[i].runSeconds;
+        for (; i < history.size() && history[i].runId == runId; ++i) {
+            ++sets;
+            megapixels += double(history[i].width) * history[i].height / 1e6;
+            setSeconds += totalSeconds(history[i]);
+        }
+        // Sets overlap on parallel runs, so their sum is only the fallback for rows without the run's wall time
+        double seconds = runSeconds > 0.0 ? runSeconds : setSeconds;
+        std::cout << std::left << std::setw(26) << runId << std::setw(10) << version
+            << std::right << std::setw(8) << sets << std::fixed << std::setprecision(2)
+            << std::setw(12) << megapixels << std::setw(12) << seconds
+            << std::setw(12) << (seconds > 0.0 ? megapixels / seconds : 0.0)
+            << std::defaultfloat << std::endl;
+    }
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <filesystem>
+
+struct HistoryRecord {
+    std::string runId;
+    std::string toolVersion;
+    std::string setName;
+    unsigned width = 0;
+    unsigned height = 0;
+    std::string formats;
+    uint64_t inputBytes = 0;
+    double loadSeconds = 0.0;
+    double packSeconds = 0.0;
+    double saveSeconds = 0.0;
+    // Tiles of the outputs patched in place and how many of them were repacked; both zero when every output was packed whole
+    unsigned tiles = 0;
+    unsigned dirtyTiles = 0;
+    // Outputs written by the run: "NMO+BCR", "NMO", "BCR" or "-"
+    std::string outputs = "NMO+BCR";
+    // Wall-clock time of the whole run, the same on each of its rows; zero in rows written before it was recorded
+    double runSeconds = 0.0;
+};
+
+struct CostEstimate {
+    double seconds = 0.0;
+    uint64_t pixels = 0;
+    bool fromHistory = false;
+};
+
+// Linear fit of seconds = base + perMegapixel * megapixels for one format combination
+struct FormatCost {
+    double baseSeconds = 0.0;
+    double secondsPerMegapixel = 0.0;
+    double pixelsPerInputByte = 0.0;
+};
+
+struct CostModel {
+    std::unordered_map<std::string, std::vector<HistoryRecord>> bySet;
+    std::unordered_map<std::string, FormatCost> byFormats;
+    FormatCost overall;
+};
+
+std::string makeRunId();
+double totalSeconds(const HistoryRecord& record);
+// Whether the record timed a whole set; partial builds stay out of the cost model and the regression check
+bool isFullBuild(const HistoryRecord& record);
+
+std::vector<HistoryRecord> readHistory(const std::filesystem::path& file);
+bool appendHistory(const std::filesystem::path& file, const std::vector<HistoryRecord>& records);
+
+CostModel trainCostModel(const std::vector<HistoryRecord>& history);
+CostEstimate predictSetCost(const CostModel& model, const std::string& setName, const std::string& formats, uint64_t inputBytes);
+
+void reportRegressions(const CostModel& model, const std::vector<HistoryRecord>& current);
+void printHistoryTrends(const std::vector<HistoryRecord>& history);
@@ -0,0 +1,236 @@
+#include "Similarity.h"
+#include "Hash.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+namespace fs = std::filesystem;
+
+static const unsigned mipColumns = 9;
+static const unsigned mipRows = 8;
+
+Fingerprint computeFingerprint(const unsigned char* bits, unsigned width, unsigned height, unsigned pitch) {
+    Fingerprint fingerprint;
+    fingerprint.width = width;
+    fingerprint.height = height;
+    if (width == 0 || height == 0) {
+        return fingerprint;
+    }
+
+    // Cell of every column and row; images smaller than the mip repeat their edge pixels
+    std::vector<unsigned> columnCell(width), rowCell(height);
+    uint64_t columnPixels[mipColumns] = {}, rowPixels[mipRows] = {};
+    for (unsigned x = 0; x < width; ++x) {
+        columnCell[x] = unsigned(uint64_t(x) * mipColumns / width);
+        ++columnPixels[columnCell[x]];
+    }
+    for (unsigned y = 0; y < height; ++y) {
+        rowCell[y] = unsigned(uint64_t(y) * mipRows / height);
+        ++rowPixels[rowCell[y]];
+    }
+    uint64_t sums[mipRows][mipColumns][4] = {};
+    for (unsigned y = 0; y < height; ++y) {
+        const unsigned char* row = bits + size_t(y) * pitch;
+        uint64_t (*cells)[4] = sums[rowCell[y]];
+        for (unsigned x = 0; x < width; ++x) {
+            uint64_t* cell = cells[columnCell[x]];
+            cell[0] += row[x * 4 + 0];
+            cell[1] += row[x * 4 + 1];
+            cell[2] += row[x * 4 + 2];
+            cell[3] += row[x * 4 + 3];
+        }
+    }
+
+    uint64_t totals[4] = {};
+    unsigned mip[mipRows][mipColumns][4] = {};
+    for (unsigned cy = 0; cy < mipRows; ++cy) {
+        for (unsigned cx = 0; cx < mipColumns; ++cx) {
+            // Empty cells of tiny images take their left or lower neighbour
+            unsigned sy = cy, sx = cx;
+            while (columnPixels[sx] == 0 && sx > 0) {
+                --sx;
+            }
+            while (rowPixels[sy] == 0 && sy > 0) {
+                --sy;
+            }
+            uint64_t count = columnPixels[sx] * rowPixels[sy];
+            for (unsigned c = 0; c < 4; ++c) {
+                mip[cy][cx][c] = count ? unsigned(sums[sy][sx][c] / count) : 0;
+                totals[c] += sums[cy][cx][c];
+            }
+        }
+    }
+    uint64_t pixels = uint64_t(width) * height;
+    for (unsigned c = 0; c < 4; ++c) {
+        uint64_t hash = 0;
+        for (unsigned cy = 0; cy < mipRows; ++cy) {
+            for (unsigned cx = 0; cx + 1 < mipColumns; ++cx) {
+                hash = (hash << 1) | (mip[cy][cx][c] < mip[cy][cx + 1][c] ? 1u : 0u);
+            }
+        }
+        fingerprint.hashes[c] = hash;
+        fingerprint.means[c] = uint8_t(totals[c] / pixels);
+    }
+    return fingerprint;
+}
+
+// Format: "F <path>\t<size>\t<mtime>\t<width>\t<height>\t<B,G,R,A hashes>\t<B,G,R,A means>"
+FingerprintCache readFingerprintCache(const fs::path& file) {
+    FingerprintCache cache;
+    std::ifstream in(file);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.size() < 2 || line[0] != 'F' || line[1] != ' ') {
+            continue;
+        }
+        std::istringstream row(line.substr(2));
+        std::vector<std::string> fields;
+        for (std::string field; std::getline(row, field, '\t');) {
+            fields.push_back(field);
+        }
+        if (fields.size() != 7) {
+            continue;
+        }
+        try {
+            InputSignature signature;
+            Fingerprint fingerprint;
+            signature.path = fields[0];
+            signature.size = std::stoull(fields[1]);
+            signature.modified = std::stoll(fields[2]);
+            fingerprint.width = static_cast<unsigned>(std::stoul(fields[3]));
+            fingerprint.height = static_cast<unsigned>(std::stoul(fields[4]));
+            std::istringstream hashes(fields[5]), means(fields[6]);
+            std::string value;
+            for (unsigned c = 0; c < 4; ++c) {
+                if (!std::getline(hashes, value, ',')) {
+                    throw std::invalid_argument("hashes");
+                }
+                fingerprint.hashes[c] = std::stoull(value, nullptr, 16);
+                if (!std::getline(means, value, ',')) {
+                    throw std::invalid_argument("means");
+                }
+                fingerprint.means[c] = uint8_t(std::stoul(value));
+            }
+            cache[signature.path] = { signature, fingerprint };
+        }
+        catch (const std::exception&) {
+            // A damaged line only means that input is fingerprinted again
+        }
+    }
+    return cache;
+}
+
+bool writeFingerprintCache(const fs::path& file, const FingerprintCache& cache) {
+    std::vector<std::string> paths;
+    for (const auto& entry : cache) {
+        paths.push_back(entry.first);
+    }
+    std::sort(paths.begin(), paths.end());
+
+    fs::path temporary = file;
+    temporary += ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::trunc);
+        for (const auto& path : paths) {
+            const InputSignature& signature = cache.at(path).first;
+            const Fingerprint& fingerprint = cache.at(path).second;
+            out << "F " << signature.path << '\t' << signature.size << '\t' << signature.modified << '\t'
+                << fingerprint.width << '\t' << fingerprint.height << '\t';
+            for (unsigned c = 0; c < 4; ++c) {
+                out << (c ? "," : "") << toHex(fingerprint.hashes[c]);
+            }
+            out << '\t';
+            for (unsigned c = 0; c < 4; ++c) {
+                out << (c ? "," : "") << unsigned(fingerprint.means[c]);
+            }
+            out << '\n';
+        }
+        if (!out) {
+            std::cerr << "Failed to write fingerprint cache: " << temporary.string() << std::endl;
+            return false;
+        }
+    }
+    std::error_code error;
+    fs::rename(temporary, file, error);
+    if (error) {
+        std::cerr << "Failed to replace fingerprint cache: " << file.string() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static unsigned getBandCount(const SimilarityIndex& index, const OutputFingerprint& fingerprint) {
+    return std::max(1u, std::min<unsigned>(index.toleranceBits + 1, unsigned(fingerprint.hashes.size() * 64)));
+}
+
+// Bucket of one band: the band's bits together with the image sizes, which must match exactly anyway
+static uint64_t getBandKey(const OutputFingerprint& fingerprint, unsigned band, unsigned bands) {
+    size_t totalBits = fingerprint.hashes.size() * 64;
+    size_t first = totalBits * band / bands;
+    size_t last = totalBits * (band + 1) / bands;
+    Xxh64State state;
+    xxh64Reset(state, band);
+    for (size_t word = first / 64; word * 64 < last; ++word) {
+        uint64_t mask = ~0ull;
+        if (first > word * 64) {
+            mask &= ~0ull << (first - word * 64);
+        }
+        if (last < word * 64 + 64) {
+            mask &= ~0ull >> (word * 64 + 64 - last);
+        }
+        uint64_t bits = fingerprint.hashes[word] & mask;
+        xxh64Update(state, &bits, sizeof(bits));
+    }
+    for (unsigned size : fingerprint.sizes) {
+        xxh64Update(state, &size, sizeof(size));
+    }
+    return xxh64Digest(state);
+}
+
+void addToSimilarityIndex(SimilarityIndex& index, const OutputFingerprint& fingerprint) {
+    size_t item = index.items.size();
+    index.items.push_back(fingerprint);
+    unsigned bands = getBandCount(index, fingerprint);
+    for (unsigned band = 0; band < bands; ++band) {
+        index.buckets[getBandKey(fingerprint, band, bands)].push_back(item);
+    }
+}
+
+bool findSimilar(const SimilarityIndex& index, const OutputFingerprint& fingerprint, size_t& item) {
+    unsigned bands = getBandCount(index, fingerprint);
+    bool found = false;
+    for (unsigned band = 0; band < bands; ++band) {
+        auto bucket = index.buckets.find(getBandKey(fingerprint, band, bands));
+        if (bucket == index.buckets.end()) {
+            continue;
+        }
+        for (size_t candidate : bucket->second) {
+            if (found && candidate >= item) {
+                continue;
+            }
+            const OutputFingerprint& other = index.items[candidate];
+            if (other.sizes != fingerprint.sizes || other.hashes.size() != fingerprint.hashes.size() ||
+                other.means.size() != fingerprint.means.size()) {
+                continue;
+            }
+            unsigned distance = 0;
+            for (size_t i = 0; i < fingerprint.hashes.size(); ++i) {
+                distance += unsigned(std::popcount(other.hashes[i] ^ fingerprint.hashes[i]));
+            }
+            bool close = distance <= index.toleranceBits;
+            for (size_t i = 0; close && i < fingerprint.means.size(); ++i) {
+                close = std::abs(int(other.means[i]) - int(fingerprint.means[i])) <= int(index.meanTolerance);
+            }
+            if (close) {
+                item = candidate;
+                found = true;
+            }
+        }
+    }
+    return found;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "BuildManifest.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Perceptual fingerprint of one decoded 32-bit input: every channel is box-filtered down to a 9x8 mip,
+// and each of its rows gives 8 bits saying whether the next cell is brighter (a difference hash)
+struct Fingerprint {
+    unsigned width = 0;
+    unsigned height = 0;
+    uint64_t hashes[4] = {};   // B, G, R, A
+    uint8_t means[4] = {};
+};
+
+Fingerprint computeFingerprint(const unsigned char* bits, unsigned width, unsigned height, unsigned pitch);
+
+// Fingerprints of inputs seen before, valid while the input signature (path, size, mtime) is unchanged
+using FingerprintCache = std::unordered_map<std::string, std::pair<InputSignature, Fingerprint>>;
+
+FingerprintCache readFingerprintCache(const std::filesystem::path& file);
+bool writeFingerprintCache(const std::filesystem::path& file, const FingerprintCache& cache);
+
+// A packed output described by the fingerprints of the channels it is built from
+struct OutputFingerprint {
+    std::vector<uint64_t> hashes;
+    std::vector<uint8_t> means;
+    std::vector<unsigned> sizes;
+};
+
+// Locality-sensitive index over output fingerprints: the hash bits are cut into tolerance + 1 bands, so any
+// fingerprint within the tolerance shares at least one whole band with its match and lands in the same bucket
+struct SimilarityIndex {
+    unsigned toleranceBits = 0;
+    unsigned meanTolerance = 2;
+    std::vector<OutputFingerprint> items;
+    std::unordered_map<uint64_t, std::vector<size_t>> buckets;
+};
+
+void addToSimilarityIndex(SimilarityIndex& index, const OutputFingerprint& fingerprint);
+// Earliest indexed item within the tolerance, or false
+bool findSimilar(const SimilarityIndex& index, const OutputFingerprint& fingerprint, size_t& item);
@@ -0,0 +1,345 @@
+#include "Vfs.h"
+#include "Zip.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace fs = std::filesystem;
+
+static const uint32_t pboVersionMagic = 0x56657273;     // "sreV"
+static const uint32_t pboCompressedMagic = 0x43707273;  // "srpC"
+
+std::string normalizeVirtualPath(const std::string& path) {
+    std::string normalized;
+    normalized.reserve(path.size());
+    for (char c : path) {
+        normalized.push_back(c == '/' ? '\\' : char(tolower(static_cast<unsigned char>(c))));
+    }
+    size_t start = normalized.find_first_not_of('\\');
+    return start == std::string::npos ? std::string() : normalized.substr(start);
+}
+
+bool decompressLzss(const BYTE* in, size_t inSize, BYTE* out, size_t outSize, size_t* consumed) {
+    size_t read = 0;
+    size_t written = 0;
+    while (written < outSize) {
+        if (read >= inSize) {
+            return false;
+        }
+        BYTE flags = in[read++];
+        for (int bit = 0; bit < 8 && written < outSize; ++bit, flags >>= 1) {
+            if (flags & 1) {
+                if (read >= inSize) {
+                    return false;
+                }
+                out[written++] = in[read++];
+                continue;
+            }
+            if (read + 2 > inSize) {
+                return false;
+            }
+            size_t distance = in[read] | ((in[read + 1] & 0xF0) << 4);
+            size_t length = (in[read + 1] & 0x0F) + 3;
+            read += 2;
+            // References before the start of the output read as spaces
+            for (; length > 0 && distance > written && written < outSize; --length) {
+                out[written++] = ' ';
+            }
+            for (; length > 0 && written < outSize; --length, ++written) {
+                out[written] = out[written - distance];
+            }
+        }
+    }
+    if (consumed) {
+        *consumed = read;
+    }
+    return true;
+}
+
+static bool readCString(const BYTE* data, size_t size, size_t& position, std::string& text) {
+    const BYTE* end = static_cast<const BYTE*>(memchr(data + position, 0, size - position));
+    if (!end) {
+        return false;
+    }
+    text.assign(reinterpret_cast<const char*>(data + position), end - (data + position));
+    position = size_t(end - data) + 1;
+    return true;
+}
+
+static uint32_t readUint32(const BYTE* p) {
+    return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+}
+
+// An entry of one archive, by its name inside it
+struct ArchiveEntry {
+    std::string name;
+    VfsEntry entry;
+};
+
+// Header: entries of (name, packing method, original size, reserved, timestamp, data size), a version entry with
+// properties first and an empty entry last; data follows in the same order
+static bool readPboHeader(const std::string& path, VfsArchive& archive, std::vector<ArchiveEntry>& entries) {
+    MappedFile file;
+    if (!openMappedFile(path, false, file)) {
+        return false;
+    }
+    const BYTE* data = file.data;
+    size_t position = 0;
+    bool ok = false;
+    std::string name;
+    while (readCString(data, file.size, position, name) && position + 20 <= file.size) {
+        uint32_t method = readUint32(data + position);
+        uint32_t originalSize = readUint32(data + position + 4);
+        uint32_t dataSize = readUint32(data + position + 16);
+        position += 20;
+        if (name.empty() && method == pboVersionMagic) {
+            std::string key, value;
+            while (readCString(data, file.size, position, key) && !key.empty() && readCString(data, file.size, position, value)) {
+                if (key == "prefix") {
+                    archive.prefix = normalizeVirtualPath(value);
+                }
+            }
+            continue;
+        }
+        if (name.empty()) {
+            ok = true;
+            break;
+        }
+        ArchiveEntry entry;
+        entry.name = normalizeVirtualPath(name);
+        entry.entry.dataSize = dataSize;
+        entry.entry.originalSize = originalSize;
+        bool compressed = method == pboCompressedMagic || (method == 0 && originalSize != 0 && originalSize != dataSize);
+        entry.entry.packing = compressed ? VfsPacking::Lzss : VfsPacking::Stored;
+        entries.push_back(entry);
+    }
+    uint64_t offset = position;
+    for (auto& entry : entries) {
+        entry.entry.offset = offset;
+        offset += entry.entry.dataSize;
+    }
+    ok = ok && offset <= file.size;
+    closeMappedFile(file);
+    if (!ok) {
+        std::cerr << "Damaged PBO header: " << path << std::endl;
+    }
+    return ok;
+}
+
+static bool readZipHeader(const std::string& path, std::vector<ArchiveEntry>& entries) {
+    MappedFile file;
+    if (!openMappedFile(path, false, file)) {
+        return false;
+    }
+    std::vector<ZipEntry> zipEntries;
+    bool ok = readZipDirectory(path, file.data, file.size, zipEntries);
+    closeMappedFile(file);
+    for (const auto& zipEntry : zipEntries) {
+        if (zipEntry.dataSize > 0xFFFFFFFF || zipEntry.originalSize > 0xFFFFFFFF) {
+            std::cerr << "Skipped ZIP entry over 4 GB: " << path << ": " << zipEntry.name << std::endl;
+            continue;
+        }
+        ArchiveEntry entry;
+        entry.name = normalizeVirtualPath(zipEntry.name);
+        entry.entry.offset = zipEntry.offset;
+        entry.entry.dataSize = uint32_t(zipEntry.dataSize);
+        entry.entry.originalSize = uint32_t(zipEntry.originalSize);
+        entry.entry.packing = zipEntry.deflated ? VfsPacking::Deflate : VfsPacking::Stored;
+        entries.push_back(entry);
+    }
+    return ok;
+}
+
+static std::string getLowerExtension(const fs::path& path) {
+    std::string extension = path.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return char(tolower(c)); });
+    return extension;
+}
+
+static bool readArchiveHeader(const fs::path& path, VfsArchive& archive, std::vector<ArchiveEntry>& entries) {
+    return getLowerExtension(path) == ".zip" ? readZipHeader(path.string(), entries) : readPboHeader(path.string(), archive, entries);
+}
+
+// Format: "A <archive>\t<size>\t<mtime>\t<prefix>" followed by its "E <name>\t<offset>\t<data size>\t<original size>\t<packing>",
+// packing 0 stored, 1 LZSS, 2 deflate
+static void readVfsIndex(const fs::path& index, std::unordered_map<std::string, std::pair<VfsArchive, std::vector<ArchiveEntry>>>& cached) {
+    std::ifstream in(index);
+    std::string line;
+    std::pair<VfsArchive, std::vector<ArchiveEntry>>* current = nullptr;
+    while (std::getline(in, line)) {
+        if (line.size() < 2 || line[1] != ' ') {
+            continue;
+        }
+        std::istringstream row(line.substr(2));
+        std::vector<std::string> fields;
+        for (std::string field; std::getline(row, field, '\t');) {
+            fields.push_back(field);
+        }
+        try {
+            if (line[0] == 'A' && fields.size() >= 3) {
+                current = &cached[fields[0]];
+                current->first.path = fields[0];
+                current->first.size = std::stoull(fields[1]);
+                current->first.modified = std::stoll(fields[2]);
+                current->first.prefix = fields.size() > 3 ? fields[3] : std::string();
+                current->second.clear();
+            }
+            else if (line[0] == 'E' && current && fields.size() == 5) {
+                ArchiveEntry entry;
+                entry.name = fields[0];
+                entry.entry.offset = std::stoull(fields[1]);
+                entry.entry.dataSize = static_cast<uint32_t>(std::stoul(fields[2]));
+                entry.entry.originalSize = static_cast<uint32_t>(std::stoul(fields[3]));
+                entry.entry.packing = VfsPacking(std::clamp(std::stoi(fields[4]), 0, 2));
+                current->second.push_back(entry);
+            }
+        }
+        catch (const std::exception&) {
+            // A damaged archive entry only means the archive is read again
+            if (current) {
+                current->first.size = 0;
+            }
+        }
+    }
+}
+
+bool buildVfs(const std::vector<fs::path>& roots, const std::vector<fs::path>& extraArchives, const fs::path& index, Vfs& vfs, bool updateIndex) {
+    std::unordered_map<std::string, std::pair<VfsArchive, std::vector<ArchiveEntry>>> cached;
+    readVfsIndex(index, cached);
+
+    std::vector<fs::path> archives = extraArchives;
+    std::vector<std::pair<std::string, std::string>> looseFiles;
+    for (const auto& root : roots) {
+        std::error_code error;
+        for (auto it = fs::recursive_directory_iterator(root, fs::directory_options::skip_permission_denied, error);
+            !error && it != fs::recursive_directory_iterator(); it.increment(error)) {
+            if (!it->is_regular_file(error)) {
+                continue;
+            }
+            std::string extension = getLowerExtension(it->path());
+            if (extension == ".pbo" || extension == ".zip") {
+                archives.push_back(it->path());
+            }
+            else {
+                looseFiles.push_back({ normalizeVirtualPath(fs::relative(it->path(), root, error).string()), it->path().string() });
+            }
+        }
+        if (error) {
+            std::cerr << "Error reading directory: " << root.string() << std::endl;
+        }
+    }
+    std::sort(archives.begin(), archives.end());
+
+    std::ostringstream out;
+    out << "# Legacy2PBR virtual file system index\n";
+    for (const auto& path : archives) {
+        std::string name = path.string();
+        std::error_code error;
+        uint64_t size = fs::file_size(path, error);
+        auto time = fs::last_write_time(path, error);
+        int64_t modified = error ? 0 : static_cast<int64_t>(time.time_since_epoch().count());
+
+        VfsArchive archive;
+        std::vector<ArchiveEntry> entries;
+        auto hit = cached.find(name);
+        if (hit != cached.end() && hit->second.first.size == size && hit->second.first.modified == modified && size != 0) {
+            archive.prefix = hit->second.first.prefix;
+            entries = std::move(hit->second.second);
+        }
+        else if (!readArchiveHeader(path, archive, entries)) {
+            continue;
+        }
+        archive.path = name;
+        archive.size = size;
+        archive.modified = modified;
+
+        out << "A " << name << '\t' << size << '\t' << modified << '\t' << archive.prefix << '\n';
+        int archiveIndex = int(vfs.archives.size());
+        for (auto& entry : entries) {
+            out << "E " << entry.name << '\t' << entry.entry.offset << '\t' << entry.entry.dataSize << '\t'
+                << entry.entry.originalSize << '\t' << int(entry.entry.packing) << '\n';
+            entry.entry.archive = archiveIndex;
+            std::string virtualPath = archive.prefix.empty() ? entry.name : archive.prefix + "\\" + entry.name;
+            vfs.entries[virtualPath] = entry.entry;
+        }
+        vfs.archives.push_back(std::move(archive));
+    }
+    for (const auto& loose : looseFiles) {
+        VfsEntry entry;
+        entry.loosePath = loose.second;
+        vfs.entries[loose.first] = entry;
+    }
+    if (!updateIndex) {
+        return true;
+    }
+    // Written next to the old index and swapped, like the build manifest
+    fs::path temporary = index;
+    temporary += ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::trunc);
+        file << out.str();
+        if (!file) {
+            std::cerr << "Failed to write VFS index: " << temporary.string() << std::endl;
+            return false;
+        }
+    }
+    std::error_code error;
+    fs::rename(temporary, index, error);
+    if (error) {
+        std::cerr << "Failed to replace VFS index: " << index.string() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+const VfsEntry* findVfsEntry(const Vfs& vfs, const std::string& virtualPath) {
+    auto found = vfs.entries.find(normalizeVirtualPath(virtualPath));
+    return found == vfs.entries.end() ? nullptr : &found->second;
+}
+
+bool readVfsEntry(Vfs& vfs, const VfsEntry& entry, std::vector<BYTE>& buffer, const BYTE*& data, size_t& size) {
+    if (entry.archive < 0) {
+        if (!readFile(entry.loosePath, buffer)) {
+            return false;
+        }
+        data = buffer.data();
+        size = buffer.size();
+        return true;
+    }
+    VfsArchive& archive = vfs.archives[size_t(entry.archive)];
+    {
+        std::lock_guard<std::mutex> lock(vfs.mapMutex);
+        if (!archive.mapped.data && !openMappedFile(archive.path, false, archive.mapped)) {
+            std::cerr << "Failed to map archive: " << archive.path << std::endl;
+            return false;
+        }
+    }
+    if (entry.offset + entry.dataSize > archive.mapped.size) {
+        return false;
+    }
+    const BYTE* stored = archive.mapped.data + entry.offset;
+    if (entry.packing == VfsPacking::Stored) {
+        data = stored;
+        size = entry.dataSize;
+        return true;
+    }
+    // Unpacked by the calling worker straight into the buffer it decodes from
+    buffer.resize(entry.originalSize);
+    bool unpacked = entry.packing == VfsPacking::Lzss ? decompressLzss(stored, entry.dataSize, buffer.data(), buffer.size()) :
+        inflateRaw(stored, entry.dataSize, buffer.data(), buffer.size());
+    if (!unpacked) {
+        return false;
+    }
+    data = buffer.data();
+    size = buffer.size();
+    return true;
+}
+
+void closeVfs(Vfs& vfs) {
+    for (auto& archive : vfs.archives) {
+        closeMappedFile(archive.mapped);
+    }
+}
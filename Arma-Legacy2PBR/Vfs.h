@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "FileIO.h"
+
+struct VfsArchive {
+    std::string path;
+    uint64_t size = 0;
+    int64_t modified = 0;
+    std::string prefix;
+    MappedFile mapped;
+};
+
+enum class VfsPacking { Stored, Lzss, Deflate };
+
+// A PBO or ZIP entry (archive >= 0) or a loose file
+struct VfsEntry {
+    int archive = -1;
+    uint64_t offset = 0;
+    uint32_t dataSize = 0;
+    uint32_t originalSize = 0;
+    VfsPacking packing = VfsPacking::Stored;
+    std::string loosePath;
+};
+
+// Every file of an install by virtual path; loose files override archive entries, later archives (by path) override
+// earlier ones. ZIP entries have no prefix, their virtual path is the path inside the archive
+struct Vfs {
+    std::vector<VfsArchive> archives;
+    std::unordered_map<std::string, VfsEntry> entries;
+    // Archives are mapped on first read
+    std::mutex mapMutex;
+};
+
+// Lower-case, backslash-separated, without a leading separator
+std::string normalizeVirtualPath(const std::string& path);
+
+// Walks the roots for .pbo and .zip archives and loose files, and adds the given single archives (ZIPs dropped into
+// TGA_Result). Entry tables of archives unchanged since the index was written are reused, and the index is rewritten
+bool buildVfs(const std::vector<std::filesystem::path>& roots, const std::vector<std::filesystem::path>& extraArchives,
+    const std::filesystem::path& index, Vfs& vfs, bool updateIndex = true);
+const VfsEntry* findVfsEntry(const Vfs& vfs, const std::string& virtualPath);
+// Stored entries point into the archive mapping; compressed ones are unpacked and loose ones read into buffer
+bool readVfsEntry(Vfs& vfs, const VfsEntry& entry, std::vector<BYTE>& buffer, const BYTE*& data, size_t& size);
+void closeVfs(Vfs& vfs);
+
+// Bohemia LZSS as used by PBO and PAA; false when the input runs out before outSize bytes
+bool decompressLzss(const BYTE* in, size_t inSize, BYTE* out, size_t outSize, size_t* consumed = nullptr);
@@ -0,0 +1,149 @@
+#include "Workload.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+
+namespace fs = std::filesystem;
+
+// Order-0 entropy of left-neighbour deltas in bits per byte, sampled on every 8th row
+double estimateEntropy(FIBITMAP* dib) {
+    unsigned width = FreeImage_GetWidth(dib);
+    unsigned height = FreeImage_GetHeight(dib);
+    unsigned bytesPerPixel = FreeImage_GetBPP(dib) / 8;
+    if (width < 2 || bytesPerPixel == 0) {
+        return 0.0;
+    }
+    uint64_t histogram[256] = {};
+    uint64_t samples = 0;
+    for (unsigned y = 0; y < height; y += 8) {
+        const BYTE* row = FreeImage_GetScanLine(dib, y);
+        for (unsigned x = 1; x < width; ++x) {
+            for (unsigned c = 0; c < bytesPerPixel; ++c) {
+                BYTE delta = BYTE(row[x * bytesPerPixel + c] - row[(x - 1) * bytesPerPixel + c]);
+                ++histogram[delta];
+                ++samples;
+            }
+        }
+    }
+    double entropy = 0.0;
+    for (uint64_t count : histogram) {
+        if (count) {
+            double p = double(count) / double(samples);
+            entropy -= p * std::log2(p);
+        }
+    }
+    return entropy;
+}
+
+bool writeWorkloadProfile(const fs::path& file, const std::vector<WorkloadInput>& inputs) {
+    std::ofstream out(file);
+    if (!out) {
+        std::cerr << "Failed to write workload profile: " << file.string() << std::endl;
+        return false;
+    }
+    out << "# set\trole\tinput\twidth\theight\tformat\tbpp\tentropy\tfile_bytes\n";
+    for (const auto& input : inputs) {
+        out << input.setIndex << '\t' << input.role << '\t' << input.inputId << '\t'
+            << input.width << '\t' << input.height << '\t' << input.format << '\t'
+            << input.bpp << '\t' << input.entropy << '\t' << input.fileBytes << '\n';
+    }
+    std::cout << "Workload profile saved to: " << file.string() << std::endl;
+    return static_cast<bool>(out);
+}
+
+std::vector<WorkloadInput> readWorkloadProfile(const fs::path& file) {
+    std::vector<WorkloadInput> inputs;
+    std::ifstream in(file);
+    if (!in) {
+        std::cerr << "Failed to read workload profile: " << file.string() << std::endl;
+        return inputs;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::istringstream row(line);
+        WorkloadInput input;
+        if (row >> input.setIndex >> input.role >> input.inputId >> input.width >> input.height
+            >> input.format >> input.bpp >> input.entropy >> input.fileBytes) {
+            inputs.push_back(input);
+        }
+    }
+    return inputs;
+}
+
+static FIBITMAP* synthesizeImage(const WorkloadInput& input, std::mt19937& random) {
+    unsigned bpp = (input.bpp == 8 || input.bpp == 24) ? input.bpp : 32;
+    FIBITMAP* dib = FreeImage_Allocate(input.width, input.height, bpp);
+    if (!dib) {
+        return nullptr;
+    }
+    // A random walk whose deltas are uniform over 2^entropy values reproduces the measured entropy
+    unsigned range = std::max(1u, static_cast<unsigned>(std::lround(std::exp2(std::min(input.entropy, 8.0)))));
+    std::uniform_int_distribution<unsigned> delta(0, range - 1);
+    std::uniform_int_distribution<unsigned> start(0, 255);
+    unsigned bytesPerPixel = bpp / 8;
+    for (unsigned y = 0; y < input.height; ++y) {
+        BYTE* row = FreeImage_GetScanLine(dib, y);
+        for (unsigned c = 0; c < bytesPerPixel; ++c) {
+            BYTE value = BYTE(start(random));
+            for (unsigned x = 0; x < input.width; ++x) {
+                value = BYTE(value + delta(random));
+                row[x * bytesPerPixel + c] = value;
+            }
+        }
+    }
+    return dib;
+}
+
+bool synthesizeWorkload(const std::vector<WorkloadInput>& inputs, const fs::path& inputFolder, std::vector<WorkloadSet>& sets) {
+    std::error_code error;
+    fs::create_directories(inputFolder, error);
+    if (error) {
+        std::cerr << "Failed to create replay folder: " << inputFolder.string() << std::endl;
+        return false;
+    }
+
+    // Inputs shared between sets appear once per set in the profile but are written once
+    std::map<std::pair<std::string, size_t>, const WorkloadInput*> unique;
+    for (const auto& input : inputs) {
+        unique.emplace(std::make_pair(input.role, input.inputId), &input);
+    }
+
+    std::map<std::pair<std::string, size_t>, std::string> files;
+    std::mt19937 random(12345);
+    for (const auto& [key, input] : unique) {
+        std::ostringstream name;
+        name << 'w' << std::setw(5) << std::setfill('0') << key.second << '_' << key.first << '.' << input->format;
+        std::string filename = (inputFolder / name.str()).string();
+
+        FREE_IMAGE_FORMAT format = FreeImage_GetFIFFromFilename(filename.c_str());
+        FIBITMAP* dib = synthesizeImage(*input, random);
+        if (format == FIF_UNKNOWN || !dib || !FreeImage_Save(format, dib, filename.c_str(), 0)) {
+            std::cerr << "Failed to synthesize image: " << filename << std::endl;
+            FreeImage_Unload(dib);
+            return false;
+        }
+        FreeImage_Unload(dib);
+        files[key] = filename;
+    }
+
+    sets.clear();
+    for (const auto& input : inputs) {
+        if (input.setIndex >= sets.size()) {
+            sets.resize(input.setIndex + 1);
+        }
+        WorkloadSet& set = sets[input.setIndex];
+        std::string& file = input.role == "smdi" ? set.smdi : input.role == "as" ? set.as : input.role == "co" ? set.co : set.nohq;
+        file = files[std::make_pair(input.role, input.inputId)];
+    }
+    std::cout << "Synthesized " << unique.size() << " inputs into: " << inputFolder.string() << std::endl;
+    return true;
+}
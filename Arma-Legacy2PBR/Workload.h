@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <FreeImage.h>
+
+// Anonymized shape of one input of a texture set: no names, no pixels
+struct WorkloadInput {
+    size_t setIndex = 0;
+    std::string role;
+    size_t inputId = 0;
+    unsigned width = 0;
+    unsigned height = 0;
+    std::string format;
+    unsigned bpp = 0;
+    double entropy = 0.0;
+    uint64_t fileBytes = 0;
+};
+
+// Synthesized files of one captured set by role; empty where the set had no file, e.g. a baked AS
+struct WorkloadSet {
+    std::string nohq;
+    std::string smdi;
+    std::string as;
+    std::string co;
+};
+
+double estimateEntropy(FIBITMAP* dib);
+
+bool writeWorkloadProfile(const std::filesystem::path& file, const std::vector<WorkloadInput>& inputs);
+std::vector<WorkloadInput> readWorkloadProfile(const std::filesystem::path& file);
+// sets[i] holds the files of captured set i, so inputs the capture shared between sets are shared again
+bool synthesizeWorkload(const std::vector<WorkloadInput>& inputs, const std::filesystem::path& inputFolder, std::vector<WorkloadSet>& sets);
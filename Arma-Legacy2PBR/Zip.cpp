@@ -0,0 +1,374 @@
+#include "Zip.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+static const uint32_t zipEndSignature = 0x06054b50;
+static const uint32_t zip64EndSignature = 0x06064b50;
+static const uint32_t zip64LocatorSignature = 0x07064b50;
+static const uint32_t zipCentralSignature = 0x02014b50;
+static const uint32_t zipLocalSignature = 0x04034b50;
+static const size_t zipEndSize = 22;
+static const size_t zipCentralSize = 46;
+static const size_t zipLocalSize = 30;
+
+static uint16_t readUint16(const BYTE* p) {
+    return uint16_t(p[0] | (p[1] << 8));
+}
+
+static uint32_t readUint32(const BYTE* p) {
+    return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+}
+
+static uint64_t readUint64(const BYTE* p) {
+    return uint64_t(readUint32(p)) | (uint64_t(readUint32(p + 4)) << 32);
+}
+
+// Sizes and the local header offset that did not fit 32 bits are in the ZIP64 extra field, in this order
+static void readZip64Extra(const BYTE* extra, size_t length, uint64_t& originalSize, uint64_t& dataSize, uint64_t& localOffset) {
+    size_t position = 0;
+    while (position + 4 <= length) {
+        uint16_t id = readUint16(extra + position);
+        size_t fieldSize = readUint16(extra + position + 2);
+        const BYTE* field = extra + position + 4;
+        if (position + 4 + fieldSize > length) {
+            return;
+        }
+        if (id == 0x0001) {
+            size_t used = 0;
+            for (uint64_t* value : { &originalSize, &dataSize, &localOffset }) {
+                if (*value == 0xFFFFFFFF && used + 8 <= fieldSize) {
+                    *value = readUint64(field + used);
+                    used += 8;
+                }
+            }
+            return;
+        }
+        position += 4 + fieldSize;
+    }
+}
+
+bool readZipDirectory(const std::string& path, const BYTE* data, size_t size, std::vector<ZipEntry>& entries) {
+    // The end record sits behind at most 64 KB of archive comment
+    size_t end = size;
+    for (size_t position = size >= zipEndSize ? size - zipEndSize + 1 : 0; position-- > 0 && size - position <= zipEndSize + 0xFFFF;) {
+        if (readUint32(data + position) == zipEndSignature) {
+            end = position;
+            break;
+        }
+    }
+    if (end == size) {
+        std::cerr << "Not a ZIP archive: " << path << std::endl;
+        return false;
+    }
+    uint64_t count = readUint16(data + end + 10);
+    uint64_t directorySize = readUint32(data + end + 12);
+    uint64_t directoryOffset = readUint32(data + end + 16);
+    if ((count == 0xFFFF || directorySize == 0xFFFFFFFF || directoryOffset == 0xFFFFFFFF) && end >= 20 &&
+        readUint32(data + end - 20) == zip64LocatorSignature) {
+        uint64_t record = readUint64(data + end - 20 + 8);
+        if (record <= size && size - record >= 56 && readUint32(data + record) == zip64EndSignature) {
+            count = readUint64(data + record + 32);
+            directorySize = readUint64(data + record + 40);
+            directoryOffset = readUint64(data + record + 48);
+        }
+    }
+    // Offsets and sizes come from the file; compared without adding them, so a huge value cannot wrap around
+    if (directoryOffset > size || directorySize > size - directoryOffset) {
+        std::cerr << "Damaged ZIP directory: " << path << std::endl;
+        return false;
+    }
+
+    size_t position = size_t(directoryOffset);
+    size_t directoryEnd = size_t(directoryOffset + directorySize);
+    for (uint64_t i = 0; i < count; ++i) {
+        if (position + zipCentralSize > directoryEnd || readUint32(data + position) != zipCentralSignature) {
+            std::cerr << "Damaged ZIP directory: " << path << std::endl;
+            return false;
+        }
+        const BYTE* header = data + position;
+        uint16_t flags = readUint16(header + 8);
+        uint16_t method = readUint16(header + 10);
+        uint64_t dataSize = readUint32(header + 20);
+        uint64_t originalSize = readUint32(header + 24);
+        size_t nameLength = readUint16(header + 28);
+        size_t extraLength = readUint16(header + 30);
+        size_t commentLength = readUint16(header + 32);
+        uint64_t localOffset = readUint32(header + 42);
+        if (position + zipCentralSize + nameLength + extraLength + commentLength > directoryEnd) {
+            std::cerr << "Damaged ZIP directory: " << path << std::endl;
+            return false;
+        }
+        std::string name(reinterpret_cast<const char*>(header + zipCentralSize), nameLength);
+        readZip64Extra(header + zipCentralSize + nameLength, extraLength, originalSize, dataSize, localOffset);
+        position += zipCentralSize + nameLength + extraLength + commentLength;
+
+        if (name.empty() || name.back() == '/') {
+            continue;
+        }
+        if ((flags & 1) || (method != 0 && method != 8)) {
+            std::cerr << "Skipped " << ((flags & 1) ? "encrypted" : "unsupported compression in") << " ZIP entry: " << path << ": " << name << std::endl;
+            continue;
+        }
+        // The local header repeats the name and may carry a different extra field
+        if (localOffset > size || zipLocalSize > size - localOffset || readUint32(data + localOffset) != zipLocalSignature) {
+            std::cerr << "Damaged ZIP entry: " << path << ": " << name << std::endl;
+            continue;
+        }
+        const BYTE* local = data + localOffset;
+        ZipEntry entry;
+        entry.name = name;
+        entry.offset = localOffset + zipLocalSize + readUint16(local + 26) + readUint16(local + 28);
+        entry.dataSize = dataSize;
+        entry.originalSize = originalSize;
+        entry.deflated = method == 8;
+        if (entry.offset > size || entry.dataSize > size - entry.offset || (!entry.deflated && entry.dataSize != entry.originalSize)) {
+            std::cerr << "Damaged ZIP entry: " << path << ": " << name << std::endl;
+            continue;
+        }
+        entries.push_back(entry);
+    }
+    return true;
+}
+
+// Bits are consumed from the low end of a 64-bit buffer; past the input it fills with zeros, and inflateRaw checks
+// at the end that no more than the input was used
+struct BitReader {
+    const BYTE* data;
+    size_t size;
+    size_t position = 0;
+    uint64_t bits = 0;
+    unsigned count = 0;
+};
+
+static void refill(BitReader& reader) {
+    while (reader.count <= 56) {
+        uint64_t byte = reader.position < reader.size ? reader.data[reader.position] : 0;
+        reader.bits |= byte << reader.count;
+        reader.count += 8;
+        ++reader.position;
+    }
+}
+
+static unsigned getBits(BitReader& reader, unsigned count) {
+    if (count == 0) {
+        return 0;
+    }
+    refill(reader);
+    unsigned value = unsigned(reader.bits & ((uint64_t(1) << count) - 1));
+    reader.bits >>= count;
+    reader.count -= count;
+    return value;
+}
+
+// Canonical Huffman code: codes up to fastBits long are one table lookup, (symbol << 4) | length; longer ones are
+// decoded a bit at a time from the per-length counts and the symbols sorted by length
+const unsigned fastBits = 10;
+
+struct Huffman {
+    uint16_t fast[1 << fastBits];
+    uint16_t counts[16];
+    uint16_t symbols[288];
+};
+
+static bool buildHuffman(Huffman& code, const BYTE* lengths, unsigned symbolCount) {
+    std::memset(code.fast, 0, sizeof(code.fast));
+    std::memset(code.counts, 0, sizeof(code.counts));
+    for (unsigned symbol = 0; symbol < symbolCount; ++symbol) {
+        ++code.counts[lengths[symbol]];
+    }
+    code.counts[0] = 0;
+    int left = 1;
+    for (unsigned length = 1; length < 16; ++length) {
+        left = (left << 1) - code.counts[length];
+        if (left < 0) {
+            return false;
+        }
+    }
+    uint16_t offsets[16] = {};
+    unsigned next[16] = {};
+    for (unsigned length = 1; length < 15; ++length) {
+        offsets[length + 1] = uint16_t(offsets[length] + code.counts[length]);
+        next[length + 1] = (next[length] + code.counts[length]) << 1;
+    }
+    for (unsigned symbol = 0; symbol < symbolCount; ++symbol) {
+        unsigned length = lengths[symbol];
+        if (length == 0) {
+            continue;
+        }
+        code.symbols[offsets[length]++] = uint16_t(symbol);
+        unsigned value = next[length]++;
+        if (length <= fastBits) {
+            unsigned reversed = 0;
+            for (unsigned bit = 0; bit < length; ++bit) {
+                reversed |= ((value >> bit) & 1) << (length - 1 - bit);
+            }
+            for (unsigned slot = reversed; slot < (1u << fastBits); slot += 1u << length) {
+                code.fast[slot] = uint16_t((symbol << 4) | length);
+            }
+        }
+    }
+    return true;
+}
+
+static int decodeSymbol(BitReader& reader, const Huffman& code) {
+    refill(reader);
+    unsigned entry = code.fast[reader.bits & ((1u << fastBits) - 1)];
+    if (entry) {
+        reader.bits >>= entry & 15;
+        reader.count -= entry & 15;
+        return int(entry >> 4);
+    }
+    int value = 0, first = 0, index = 0;
+    for (unsigned length = 1; length < 16; ++length) {
+        value |= int(reader.bits & 1);
+        reader.bits >>= 1;
+        --reader.count;
+        int count = code.counts[length];
+        if (value - first < count) {
+            return code.symbols[index + value - first];
+        }
+        index += count;
+        first = (first + count) << 1;
+        value <<= 1;
+    }
+    return -1;
+}
+
+static const uint16_t lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const BYTE lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t distanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537,
+    2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const BYTE distanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+static bool inflateBlock(BitReader& reader, const Huffman& literals, const Huffman& distances, BYTE* out, size_t outSize, size_t& written) {
+    for (;;) {
+        int symbol = decodeSymbol(reader, literals);
+        if (symbol < 256) {
+            if (symbol < 0 || written >= outSize) {
+                return false;
+            }
+            out[written++] = BYTE(symbol);
+            continue;
+        }
+        if (symbol == 256) {
+            return true;
+        }
+        symbol -= 257;
+        if (symbol >= 29) {
+            return false;
+        }
+        size_t length = lengthBase[symbol] + getBits(reader, lengthExtra[symbol]);
+        int distanceSymbol = decodeSymbol(reader, distances);
+        if (distanceSymbol < 0 || distanceSymbol >= 30) {
+            return false;
+        }
+        size_t distance = distanceBase[distanceSymbol] + getBits(reader, distanceExtra[distanceSymbol]);
+        if (distance > written || length > outSize - written) {
+            return false;
+        }
+        BYTE* target = out + written;
+        if (distance >= length) {
+            std::memcpy(target, target - distance, length);
+        }
+        else {
+            // Overlapping copies repeat the last distance bytes
+            for (size_t i = 0; i < length; ++i) {
+                target[i] = target[ptrdiff_t(i) - ptrdiff_t(distance)];
+            }
+        }
+        written += length;
+    }
+}
+
+static bool readDynamicCodes(BitReader& reader, Huffman& literals, Huffman& distances) {
+    static const BYTE order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+    unsigned literalCount = getBits(reader, 5) + 257;
+    unsigned distanceCount = getBits(reader, 5) + 1;
+    unsigned lengthCount = getBits(reader, 4) + 4;
+    BYTE codeLengths[19] = {};
+    for (unsigned i = 0; i < lengthCount; ++i) {
+        codeLengths[order[i]] = BYTE(getBits(reader, 3));
+    }
+    Huffman lengthCode;
+    if (literalCount > 286 || distanceCount > 30 || !buildHuffman(lengthCode, codeLengths, 19)) {
+        return false;
+    }
+    BYTE lengths[286 + 30] = {};
+    for (unsigned i = 0; i < literalCount + distanceCount;) {
+        int symbol = decodeSymbol(reader, lengthCode);
+        if (symbol < 0) {
+            return false;
+        }
+        if (symbol < 16) {
+            lengths[i++] = BYTE(symbol);
+            continue;
+        }
+        BYTE value = 0;
+        unsigned repeat;
+        if (symbol == 16) {
+            if (i == 0) {
+                return false;
+            }
+            value = lengths[i - 1];
+            repeat = 3 + getBits(reader, 2);
+        }
+        else {
+            repeat = symbol == 17 ? 3 + getBits(reader, 3) : 11 + getBits(reader, 7);
+        }
+        if (i + repeat > literalCount + distanceCount) {
+            return false;
+        }
+        std::memset(lengths + i, value, repeat);
+        i += repeat;
+    }
+    return lengths[256] != 0 && buildHuffman(literals, lengths, literalCount) && buildHuffman(distances, lengths + literalCount, distanceCount);
+}
+
+bool inflateRaw(const BYTE* in, size_t inSize, BYTE* out, size_t outSize) {
+    BitReader reader = { in, inSize };
+    size_t written = 0;
+    Huffman literals, distances;
+    for (bool last = false; !last;) {
+        last = getBits(reader, 1) != 0;
+        unsigned type = getBits(reader, 2);
+        if (type == 0) {
+            getBits(reader, reader.count % 8);
+            unsigned length = getBits(reader, 16);
+            if (getBits(reader, 16) != (~length & 0xFFFF) || length > outSize - written) {
+                return false;
+            }
+            // The bit buffer read ahead; the stored bytes are copied straight from the input instead
+            reader.position -= reader.count / 8;
+            reader.bits = 0;
+            reader.count = 0;
+            size_t available = reader.position < inSize ? inSize - reader.position : 0;
+            if (length > available) {
+                return false;
+            }
+            std::memcpy(out + written, in + reader.position, length);
+            reader.position += length;
+            written += length;
+            continue;
+        }
+        if (type == 1) {
+            BYTE lengths[288 + 30];
+            std::memset(lengths, 8, 144);
+            std::memset(lengths + 144, 9, 112);
+            std::memset(lengths + 256, 7, 24);
+            std::memset(lengths + 280, 8, 8);
+            std::memset(lengths + 288, 5, 30);
+            buildHuffman(literals, lengths, 288);
+            buildHuffman(distances, lengths + 288, 30);
+        }
+        else if (type != 2 || !readDynamicCodes(reader, literals, distances)) {
+            return false;
+        }
+        if (!inflateBlock(reader, literals, distances, out, outSize, written)) {
+            return false;
+        }
+    }
+    // Bytes the bit buffer read ahead are not part of the stream
+    return written == outSize && reader.position - reader.count / 8 <= inSize;
+}
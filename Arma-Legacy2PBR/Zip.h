@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <FreeImage.h>
+
+// A file in a ZIP central directory; offset is where its data starts, past the local header
+struct ZipEntry {
+    std::string name;
+    uint64_t offset = 0;
+    uint64_t dataSize = 0;
+    uint64_t originalSize = 0;
+    bool deflated = false;
+};
+
+// Parses the central directory of a mapped archive, ZIP64 included. Directories are left out; encrypted entries and
+// methods other than stored and deflate are skipped with a warning
+bool readZipDirectory(const std::string& path, const BYTE* data, size_t size, std::vector<ZipEntry>& entries);
+// Raw deflate (RFC 1951); false on damaged data or when the output is not exactly outSize bytes
+bool inflateRaw(const BYTE* in, size_t inSize, BYTE* out, size_t outSize);
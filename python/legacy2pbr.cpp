@@ -0,0 +1,302 @@
+// Python bindings for the NMO/BCR packing core.
+// Images are exchanged through the buffer protocol as uint8 arrays of shape (height, width, 4) in FreeImage
+// layout (BGRA, bottom-up rows), so numpy.asarray() on an input or a result never copies pixels.
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <string>
+#include <FreeImage.h>
+
+#include "CpuDispatch.h"
+
+// A FreeImage bitmap exposed as a read-write buffer; the bitmap lives as long as any view of it
+struct ImageObject {
+    PyObject_HEAD
+    FIBITMAP* dib;
+    Py_ssize_t shape[3];
+    Py_ssize_t strides[3];
+};
+
+static void imageDealloc(ImageObject* self) {
+    if (self->dib) {
+        FreeImage_Unload(self->dib);
+    }
+    Py_TYPE(self)->tp_free(reinterpret_cast<PyObject*>(self));
+}
+
+static int imageGetBuffer(ImageObject* self, Py_buffer* view, int flags) {
+    if (PyBuffer_FillInfo(view, reinterpret_cast<PyObject*>(self), FreeImage_GetBits(self->dib),
+        self->shape[0] * self->strides[0], 0, flags) < 0) {
+        return -1;
+    }
+    view->ndim = 3;
+    view->format = (flags & PyBUF_FORMAT) ? const_cast<char*>("B") : nullptr;
+    view->shape = (flags & PyBUF_ND) == PyBUF_ND ? self->shape : nullptr;
+    view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? self->strides : nullptr;
+    return 0;
+}
+
+static PyBufferProcs imageBufferProcs = {
+    reinterpret_cast<getbufferproc>(imageGetBuffer),
+    nullptr
+};
+
+static PyObject* imageWidth(ImageObject* self, void*) {
+    return PyLong_FromUnsignedLong(FreeImage_GetWidth(self->dib));
+}
+
+static PyObject* imageHeight(ImageObject* self, void*) {
+    return PyLong_FromUnsignedLong(FreeImage_GetHeight(self->dib));
+}
+
+static PyGetSetDef imageGetSet[] = {
+    { "width", reinterpret_cast<getter>(imageWidth), nullptr, "Width in pixels", nullptr },
+    { "height", reinterpret_cast<getter>(imageHeight), nullptr, "Height in pixels", nullptr },
+    { nullptr, nullptr, nullptr, nullptr, nullptr }
+};
+
+static PyTypeObject ImageType = {
+    PyVarObject_HEAD_INIT(nullptr, 0)
+    "legacy2pbr.Image",
+};
+
+// Takes ownership of dib (a 32-bit bitmap with unpadded rows)
+static PyObject* wrapImage(FIBITMAP* dib) {
+    ImageObject* image = PyObject_New(ImageObject, &ImageType);
+    if (!image) {
+        FreeImage_Unload(dib);
+        return nullptr;
+    }
+    image->dib = dib;
+    image->shape[0] = FreeImage_GetHeight(dib);
+    image->shape[1] = FreeImage_GetWidth(dib);
+    image->shape[2] = 4;
+    image->strides[0] = FreeImage_GetPitch(dib);
+    image->strides[1] = 4;
+    image->strides[2] = 1;
+    return reinterpret_cast<PyObject*>(image);
+}
+
+// Borrows a C-contiguous (height, width, 4) byte buffer without copying it
+static bool getPixels(PyObject* object, Py_buffer& view, const char* role, bool writable = false) {
+    if (PyObject_GetBuffer(object, &view, PyBUF_ND | PyBUF_C_CONTIGUOUS | (writable ? PyBUF_WRITABLE : 0)) < 0) {
+        return false;
+    }
+    if (view.itemsize != 1 || view.ndim != 3 || view.shape[2] != 4 || view.shape[0] <= 0 || view.shape[1] <= 0) {
+        PyErr_Format(PyExc_ValueError, "%s must be a uint8 array of shape (height, width, 4)", role);
+        PyBuffer_Release(&view);
+        return false;
+    }
+    return true;
+}
+
+static bool sameShape(const Py_buffer& a, const Py_buffer& b, const char* role) {
+    if (a.shape[0] != b.shape[0] || a.shape[1] != b.shape[1]) {
+        PyErr_Format(PyExc_ValueError, "%s has different dimensions", role);
+        return false;
+    }
+    return true;
+}
+
+static FIBITMAP* allocateOutput(const Py_buffer& reference) {
+    FIBITMAP* dib = FreeImage_Allocate(int(reference.shape[1]), int(reference.shape[0]), 32);
+    if (!dib) {
+        PyErr_NoMemory();
+    }
+    return dib;
+}
+
+static PyObject* packNmo(PyObject*, PyObject* args) {
+    PyObject *nohqObject, *smdiObject, *asObject;
+    if (!PyArg_ParseTuple(args, "OOO:pack_nmo", &nohqObject, &smdiObject, &asObject)) {
+        return nullptr;
+    }
+    Py_buffer nohq, smdi, as;
+    if (!getPixels(nohqObject, nohq, "nohq")) {
+        return nullptr;
+    }
+    if (!getPixels(smdiObject, smdi, "smdi")) {
+        PyBuffer_Release(&nohq);
+        return nullptr;
+    }
+    if (!getPixels(asObject, as, "as")) {
+        PyBuffer_Release(&nohq);
+        PyBuffer_Release(&smdi);
+        return nullptr;
+    }
+    FIBITMAP* dib = nullptr;
+    if (sameShape(nohq, smdi, "smdi") && sameShape(nohq, as, "as")) {
+        dib = allocateOutput(nohq);
+    }
+    if (dib) {
+        BYTE* out = FreeImage_GetBits(dib);
+        size_t pixels = size_t(nohq.shape[0]) * size_t(nohq.shape[1]);
+        Py_BEGIN_ALLOW_THREADS
+        kernels().packNmo(out, static_cast<BYTE*>(nohq.buf), static_cast<BYTE*>(smdi.buf), static_cast<BYTE*>(as.buf), pixels);
+        Py_END_ALLOW_THREADS
+    }
+    PyBuffer_Release(&nohq);
+    PyBuffer_Release(&smdi);
+    PyBuffer_Release(&as);
+    return dib ? wrapImage(dib) : nullptr;
+}
+
+static PyObject* packBcr(PyObject*, PyObject* args) {
+    PyObject *coObject, *smdiObject;
+    if (!PyArg_ParseTuple(args, "OO:pack_bcr", &coObject, &smdiObject)) {
+        return nullptr;
+    }
+    Py_buffer co, smdi;
+    if (!getPixels(coObject, co, "co")) {
+        return nullptr;
+    }
+    if (!getPixels(smdiObject, smdi, "smdi")) {
+        PyBuffer_Release(&co);
+        return nullptr;
+    }
+    FIBITMAP* dib = nullptr;
+    if (sameShape(co, smdi, "smdi")) {
+        dib = allocateOutput(co);
+    }
+    if (dib) {
+        BYTE* out = FreeImage_GetBits(dib);
+        size_t pixels = size_t(co.shape[0]) * size_t(co.shape[1]);
+        Py_BEGIN_ALLOW_THREADS
+        kernels().packBcr(out, static_cast<BYTE*>(co.buf), static_cast<BYTE*>(smdi.buf), pixels);
+        Py_END_ALLOW_THREADS
+    }
+    PyBuffer_Release(&co);
+    PyBuffer_Release(&smdi);
+    return dib ? wrapImage(dib) : nullptr;
+}
+
+static PyObject* load(PyObject*, PyObject* args) {
+    const char* filename;
+    if (!PyArg_ParseTuple(args, "s:load", &filename)) {
+        return nullptr;
+    }
+    FREE_IMAGE_FORMAT format = FreeImage_GetFIFFromFilename(filename);
+    if (format == FIF_UNKNOWN) {
+        PyErr_Format(PyExc_ValueError, "Unknown image format: %s", filename);
+        return nullptr;
+    }
+    FIBITMAP* dib;
+    Py_BEGIN_ALLOW_THREADS
+    dib = FreeImage_Load(format, filename);
+    if (dib && (FreeImage_GetBPP(dib) != 32 || FreeImage_GetImageType(dib) != FIT_BITMAP)) {
+        FIBITMAP* converted = FreeImage_ConvertTo32Bits(dib);
+        FreeImage_Unload(dib);
+        dib = converted;
+    }
+    Py_END_ALLOW_THREADS
+    if (!dib) {
+        PyErr_Format(PyExc_OSError, "Failed to load image: %s", filename);
+        return nullptr;
+    }
+    return wrapImage(dib);
+}
+
+static PyObject* save(PyObject*, PyObject* args) {
+    PyObject* imageObject;
+    const char* filename;
+    if (!PyArg_ParseTuple(args, "Os:save", &imageObject, &filename)) {
+        return nullptr;
+    }
+    FREE_IMAGE_FORMAT format = FreeImage_GetFIFFromFilename(filename);
+    if (format == FIF_UNKNOWN) {
+        PyErr_Format(PyExc_ValueError, "Unknown image format: %s", filename);
+        return nullptr;
+    }
+    Py_buffer image;
+    if (!getPixels(imageObject, image, "image")) {
+        return nullptr;
+    }
+    // Same encoder settings as the converter
+    int flags = (format == FIF_TARGA) ? TARGA_DEFAULT :
+        (format == FIF_TIFF) ? TIFF_NONE :
+        (format == FIF_PNG) ? PNG_Z_NO_COMPRESSION : 0;
+    BOOL saved = FALSE;
+    Py_BEGIN_ALLOW_THREADS
+    // Header-only bitmap over the caller's pixels
+    FIBITMAP* dib = FreeImage_ConvertFromRawBitsEx(FALSE, static_cast<BYTE*>(image.buf), FIT_BITMAP, int(image.shape[1]),
+        int(image.shape[0]), int(image.shape[1] * 4), 32, FI_RGBA_RED_MASK, FI_RGBA_GREEN_MASK, FI_RGBA_BLUE_MASK, FALSE);
+    if (dib) {
+        saved = FreeImage_Save(format, dib, filename, flags);
+        FreeImage_Unload(dib);
+    }
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&image);
+    if (!saved) {
+        PyErr_Format(PyExc_OSError, "Failed to save image: %s", filename);
+        return nullptr;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* isa(PyObject*, PyObject*) {
+    return PyUnicode_FromString(isaName(activeIsa()));
+}
+
+static PyObject* selectIsaLevel(PyObject*, PyObject* args) {
+    const char* name;
+    if (!PyArg_ParseTuple(args, "s:select_isa", &name)) {
+        return nullptr;
+    }
+    IsaLevel level;
+    if (!parseIsaLevel(name, level)) {
+        PyErr_Format(PyExc_ValueError, "Unknown instruction set: %s", name);
+        return nullptr;
+    }
+    return PyBool_FromLong(selectIsa(level));
+}
+
+static PyMethodDef methods[] = {
+    { "pack_nmo", packNmo, METH_VARARGS, "pack_nmo(nohq, smdi, as_) -> Image\nNMO = (B: SMDI.G, G: NOHQ.G, R: NOHQ.R, A: AS.G)" },
+    { "pack_bcr", packBcr, METH_VARARGS, "pack_bcr(co, smdi) -> Image\nBCR = (BGR: CO.BGR, A: SMDI.B)" },
+    { "load", load, METH_VARARGS, "load(filename) -> Image\nDecodes any FreeImage format to 32-bit BGRA." },
+    { "save", save, METH_VARARGS, "save(image, filename)\nEncodes by extension (.tga, .tif, .png)." },
+    { "isa", isa, METH_NOARGS, "isa() -> str\nInstruction set of the active packing kernels." },
+    { "select_isa", selectIsaLevel, METH_VARARGS, "select_isa(name) -> bool\nForces scalar, sse2, avx2 or avx512 kernels." },
+    { nullptr, nullptr, 0, nullptr }
+};
+
+static void freeModule(void*) {
+    FreeImage_DeInitialise();
+}
+
+static PyModuleDef moduleDef = {
+    PyModuleDef_HEAD_INIT,
+    "legacy2pbr",
+    "Arma-Legacy2PBR channel packing. Arrays are uint8 (height, width, 4), BGRA, bottom-up rows.",
+    -1,
+    methods,
+    nullptr,
+    nullptr,
+    nullptr,
+    freeModule
+};
+
+PyMODINIT_FUNC PyInit_legacy2pbr() {
+    ImageType.tp_basicsize = sizeof(ImageObject);
+    ImageType.tp_flags = Py_TPFLAGS_DEFAULT;
+    ImageType.tp_doc = "Packed or decoded pixels; numpy.asarray(image) shares them without copying";
+    ImageType.tp_dealloc = reinterpret_cast<destructor>(imageDealloc);
+    ImageType.tp_as_buffer = &imageBufferProcs;
+    ImageType.tp_getset = imageGetSet;
+    if (PyType_Ready(&ImageType) < 0) {
+        return nullptr;
+    }
+    PyObject* module = PyModule_Create(&moduleDef);
+    if (!module) {
+        return nullptr;
+    }
+    Py_INCREF(&ImageType);
+    if (PyModule_AddObject(module, "Image", reinterpret_cast<PyObject*>(&ImageType)) < 0) {
+        Py_DECREF(&ImageType);
+        Py_DECREF(module);
+        return nullptr;
+    }
+    FreeImage_Initialise();
+    selectIsa(detectIsa());
+    return module;
+}
@@ -0,0 +1,28 @@
+# Builds the legacy2pbr extension: python setup.py build_ext --inplace
+# FREEIMAGE_DIR points at the folder holding FreeImage.h and the FreeImage import library.
+import os
+from setuptools import setup, Extension
+
+core = os.path.join("..", "Arma-Legacy2PBR")
+freeimage = os.environ.get("FREEIMAGE_DIR")
+
+if os.name == "nt":
+    compile_args = ["/std:c++17", "/O2", "/EHsc"]
+else:
+    compile_args = ["-std=c++17", "-O2"]
+
+setup(
+    name="legacy2pbr",
+    version="1.1.0",
+    description="Arma-Legacy2PBR NMO/BCR channel packing",
+    ext_modules=[
+        Extension(
+            "legacy2pbr",
+            sources=["legacy2pbr.cpp", os.path.join(core, "CpuDispatch.cpp"), os.path.join(core, "Kernels.cpp")],
+            include_dirs=[core] + ([freeimage] if freeimage else []),
+            library_dirs=[freeimage] if freeimage else [],
+            libraries=["FreeImage"],
+            extra_compile_args=compile_args,
+        )
+    ],
+)